@@ -0,0 +1,70 @@
+#ifndef ALIGNED_ALLOCATOR_H_
+#define ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace GLOO {
+// An std::allocator replacement that aligns every allocation to Alignment
+// bytes, so that SIMD code can use aligned loads on the buffer.
+template <class T, size_t Alignment = 64>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+
+  template <class U>
+  struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() {
+  }
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {
+  }
+
+  T* allocate(size_t n) {
+    if (n == 0) {
+      return nullptr;
+    }
+    void* p = nullptr;
+#ifdef _WIN32
+    p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+    if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+      p = nullptr;
+    }
+#endif
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, size_t) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+  }
+};
+
+template <class T, class U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return true;
+}
+template <class T, class U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return false;
+}
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef BOUNDARY_BASE_H_
+#define BOUNDARY_BASE_H_
+
+#include <memory>
+#include <vector>
+
+#include "ParticleState.hpp"
+
+namespace GLOO {
+// A collider that keeps particles inside (or outside) some region. Particles
+// that crossed it during a step are moved back and get the normal part of
+// their velocity reflected and scaled by the restitution.
+class BoundaryBase {
+ public:
+  virtual ~BoundaryBase() {
+  }
+
+  // Handles the particles in [begin, end), which lies inside
+  // [0, state.positions.size()).
+  virtual void Apply(ParticleState& state, size_t begin, size_t end) const = 0;
+};
+
+typedef std::vector<std::shared_ptr<BoundaryBase>> BoundaryList;
+
+// Runs all boundaries in a single parallel pass, so each block of particles
+// is handled by every boundary while it is still in cache.
+inline void ApplyBoundaries(const BoundaryList& boundaries, ParticleState& state) {
+  size_t n = state.positions.size();
+  if (boundaries.empty() || n == 0) {
+    return;
+  }
+  ParallelForPadded(state.positions.GetPaddedSize(), [&](size_t begin, size_t end) {
+    // Leave the padding alone, a boundary may not contain the origin
+    end = std::min(end, n);
+    for (const std::shared_ptr<BoundaryBase>& boundary : boundaries) {
+      boundary->Apply(state, begin, end);
+    }
+  });
+}
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef BOX_BOUNDARY_H_
+#define BOX_BOUNDARY_H_
+
+#include <algorithm>
+
+#include "BoundaryBase.hpp"
+
+namespace GLOO {
+// Keeps the particles inside an axis aligned box
+class BoxBoundary : public BoundaryBase {
+ public:
+  BoxBoundary(glm::vec3 min, glm::vec3 max, float restitution = 0.3f)
+      : min_(min), max_(max), restitution_(restitution) {
+  }
+
+  void Apply(ParticleState& state, size_t begin, size_t end) const override {
+    for (int axis = 0; axis < 3; axis++) {
+      ClampAxis(state.positions.component(axis) + begin,
+                state.velocities.component(axis) + begin,
+                end - begin, min_[axis], max_[axis]);
+    }
+  }
+
+ private:
+  // Moves every particle outside of [lo, hi] along one axis back inside,
+  // and reflects and damps its velocity if it still points into the wall
+  // it crossed. Written without branches so that it vectorizes.
+  void ClampAxis(float* __restrict p, float* __restrict v, size_t n,
+                 float lo, float hi) const {
+    // Particles that hit a wall are placed slightly inside of it
+    float inner_lo = lo + eps_;
+    float inner_hi = hi - eps_;
+    float damping = -restitution_;
+    for (size_t i = 0; i < n; i++) {
+      float x = p[i];
+      bool below = x < lo;
+      bool above = x > hi;
+      bool out = below | above;
+      // Inside the box the clamp to [lo, hi] leaves x unchanged
+      float bound_lo = out ? inner_lo : lo;
+      float bound_hi = out ? inner_hi : hi;
+      // Particles already moving back in keep their velocity
+      bool into_wall = (below & (v[i] < 0.f)) | (above & (v[i] > 0.f));
+      float scale = into_wall ? damping : 1.f;
+      v[i] = v[i] * scale;
+      p[i] = std::min(std::max(x, bound_lo), bound_hi);
+    }
+  }
+
+  glm::vec3 min_;
+  glm::vec3 max_;
+  float restitution_;
+  float eps_ = 0.001f;
+};
+}  // namespace GLOO
+
+#endif
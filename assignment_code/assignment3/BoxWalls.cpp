@@ -0,0 +1,77 @@
+#include "BoxWalls.hpp"
+#include "WaterSystem.hpp"
+#include "SimulationBox.hpp"
+#include <math.h>
+#include <algorithm>
+
+namespace GLOO {
+
+float BoxWalls::Density(glm::vec3 p) const {
+	float rho = 0.f;
+	for (int axis = 0; axis < 3; axis++) {
+		rho += Density(p[axis] - BOX_MIN[axis]) + Density(BOX_MAX[axis] - p[axis]);
+	}
+	return rho;
+}
+
+glm::vec3 BoxWalls::DensityGradient(glm::vec3 p) const {
+	glm::vec3 gradient(0.f);
+	for (int axis = 0; axis < 3; axis++) {
+		gradient[axis] = DensityDerivative(p[axis] - BOX_MIN[axis]) -
+										 DensityDerivative(BOX_MAX[axis] - p[axis]);
+	}
+	return gradient;
+}
+
+glm::vec3 BoxWalls::PressureGradient(glm::vec3 p) const {
+	glm::vec3 gradient(0.f);
+	for (int axis = 0; axis < 3; axis++) {
+		gradient[axis] = PressureDerivative(p[axis] - BOX_MIN[axis]) -
+										 PressureDerivative(BOX_MAX[axis] - p[axis]);
+	}
+	return gradient;
+}
+
+float BoxWalls::Density(float distance) const {
+	if (distance >= H) {
+		return 0.f;
+	}
+	distance = std::max(0.f, distance);
+	return rest_density_ * (KernelIntegral(H) - KernelIntegral(distance)) /
+				 (2.f*KernelIntegral(H));
+}
+
+float BoxWalls::DensityDerivative(float distance) const {
+	if (distance >= H) {
+		return 0.f;
+	}
+	distance = std::max(0.f, distance);
+	float t = HSQ - distance*distance;
+	return -rest_density_ * t*t*t*t / (2.f*KernelIntegral(H));
+}
+
+float BoxWalls::PressureDerivative(float distance) const {
+	if (distance >= H) {
+		return 0.f;
+	}
+	distance = std::max(0.f, distance);
+	// The SPIKY gradient integrated over the fluid behind the wall, at the
+	// particle density that makes the POLY6 integral the rest density
+	float r = distance;
+	float r2 = r*r;
+	float integral = HSQ*(H*HSQ - r*r2)/3.f - H*(HSQ*HSQ - r2*r2)/2.f +
+									 (HSQ*HSQ*H - r2*r2*r)/5.f - r2*HSQ*(H - r) +
+									 H*r2*(HSQ - r2) - r2*(H*HSQ - r*r2)/3.f;
+	return rest_density_ * 3.1415f*MullerKernels::kSpikyGrad * integral /
+				 (MullerKernels::kPoly6 * 3.1415f/2.f * KernelIntegral(H));
+}
+
+float BoxWalls::KernelIntegral(float z) {
+	// Antiderivative of (H^2 - z^2)^4, the integral of POLY6 over the plane
+	// at distance z up to a constant
+	float z2 = z*z;
+	return z*((float)IntPow(H, 8) - 4.f/3.f*(float)IntPow(H, 6)*z2 + 6.f/5.f*(float)IntPow(H, 4)*z2*z2 -
+						4.f/7.f*HSQ*z2*z2*z2 + z2*z2*z2*z2/9.f);
+}
+
+}  // namespace GLOO
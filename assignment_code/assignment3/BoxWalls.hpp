@@ -0,0 +1,36 @@
+#ifndef BOX_WALLS_H_
+#define BOX_WALLS_H_
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+
+// The walls of the simulation box as fluid at rest density behind them, for
+// the incompressible solvers. Without it the particles at a wall only see
+// half a neighborhood and pile up until they reach the rest density.
+class BoxWalls {
+ public:
+	explicit BoxWalls(float rest_density = 0.f) : rest_density_(rest_density) {
+	}
+
+	void SetRestDensity(float rest_density) { rest_density_ = rest_density; }
+
+	// The POLY6 density the walls add at p and its gradient
+	float Density(glm::vec3 p) const;
+	glm::vec3 DensityGradient(glm::vec3 p) const;
+	// The sum of mass times the SPIKY gradient over the fluid behind the
+	// walls, which the pressure accelerations use
+	glm::vec3 PressureGradient(glm::vec3 p) const;
+
+ private:
+	// The same for a single wall at distance from p
+	float Density(float distance) const;
+	float DensityDerivative(float distance) const;
+	float PressureDerivative(float distance) const;
+	static float KernelIntegral(float z);
+
+	float rest_density_;
+};
+}  // namespace GLOO
+
+#endif
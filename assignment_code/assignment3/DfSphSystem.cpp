@@ -0,0 +1,315 @@
+#include "DfSphSystem.hpp"
+#include "ThreadPool.hpp"
+#include "SimulationBox.hpp"
+#include "MortonOrder.hpp"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+
+namespace GLOO {
+
+DfSphSystem::DfSphSystem() {
+	grid_ = NeighborGrid(BOX_MIN, BOX_SIZE, grid_cell_size_);
+	walls_.SetRestDensity(rest_density_);
+}
+
+void DfSphSystem::SetRestDensity(float rest_density) {
+	rest_density_ = rest_density;
+	walls_.SetRestDensity(rest_density);
+}
+
+void DfSphSystem::SetTolerances(float tolerance, float divergence_tolerance) {
+	tolerance_ = tolerance;
+	divergence_tolerance_ = divergence_tolerance;
+}
+
+ParticleState DfSphSystem::ComputeTimeDerivative(const ParticleState& state,
+																								 float time) {
+	ParticleState derivative;
+	ComputeTimeDerivative(state, time, derivative);
+	return derivative;
+}
+
+void DfSphSystem::ComputeTimeDerivative(const ParticleState& state,
+																				float time,
+																				ParticleState& derivative) {
+	Solve(state, time_step_);
+	// The positions move with the solved velocities, so that an Euler step
+	// of time_step_ is the step the densities were corrected for
+	int n = state.positions.size();
+	float inv_dt = 1.f / time_step_;
+	derivative.positions = velocities_;
+	derivative.velocities.resize(n);
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			derivative.velocities[i] = inv_dt * (glm::vec3(velocities_[i]) - glm::vec3(state.velocities[i]));
+		}
+	}, kParticleGrain);
+}
+
+bool DfSphSystem::Advance(ParticleState& state, float time, float dt) {
+	time_step_ = dt;
+	Solve(state, dt);
+	ThreadPool::GetInstance().ParallelFor(0, state.positions.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 v = velocities_[i];
+			state.velocities[i] = v;
+			state.positions[i] = glm::vec3(state.positions[i]) + dt*v;
+		}
+	}, kParticleGrain);
+	return true;
+}
+
+void DfSphSystem::OnParticlesPermuted(const std::vector<int>& order) {
+	neighbors_.Invalidate();
+	// The warm start follows the particles. If particles were added since
+	// the last step it no longer lines up with them, so it starts over.
+	if (density_stiffnesses_.size() == order.size()) {
+		PermuteArray(density_stiffnesses_, order);
+	} else {
+		density_stiffnesses_.clear();
+	}
+	if (divergence_stiffnesses_.size() == order.size()) {
+		PermuteArray(divergence_stiffnesses_, order);
+	} else {
+		divergence_stiffnesses_.clear();
+	}
+}
+
+void DfSphSystem::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
+	state.positions.push_back(position);
+	state.velocities.push_back(velocity);
+}
+
+void DfSphSystem::Solve(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	UpdateNeighbors(state);
+	ComputeDensitiesAndFactors(state);
+	velocities_ = state.velocities;
+	// Particles added since the last step start without pressure
+	stiffnesses_.resize(n);
+	density_stiffnesses_.resize(n, 0.f);
+	divergence_stiffnesses_.resize(n, 0.f);
+
+	// The paper ends each step with the divergence solve at the new
+	// positions. Doing it first instead, after the boundaries moved the
+	// particles, needs only one neighbor and density update per step.
+	divergence_iterations_ = SolveDivergence(state, dt);
+	AddNonPressureAccelerations(state, dt);
+	density_iterations_ = SolveDensity(state, dt);
+
+	float max_acceleration_sq = 0.f;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 dv = glm::vec3(velocities_[i]) - glm::vec3(state.velocities[i]);
+			chunk_max = std::max(chunk_max, glm::dot(dv, dv));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_acceleration_sq = std::max(max_acceleration_sq, chunk_max);
+	}, kParticleGrain);
+	max_acceleration_ = sqrt(max_acceleration_sq) / dt;
+}
+
+void DfSphSystem::UpdateNeighbors(const ParticleState& state) {
+	if (neighbors_.NeedsRebuild(state.positions)) {
+		grid_.Build(state.positions);
+		neighbors_.Build(grid_, state.positions, H, skin_);
+	}
+}
+
+void DfSphSystem::ComputeDensitiesAndFactors(const ParticleState& state) {
+	int n = state.positions.size();
+	rhos_.resize(n);
+	factors_.resize(n);
+	wall_gradients_.resize(n);
+	pair_offsets_.resize(n + 1);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	// The list includes the skin, so count the pairs inside the kernel
+	// before laying them out
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = state.positions[i];
+			int count = 0;
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(state.positions[j]);
+				float d2 = glm::dot(r, r);
+				if (i != j && d2 < HSQ) {
+					count++;
+				}
+			});
+			pair_offsets_[i + 1] = count;
+		}
+	}, kParticleGrain);
+	pair_offsets_[0] = 0;
+	for (int i = 0; i < n; i++) {
+		pair_offsets_[i + 1] += pair_offsets_[i];
+	}
+	pair_neighbors_.resize(pair_offsets_[n]);
+	pair_gradients_.resize(pair_offsets_[n]);
+
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = state.positions[i];
+			float rho = walls_.Density(p);
+			glm::vec3 wall_gradient = walls_.PressureGradient(p);
+			glm::vec3 grad_sum = wall_gradient;
+			float grad_sq_sum = 0.f;
+			int pair = pair_offsets_[i];
+			// Includes the particle itself
+			rho += MASS*MullerKernels::Density(0.f);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(state.positions[j]);
+				float d2 = glm::dot(r, r);
+				if (i != j && d2 < HSQ) {
+					rho += MASS*MullerKernels::Density(d2);
+					float d = sqrt(d2);
+					// Coincident particles push each other nowhere
+					glm::vec3 grad = d > 0.f ? MASS*MullerKernels::PressureGradient(d) * r/d : glm::vec3(0.f);
+					grad_sum += grad;
+					grad_sq_sum += glm::dot(grad, grad);
+					pair_neighbors_[pair] = j;
+					pair_gradients_[pair] = grad;
+					pair++;
+				}
+			});
+			rhos_[i] = rho;
+			wall_gradients_[i] = wall_gradient;
+			float denominator = glm::dot(grad_sum, grad_sum) + grad_sq_sum;
+			factors_[i] = denominator > 1e-6f ? 1.f / denominator : 0.f;
+		}
+	}, kParticleGrain);
+}
+
+void DfSphSystem::AddNonPressureAccelerations(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = state.positions[i];
+			glm::vec3 v = state.velocities[i];
+			glm::vec3 visc(0.f);
+			for (int pair = pair_offsets_[i]; pair < pair_offsets_[i + 1]; pair++) {
+				int j = pair_neighbors_[pair];
+				float d = glm::length(glm::vec3(state.positions[j]) - p);
+				visc += VISC*MASS*(glm::vec3(state.velocities[j]) - v)/rhos_[j] * MullerKernels::ViscosityLaplacian(d);
+			}
+			velocities_[i] = glm::vec3(velocities_[i]) + dt*(GRAVITY + visc/rhos_[i]);
+		}
+	}, kParticleGrain);
+}
+
+void DfSphSystem::ComputeDensityRates() {
+	int n = velocities_.size();
+	rates_.resize(n);
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 v = velocities_[i];
+			// The walls stand still
+			float rate = glm::dot(v, glm::vec3(wall_gradients_[i]));
+			for (int pair = pair_offsets_[i]; pair < pair_offsets_[i + 1]; pair++) {
+				int j = pair_neighbors_[pair];
+				rate += glm::dot(v - glm::vec3(velocities_[j]), glm::vec3(pair_gradients_[pair]));
+			}
+			rates_[i] = rate;
+		}
+	}, kParticleGrain);
+}
+
+void DfSphSystem::ApplyPressures(const std::vector<float>& stiffnesses, float dt) {
+	int n = velocities_.size();
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			float k = stiffnesses[i];
+			// The fluid behind the walls has the particle's own pressure
+			glm::vec3 a = k * glm::vec3(wall_gradients_[i]);
+			for (int pair = pair_offsets_[i]; pair < pair_offsets_[i + 1]; pair++) {
+				int j = pair_neighbors_[pair];
+				a += (k + stiffnesses[j]) * glm::vec3(pair_gradients_[pair]);
+			}
+			velocities_[i] = glm::vec3(velocities_[i]) - dt*a;
+		}
+	}, kParticleGrain);
+}
+
+int DfSphSystem::SolveDivergence(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	// Half of the last step's pressures, as in SPlisHSPlasH, since the full
+	// ones overshoot wherever the flow slowed down
+	for (int i = 0; i < n; i++) {
+		divergence_stiffnesses_[i] = warm_start_ ? 0.5f*divergence_stiffnesses_[i] : 0.f;
+	}
+	if (warm_start_) {
+		ApplyPressures(divergence_stiffnesses_, dt);
+	}
+
+	float inv_dt = 1.f / dt;
+	int iterations = 0;
+	while (true) {
+		ComputeDensityRates();
+		float error_sum = pool.ParallelSum<float>(0, n, [&](int begin, int end) {
+			float chunk_sum = 0.f;
+			for (int i = begin; i < end; i++) {
+				// Expanding regions are left to gravity, negative pressures
+				// would pull the free surface together. Splashes are left alone
+				// too, a few neighbors or a wall at the edge of the kernel
+				// give tiny gradients and huge pressures.
+				float rate = pair_offsets_[i + 1] - pair_offsets_[i] < min_divergence_neighbors_ ? 0.f : std::max(0.f, rates_[i]);
+				stiffnesses_[i] = inv_dt * rate * factors_[i];
+				chunk_sum += rate;
+			}
+			return chunk_sum;
+		}, kParticleGrain);
+		float error = n > 0 ? dt * error_sum / (n * rest_density_) : 0.f;
+		if (iterations >= max_iterations_ ||
+				(iterations >= 1 && error < divergence_tolerance_)) {
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			divergence_stiffnesses_[i] += stiffnesses_[i];
+		}
+		ApplyPressures(stiffnesses_, dt);
+		iterations++;
+	}
+	return iterations;
+}
+
+int DfSphSystem::SolveDensity(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	for (int i = 0; i < n; i++) {
+		density_stiffnesses_[i] = warm_start_ ? 0.5f*density_stiffnesses_[i] : 0.f;
+	}
+	if (warm_start_) {
+		ApplyPressures(density_stiffnesses_, dt);
+	}
+
+	float inv_dt2 = 1.f / (dt*dt);
+	int iterations = 0;
+	while (true) {
+		ComputeDensityRates();
+		float error_sum = pool.ParallelSum<float>(0, n, [&](int begin, int end) {
+			float chunk_sum = 0.f;
+			for (int i = begin; i < end; i++) {
+				float error = std::max(0.f, rhos_[i] + dt*rates_[i] - rest_density_);
+				stiffnesses_[i] = inv_dt2 * error * factors_[i];
+				chunk_sum += error;
+			}
+			return chunk_sum;
+		}, kParticleGrain);
+		density_error_ = n > 0 ? error_sum / (n * rest_density_) : 0.f;
+		if (iterations >= max_iterations_ ||
+				(iterations >= min_iterations_ && density_error_ < tolerance_)) {
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			density_stiffnesses_[i] += stiffnesses_[i];
+		}
+		ApplyPressures(stiffnesses_, dt);
+		iterations++;
+	}
+	return iterations;
+}
+
+}  // namespace GLOO
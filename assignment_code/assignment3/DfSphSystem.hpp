@@ -0,0 +1,123 @@
+#ifndef DFSPH_SYSTEM_H_
+#define DFSPH_SYSTEM_H_
+
+#include "ParticleState.hpp"
+#include "ParticleSystemBase.hpp"
+#include "NeighborGrid.hpp"
+#include "NeighborList.hpp"
+#include "WaterSystem.hpp"
+#include "BoxWalls.hpp"
+
+namespace GLOO {
+
+// Divergence-free SPH (Bender and Koschier 2015). Every step first removes
+// the velocity divergence, then corrects the velocities until the density
+// predicted for the end of the step is within a tolerance of the rest
+// density. Both solvers start from the pressures of the previous step, and
+// all their iterations reuse one neighbor list and one set of densities.
+class DfSphSystem : public ParticleSystemBase {
+ public:
+	DfSphSystem();
+	virtual ~DfSphSystem() {
+	}
+
+	// The velocity change of a step of SetTimeStep, or the dt of the last
+	// Advance, divided by that step
+	ParticleState ComputeTimeDerivative(const ParticleState& state,
+																			float time) override;
+	void ComputeTimeDerivative(const ParticleState& state,
+														 float time,
+														 ParticleState& derivative) override;
+	// Solves the velocities for dt and moves the particles with them
+	bool Advance(ParticleState& state, float time, float dt) override;
+
+	void OnParticlesPermuted(const std::vector<int>& order) override;
+
+	float GetSmoothingLength() const override { return H; }
+	float GetKinematicViscosity() const override { return VISC/rest_density_; }
+	float GetMaxAcceleration() const override { return max_acceleration_; }
+	int GetSolverIterations() const override {
+		return density_iterations_ + divergence_iterations_;
+	}
+
+	void AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity);
+
+	void SetTimeStep(float dt) { time_step_ = dt; }
+	void SetRestDensity(float rest_density);
+	// The density solver stops once the average density error is below
+	// tolerance * rest density, the divergence solver once the average
+	// density change over a step is below divergence_tolerance * rest density
+	void SetTolerances(float tolerance, float divergence_tolerance);
+	void SetMaxIterations(int max_iterations) { max_iterations_ = max_iterations; }
+	// Starting each solve from the pressures of the last step usually
+	// halves the iterations
+	void UseWarmStart(bool enabled) { warm_start_ = enabled; }
+	int GetDensityIterations() const { return density_iterations_; }
+	int GetDivergenceIterations() const { return divergence_iterations_; }
+	// The average relative density error left after the last solve
+	float GetDensityError() const { return density_error_; }
+
+ private:
+	// Fills velocities_ with the velocities at the end of a step of dt
+	void Solve(const ParticleState& state, float dt);
+	void UpdateNeighbors(const ParticleState& state);
+	// Densities and the factors turning a density error into a pressure.
+	// Also lays out the pairs inside the kernel with their gradients, which
+	// stay fixed while the solvers only change velocities.
+	void ComputeDensitiesAndFactors(const ParticleState& state);
+	void AddNonPressureAccelerations(const ParticleState& state, float dt);
+	// Jacobi iterations on the density change rate of every particle. The
+	// density solver drives rho + dt*rate to the rest density, the
+	// divergence solver drives the rate to zero.
+	int SolveDivergence(const ParticleState& state, float dt);
+	int SolveDensity(const ParticleState& state, float dt);
+	// The rate at which the velocities change the density of each
+	// particle, stored in rates_
+	void ComputeDensityRates();
+	// v -= dt * pressure acceleration of stiffnesses
+	void ApplyPressures(const std::vector<float>& stiffnesses, float dt);
+
+	NeighborGrid grid_;
+	float grid_cell_size_ = 0.25f;
+	float skin_ = 0.04f;
+	NeighborList neighbors_;
+	BoxWalls walls_;
+
+	std::vector<float> rhos_;
+	// 1/(|sum m grad W|^2 + sum |m grad W|^2), or 0 for particles too
+	// isolated to be compressed
+	std::vector<float> factors_;
+	// The pairs of particle i are pair_offsets_[i] to pair_offsets_[i + 1],
+	// with mass times the SPIKY gradient at i
+	std::vector<int> pair_offsets_;
+	std::vector<int> pair_neighbors_;
+	Vec3Array pair_gradients_;
+	Vec3Array wall_gradients_;
+	std::vector<float> rates_;
+	// Pressure over density squared of the current iteration, and their sums
+	// over the step, kept for the warm start of the next one
+	std::vector<float> stiffnesses_;
+	std::vector<float> density_stiffnesses_;
+	std::vector<float> divergence_stiffnesses_;
+	Vec3Array velocities_;
+
+	// Same as PciSphSystem, REST_DENS is only the zero of the equation of
+	// state of WaterSystem
+	float rest_density_ = 30.f;
+	bool warm_start_ = true;
+	float time_step_ = 0.005f;
+	float tolerance_ = 0.001f;
+	float divergence_tolerance_ = 0.01f;
+	int min_iterations_ = 2;
+	// About two thirds of a full neighborhood at rest density
+	int min_divergence_neighbors_ = 20;
+	int max_iterations_ = 100;
+
+	int density_iterations_ = 0;
+	int divergence_iterations_ = 0;
+	float density_error_ = 0.f;
+	float max_acceleration_ = 0.f;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,113 @@
+#include "DistributedSimulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "IntegratorFactory.hpp"
+#include "SlabDecomposition.hpp"
+#include "SocketTransport.hpp"
+#include "ThreadPool.hpp"
+#include "WaterSystem.hpp"
+
+namespace GLOO {
+
+namespace {
+// Distance a particle may drift out of its slab before it migrates
+const float kMigrationSkin = 0.04f;
+// Steps between two reports of the particle counts
+const int kReportInterval = 100;
+
+void PrintCounts(SlabDecomposition& domain, const ParticleState& state,
+								 int step, int migrations) {
+	std::vector<double> counts = domain.Gather(state.positions.size());
+	if (domain.GetRank() != 0) {
+		return;
+	}
+	double total = 0.0;
+	for (double count : counts) {
+		total += count;
+	}
+	printf("step %d: %d particles, %d migrations, per rank:", step, (int)total, migrations);
+	for (double count : counts) {
+		printf(" %d", (int)count);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+}
+
+DistributedRun RunDistributed(int num_ranks,
+															IntegratorType integrator_type,
+															float dt,
+															int steps,
+															int num_threads,
+															bool deterministic) {
+	std::shared_ptr<SocketTransport> transport = SocketTransport::Fork(num_ranks);
+	if (num_threads <= 0) {
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() / num_ranks);
+	}
+	ThreadPool::GetInstance().SetNumThreads(num_threads);
+	ThreadPool::GetInstance().SetDeterministic(deterministic);
+
+	auto domain = std::make_shared<SlabDecomposition>(
+			transport, BOX_MIN, BOX_SIZE, H, kMigrationSkin);
+	// The ghosts change every evaluation, so neighbor lists would be rebuilt
+	// every time anyway
+	WaterSystem system;
+	system.SetSimdLevel(DetectSimdLevel());
+	system.SetDomain(domain);
+	auto integrator =
+			IntegratorFactory::CreateIntegrator<WaterSystem, ParticleState>(integrator_type);
+
+	// Every process walks the same lattice and keeps its own particles, so
+	// together they hold each one exactly once
+	ParticleState state;
+	const float spacing = 0.08f;
+	for (float x = BOX_MIN.x + spacing / 2.f; x < -0.2f; x += spacing) {
+		for (float y = BOX_MIN.y + spacing / 2.f; y < 0.2f; y += spacing) {
+			for (float z = BOX_MIN.z + spacing / 2.f; z < BOX_MAX.z; z += spacing) {
+				glm::vec3 p(x, y, z);
+				if (domain->Owns(p)) {
+					system.AddParticle(state, p, glm::vec3(0.f));
+				}
+			}
+		}
+	}
+	if (domain->GetRank() == 0) {
+		printf("%d processes, %d threads each\n", num_ranks, num_threads);
+	}
+
+	using Clock = std::chrono::high_resolution_clock;
+	auto start = Clock::now();
+	int migrations = 0;
+	int migrated = 0;
+	PrintCounts(*domain, state, 0, migrations);
+	for (int step = 1; step <= steps; step++) {
+		integrator->Step(system, state, (step - 1) * dt, dt);
+		// All processes agree on whether to migrate, since the next
+		// evaluation of every one of them waits for the ghosts of the others
+		if (domain->NeedsMigration(state)) {
+			migrated += domain->Migrate(state);
+			integrator->OnParticlesMigrated();
+			migrations++;
+		}
+		if (step % kReportInterval == 0 || step == steps) {
+			PrintCounts(*domain, state, step, migrations);
+		}
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (domain->GetRank() == 0) {
+		printf("%d steps in %.2fs\n", steps, seconds);
+	}
+
+	DistributedRun run;
+	run.rank = domain->GetRank();
+	run.migrations = migrations;
+	run.migrated = migrated;
+	domain->GatherParticles(state, run.particles);
+	return run;
+}
+
+}  // namespace GLOO
@@ -0,0 +1,35 @@
+#ifndef DISTRIBUTED_SIMULATION_H_
+#define DISTRIBUTED_SIMULATION_H_
+
+#include "IntegratorType.hpp"
+#include "ParticleState.hpp"
+
+namespace GLOO {
+
+// What a process comes back from RunDistributed with
+struct DistributedRun {
+	int rank = 0;
+	// Times the particles migrated, the same on every process
+	int migrations = 0;
+	// Particles moved between processes by all of them
+	int migrated = 0;
+	// The particles of all processes after the last step, in rank order
+	ParticleState particles;
+};
+
+// Runs the WCSPH solver without a window on num_ranks processes forked on
+// this machine, each owning one slab of the box along x, starting from a
+// dam break. Every process comes back from this call, only rank 0 prints
+// the particle counts. The step is fixed, since the processes have to
+// stay in lockstep. num_threads is per process, 0 splits the cores evenly.
+// Must be called before anything uses the thread pool.
+DistributedRun RunDistributed(int num_ranks,
+															IntegratorType integrator_type,
+															float dt,
+															int steps,
+															int num_threads,
+															bool deterministic);
+
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,456 @@
+#include "FlipSystem.hpp"
+#include "ThreadPool.hpp"
+#include "SimulationBox.hpp"
+#include "WaterSystem.hpp"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+
+namespace GLOO {
+
+// Smallest number of grid cells or faces handed to a thread at once
+const static int kCellGrain = 256;
+
+FlipSystem::FlipSystem() {
+	// FLIP keeps its volume with about 8 particles per cell, which the
+	// scenes here only reach on a coarse grid
+	SetResolution(8);
+}
+
+void FlipSystem::SetResolution(int resolution) {
+	cell_size_ = BOX_WIDTH / resolution;
+	res_ = glm::ivec3(resolution, (int) round(BOX_HEIGHT / cell_size_), resolution);
+	for (int c = 0; c < 3; c++) {
+		FaceField& field = faces_[c];
+		field.res = res_;
+		field.res[c]++;
+		field.offset = glm::vec3(0.5f);
+		field.offset[c] = 0.f;
+		field.values.assign(field.Size(), 0.f);
+		field.saved.assign(field.Size(), 0.f);
+		field.valid.assign(field.Size(), 0);
+		field.next_valid.assign(field.Size(), 0);
+		field.next_values.assign(field.Size(), 0.f);
+	}
+	// Slightly smaller cells, so that rounding can't drop the last layer
+	particle_grid_ = NeighborGrid(BOX_MIN, glm::vec3(res_) * cell_size_, cell_size_ * (1.f - 1e-5f));
+	cell_rows_.assign(res_.x * res_.y * res_.z, -1);
+}
+
+void FlipSystem::SetSolverLimits(float tolerance, int max_iterations) {
+	tolerance_ = tolerance;
+	max_iterations_ = std::max(1, max_iterations);
+}
+
+ParticleState FlipSystem::ComputeTimeDerivative(const ParticleState& state,
+																								float time) {
+	ParticleState derivative;
+	ComputeTimeDerivative(state, time, derivative);
+	return derivative;
+}
+
+void FlipSystem::ComputeTimeDerivative(const ParticleState& state,
+																			 float time,
+																			 ParticleState& derivative) {
+	Solve(state, time_step_);
+	// An Euler step of time_step_ lands on the advected positions
+	int n = state.positions.size();
+	float inv_dt = 1.f / time_step_;
+	derivative.positions.resize(n);
+	derivative.velocities.resize(n);
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			derivative.positions[i] = inv_dt * (glm::vec3(new_positions_[i]) - glm::vec3(state.positions[i]));
+			derivative.velocities[i] = inv_dt * (glm::vec3(new_velocities_[i]) - glm::vec3(state.velocities[i]));
+		}
+	}, kParticleGrain);
+}
+
+bool FlipSystem::Advance(ParticleState& state, float time, float dt) {
+	time_step_ = dt;
+	Solve(state, dt);
+	state.positions = new_positions_;
+	state.velocities = new_velocities_;
+	return true;
+}
+
+void FlipSystem::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
+	state.positions.push_back(position);
+	state.velocities.push_back(velocity);
+}
+
+void FlipSystem::Solve(const ParticleState& state, float dt) {
+	TransferToGrid(state);
+	MarkFluidCells();
+	// The particles near the surface also sample faces no particle reached
+	ExtrapolateVelocities(2);
+	for (int c = 0; c < 3; c++) {
+		faces_[c].saved = faces_[c].values;
+	}
+	ApplyGravity(dt);
+	EnforceWalls();
+	ComputeDivergence();
+	iterations_ = SolvePressure();
+	SubtractPressureGradient();
+	ExtrapolateVelocities(2);
+	TransferToParticles(state, dt);
+}
+
+void FlipSystem::TransferToGrid(const ParticleState& state) {
+	particle_grid_.Build(state.positions);
+	const std::vector<int>& sorted = particle_grid_.GetSortedIndices();
+	const float* px = state.positions.x();
+	const float* py = state.positions.y();
+	const float* pz = state.positions.z();
+	float inv_dx = 1.f / cell_size_;
+	for (int c = 0; c < 3; c++) {
+		FaceField& field = faces_[c];
+		const float* vc = c == 0 ? state.velocities.x() :
+											c == 1 ? state.velocities.y() : state.velocities.z();
+		// Gathers from the particles within a cell of each face, so every
+		// face is written by one thread only
+		ThreadPool::GetInstance().ParallelFor(0, field.Size(), [&](int begin, int end) {
+			for (int f = begin; f < end; f++) {
+				int z = f % field.res.z;
+				int y = (f / field.res.z) % field.res.y;
+				int x = f / (field.res.z * field.res.y);
+				glm::vec3 s = glm::vec3(x, y, z) + field.offset;
+				glm::ivec3 lo = glm::max(glm::ivec3(glm::floor(s - 1.f)), glm::ivec3(0));
+				glm::ivec3 hi = glm::min(glm::ivec3(glm::ceil(s + 1.f)) - 1, res_ - 1);
+				float sum = 0.f;
+				float weight = 0.f;
+				for (int cx = lo.x; cx <= hi.x; cx++) {
+					for (int cy = lo.y; cy <= hi.y; cy++) {
+						for (int cz = lo.z; cz <= hi.z; cz++) {
+							int cell = CellIndex(cx, cy, cz);
+							int cell_end = particle_grid_.GetCellStart(cell) + particle_grid_.GetCellCount(cell);
+							for (int k = particle_grid_.GetCellStart(cell); k < cell_end; k++) {
+								int i = sorted[k];
+								float wx = 1.f - fabs((px[i] - BOX_MIN.x) * inv_dx - s.x);
+								float wy = 1.f - fabs((py[i] - BOX_MIN.y) * inv_dx - s.y);
+								float wz = 1.f - fabs((pz[i] - BOX_MIN.z) * inv_dx - s.z);
+								if (wx > 0.f && wy > 0.f && wz > 0.f) {
+									float w = wx * wy * wz;
+									sum += w * vc[i];
+									weight += w;
+								}
+							}
+						}
+					}
+				}
+				field.values[f] = weight > 0.f ? sum / weight : 0.f;
+				field.valid[f] = weight > 0.f;
+			}
+		}, kCellGrain);
+	}
+}
+
+void FlipSystem::MarkFluidCells() {
+	// Serial, so that the rows come out in cell order
+	fluid_cells_.clear();
+	for (int cell = 0; cell < (int) cell_rows_.size(); cell++) {
+		if (particle_grid_.GetCellCount(cell) > 0) {
+			cell_rows_[cell] = fluid_cells_.size();
+			fluid_cells_.push_back(cell);
+		} else {
+			cell_rows_[cell] = -1;
+		}
+	}
+	int rows = fluid_cells_.size();
+	diagonal_.resize(rows);
+	rhs_.resize(rows);
+	pressure_.resize(rows);
+	residual_.resize(rows);
+	preconditioned_.resize(rows);
+	search_.resize(rows);
+	product_.resize(rows);
+}
+
+bool FlipSystem::IsFluid(int x, int y, int z) const {
+	if (x < 0 || y < 0 || z < 0 || x >= res_.x || y >= res_.y || z >= res_.z) {
+		return false;
+	}
+	return cell_rows_[CellIndex(x, y, z)] >= 0;
+}
+
+void FlipSystem::ApplyGravity(float dt) {
+	for (int c = 0; c < 3; c++) {
+		if (GRAVITY[c] == 0.f) {
+			continue;
+		}
+		FaceField& field = faces_[c];
+		float dv = dt * GRAVITY[c];
+		ThreadPool::GetInstance().ParallelFor(0, field.Size(), [&](int begin, int end) {
+			for (int f = begin; f < end; f++) {
+				field.values[f] += dv;
+			}
+		}, kCellGrain);
+	}
+}
+
+void FlipSystem::EnforceWalls() {
+	for (int c = 0; c < 3; c++) {
+		FaceField& field = faces_[c];
+		// The faces at 0 and res_[c] along c are the walls
+		for (int side = 0; side < 2; side++) {
+			int layer = side * res_[c];
+			glm::ivec3 extent = field.res;
+			extent[c] = 1;
+			for (int a = 0; a < extent.x; a++) {
+				for (int b = 0; b < extent.y; b++) {
+					for (int d = 0; d < extent.z; d++) {
+						glm::ivec3 face(a, b, d);
+						face[c] = layer;
+						field.values[field.Index(face.x, face.y, face.z)] = 0.f;
+					}
+				}
+			}
+		}
+	}
+}
+
+void FlipSystem::ComputeDivergence() {
+	const FaceField& u = faces_[0];
+	const FaceField& v = faces_[1];
+	const FaceField& w = faces_[2];
+	ThreadPool::GetInstance().ParallelFor(0, fluid_cells_.size(), [&](int begin, int end) {
+		for (int row = begin; row < end; row++) {
+			int cell = fluid_cells_[row];
+			int z = cell % res_.z;
+			int y = (cell / res_.z) % res_.y;
+			int x = cell / (res_.z * res_.y);
+			float divergence = u.values[u.Index(x+1, y, z)] - u.values[u.Index(x, y, z)] +
+												 v.values[v.Index(x, y+1, z)] - v.values[v.Index(x, y, z)] +
+												 w.values[w.Index(x, y, z+1)] - w.values[w.Index(x, y, z)];
+			// The divergence times dx^2, in units of the pressure
+			rhs_[row] = -cell_size_ * divergence;
+			int neighbors = (x > 0) + (x < res_.x-1) + (y > 0) + (y < res_.y-1) +
+											(z > 0) + (z < res_.z-1);
+			diagonal_[row] = neighbors;
+		}
+	}, kCellGrain);
+}
+
+void FlipSystem::ApplyMatrix(const std::vector<double>& in, std::vector<double>& out) const {
+	ThreadPool::GetInstance().ParallelFor(0, fluid_cells_.size(), [&](int begin, int end) {
+		for (int row = begin; row < end; row++) {
+			int cell = fluid_cells_[row];
+			int z = cell % res_.z;
+			int y = (cell / res_.z) % res_.y;
+			int x = cell / (res_.z * res_.y);
+			double sum = diagonal_[row] * in[row];
+			// Air neighbors are at zero pressure and drop out
+			const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0},
+																 {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+			for (int o = 0; o < 6; o++) {
+				int nx = x + offsets[o][0];
+				int ny = y + offsets[o][1];
+				int nz = z + offsets[o][2];
+				if (IsFluid(nx, ny, nz)) {
+					sum -= in[cell_rows_[CellIndex(nx, ny, nz)]];
+				}
+			}
+			out[row] = sum;
+		}
+	}, kCellGrain);
+}
+
+double FlipSystem::Dot(const std::vector<double>& a, const std::vector<double>& b) const {
+	return ThreadPool::GetInstance().ParallelSum<double>(0, a.size(), [&](int begin, int end) {
+		double chunk_sum = 0.0;
+		for (int i = begin; i < end; i++) {
+			chunk_sum += a[i] * b[i];
+		}
+		return chunk_sum;
+	}, kCellGrain);
+}
+
+double FlipSystem::MaxAbs(const std::vector<double>& a) const {
+	double result = 0.0;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, a.size(), [&](int begin, int end) {
+		double chunk_max = 0.0;
+		for (int i = begin; i < end; i++) {
+			chunk_max = std::max(chunk_max, fabs(a[i]));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		result = std::max(result, chunk_max);
+	}, kCellGrain);
+	return result;
+}
+
+int FlipSystem::SolvePressure() {
+	// Conjugate gradient with a Jacobi preconditioner. MIC(0) converges in
+	// fewer iterations, but its triangular solves are serial, while every
+	// step here is a parallel loop.
+	int rows = fluid_cells_.size();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	std::fill(pressure_.begin(), pressure_.end(), 0.0);
+	residual_ = rhs_;
+	double threshold = tolerance_ * MaxAbs(rhs_);
+	if (rows == 0 || MaxAbs(residual_) <= threshold) {
+		return 0;
+	}
+	pool.ParallelFor(0, rows, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			preconditioned_[i] = residual_[i] / diagonal_[i];
+			search_[i] = preconditioned_[i];
+		}
+	}, kCellGrain);
+	double sigma = Dot(residual_, preconditioned_);
+	for (int it = 1; it <= max_iterations_; it++) {
+		ApplyMatrix(search_, product_);
+		double alpha = sigma / Dot(search_, product_);
+		pool.ParallelFor(0, rows, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				pressure_[i] += alpha * search_[i];
+				residual_[i] -= alpha * product_[i];
+			}
+		}, kCellGrain);
+		if (MaxAbs(residual_) <= threshold) {
+			return it;
+		}
+		pool.ParallelFor(0, rows, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				preconditioned_[i] = residual_[i] / diagonal_[i];
+			}
+		}, kCellGrain);
+		double next_sigma = Dot(residual_, preconditioned_);
+		double beta = next_sigma / sigma;
+		sigma = next_sigma;
+		pool.ParallelFor(0, rows, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				search_[i] = preconditioned_[i] + beta * search_[i];
+			}
+		}, kCellGrain);
+	}
+	return max_iterations_;
+}
+
+void FlipSystem::SubtractPressureGradient() {
+	float inv_dx = 1.f / cell_size_;
+	for (int c = 0; c < 3; c++) {
+		FaceField& field = faces_[c];
+		ThreadPool::GetInstance().ParallelFor(0, field.Size(), [&](int begin, int end) {
+			for (int f = begin; f < end; f++) {
+				glm::ivec3 right(f / (field.res.z * field.res.y),
+												 (f / field.res.z) % field.res.y,
+												 f % field.res.z);
+				glm::ivec3 left = right;
+				left[c]--;
+				bool left_fluid = IsFluid(left.x, left.y, left.z);
+				bool right_fluid = IsFluid(right.x, right.y, right.z);
+				field.valid[f] = left_fluid || right_fluid;
+				if (right[c] == 0 || right[c] == res_[c]) {
+					field.values[f] = 0.f;
+				} else if (left_fluid || right_fluid) {
+					double q_left = left_fluid ? pressure_[cell_rows_[CellIndex(left.x, left.y, left.z)]] : 0.0;
+					double q_right = right_fluid ? pressure_[cell_rows_[CellIndex(right.x, right.y, right.z)]] : 0.0;
+					field.values[f] -= (float) (q_right - q_left) * inv_dx;
+				}
+			}
+		}, kCellGrain);
+	}
+}
+
+void FlipSystem::ExtrapolateVelocities(int layers) {
+	for (int c = 0; c < 3; c++) {
+		FaceField& field = faces_[c];
+		for (int layer = 0; layer < layers; layer++) {
+			ThreadPool::GetInstance().ParallelFor(0, field.Size(), [&](int begin, int end) {
+				for (int f = begin; f < end; f++) {
+					field.next_values[f] = field.values[f];
+					field.next_valid[f] = field.valid[f];
+					if (field.valid[f]) {
+						continue;
+					}
+					int z = f % field.res.z;
+					int y = (f / field.res.z) % field.res.y;
+					int x = f / (field.res.z * field.res.y);
+					float sum = 0.f;
+					int count = 0;
+					const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0},
+																		 {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+					for (int o = 0; o < 6; o++) {
+						int nx = x + offsets[o][0];
+						int ny = y + offsets[o][1];
+						int nz = z + offsets[o][2];
+						if (nx < 0 || ny < 0 || nz < 0 || nx >= field.res.x ||
+								ny >= field.res.y || nz >= field.res.z) {
+							continue;
+						}
+						int n = field.Index(nx, ny, nz);
+						if (field.valid[n]) {
+							sum += field.values[n];
+							count++;
+						}
+					}
+					if (count > 0) {
+						field.next_values[f] = sum / count;
+						field.next_valid[f] = 1;
+					}
+				}
+			}, kCellGrain);
+			field.values.swap(field.next_values);
+			field.valid.swap(field.next_valid);
+		}
+	}
+	EnforceWalls();
+}
+
+float FlipSystem::Sample(const FaceField& field, const std::vector<float>& values, glm::vec3 p) const {
+	glm::vec3 g = (p - BOX_MIN) / cell_size_ - field.offset;
+	glm::ivec3 i0 = glm::clamp(glm::ivec3(glm::floor(g)), glm::ivec3(0), field.res - 2);
+	glm::vec3 t = glm::clamp(g - glm::vec3(i0), 0.f, 1.f);
+	float result = 0.f;
+	for (int dx = 0; dx < 2; dx++) {
+		for (int dy = 0; dy < 2; dy++) {
+			for (int dz = 0; dz < 2; dz++) {
+				float w = (dx ? t.x : 1.f - t.x) * (dy ? t.y : 1.f - t.y) * (dz ? t.z : 1.f - t.z);
+				result += w * values[field.Index(i0.x + dx, i0.y + dy, i0.z + dz)];
+			}
+		}
+	}
+	return result;
+}
+
+glm::vec3 FlipSystem::SampleVelocity(glm::vec3 p) const {
+	return glm::vec3(Sample(faces_[0], faces_[0].values, p),
+									 Sample(faces_[1], faces_[1].values, p),
+									 Sample(faces_[2], faces_[2].values, p));
+}
+
+void FlipSystem::TransferToParticles(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	new_positions_.resize(n);
+	new_velocities_.resize(n);
+	glm::vec3 lo = BOX_MIN + wall_margin_;
+	glm::vec3 hi = BOX_MIN + glm::vec3(res_) * cell_size_ - wall_margin_;
+	float max_acceleration_sq = 0.f;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = state.positions[i];
+			glm::vec3 v = state.velocities[i];
+			glm::vec3 pic = SampleVelocity(p);
+			glm::vec3 saved(Sample(faces_[0], faces_[0].saved, p),
+											Sample(faces_[1], faces_[1].saved, p),
+											Sample(faces_[2], faces_[2].saved, p));
+			// FLIP only adds the change of the grid velocity
+			glm::vec3 flip = v + pic - saved;
+			glm::vec3 v_new = flip_ratio_ * flip + (1.f - flip_ratio_) * pic;
+			new_velocities_[i] = v_new;
+			// Midpoint rule through the divergence free grid velocity
+			glm::vec3 mid = glm::clamp(p + 0.5f * dt * pic, lo, hi);
+			new_positions_[i] = glm::clamp(p + dt * SampleVelocity(mid), lo, hi);
+			glm::vec3 dv = v_new - v;
+			chunk_max = std::max(chunk_max, glm::dot(dv, dv));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_acceleration_sq = std::max(max_acceleration_sq, chunk_max);
+	}, kParticleGrain);
+	max_acceleration_ = sqrt(max_acceleration_sq) / dt;
+}
+
+}  // namespace GLOO
@@ -0,0 +1,132 @@
+#ifndef FLIP_SYSTEM_H_
+#define FLIP_SYSTEM_H_
+
+#include <vector>
+
+#include "ParticleState.hpp"
+#include "ParticleSystemBase.hpp"
+#include "NeighborGrid.hpp"
+
+namespace GLOO {
+
+// Hybrid FLIP/PIC (Zhu and Bridson 2005) on a MAC grid over the simulation
+// box. Every step transfers the particle velocities to the grid, makes them
+// divergence free with a preconditioned conjugate gradient solve and
+// transfers the change back. The particles only carry the fluid, so a few
+// per grid cell resolve what SPH needs a whole kernel neighborhood for.
+class FlipSystem : public ParticleSystemBase {
+ public:
+	FlipSystem();
+	virtual ~FlipSystem() {
+	}
+
+	// The displacement and velocity change of a step of SetTimeStep, or the
+	// dt of the last Advance, divided by that step
+	ParticleState ComputeTimeDerivative(const ParticleState& state,
+																			float time) override;
+	void ComputeTimeDerivative(const ParticleState& state,
+														 float time,
+														 ParticleState& derivative) override;
+	bool Advance(ParticleState& state, float time, float dt) override;
+
+	// The CFL condition is in grid cells
+	float GetSmoothingLength() const override { return cell_size_; }
+	float GetMaxAcceleration() const override { return max_acceleration_; }
+	int GetSolverIterations() const override { return iterations_; }
+
+	void AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity);
+
+	void SetTimeStep(float dt) { time_step_ = dt; }
+	// Cells along each side of the box
+	void SetResolution(int resolution);
+	// 1 is pure FLIP, which keeps all detail but gets noisy, 0 is pure PIC,
+	// which is smooth but viscous
+	void SetFlipRatio(float flip_ratio) { flip_ratio_ = flip_ratio; }
+	// CG stops once the largest residual is below tolerance times the
+	// largest divergence, or after max_iterations
+	void SetSolverLimits(float tolerance, int max_iterations);
+
+ private:
+	// One velocity component, sampled at the centers of the cell faces
+	// normal to it
+	struct FaceField {
+		glm::ivec3 res;
+		// Sample position of face (0, 0, 0) in cells
+		glm::vec3 offset;
+		std::vector<float> values;
+		// The values after the transfer from the particles
+		std::vector<float> saved;
+		// Faces that touch fluid, or were extrapolated from such faces
+		std::vector<char> valid;
+		std::vector<char> next_valid;
+		std::vector<float> next_values;
+
+		int Index(int x, int y, int z) const {
+			return (x * res.y + y) * res.z + z;
+		}
+		int Size() const {
+			return res.x * res.y * res.z;
+		}
+	};
+
+	// Fills new_positions_ and new_velocities_ for a step of dt
+	void Solve(const ParticleState& state, float dt);
+	void TransferToGrid(const ParticleState& state);
+	void MarkFluidCells();
+	void ApplyGravity(float dt);
+	// Zeroes the normal velocity at the walls of the box
+	void EnforceWalls();
+	void ComputeDivergence();
+	// Solves A q = b for the fluid cells, A being the Poisson matrix with
+	// air cells at zero pressure and walls at zero normal velocity
+	int SolvePressure();
+	void SubtractPressureGradient();
+	void ExtrapolateVelocities(int layers);
+	void TransferToParticles(const ParticleState& state, float dt);
+
+	// Trilinear interpolation of one component at p
+	float Sample(const FaceField& field, const std::vector<float>& values, glm::vec3 p) const;
+	glm::vec3 SampleVelocity(glm::vec3 p) const;
+	// The Poisson matrix times x, for the fluid cells
+	void ApplyMatrix(const std::vector<double>& x, std::vector<double>& result) const;
+	double Dot(const std::vector<double>& a, const std::vector<double>& b) const;
+	double MaxAbs(const std::vector<double>& a) const;
+	bool IsFluid(int x, int y, int z) const;
+	int CellIndex(int x, int y, int z) const {
+		return (x * res_.y + y) * res_.z + z;
+	}
+
+	glm::ivec3 res_;
+	float cell_size_;
+	FaceField faces_[3];
+	// Bins the particles by grid cell, for the gather in TransferToGrid
+	NeighborGrid particle_grid_;
+
+	// Row of every fluid cell in the pressure system, -1 for air
+	std::vector<int> cell_rows_;
+	std::vector<int> fluid_cells_;
+	// Non-wall neighbors of every fluid cell, the diagonal of the matrix
+	std::vector<double> diagonal_;
+	std::vector<double> rhs_;
+	std::vector<double> pressure_;
+	std::vector<double> residual_;
+	std::vector<double> preconditioned_;
+	std::vector<double> search_;
+	std::vector<double> product_;
+
+	Vec3Array new_positions_;
+	Vec3Array new_velocities_;
+
+	float time_step_ = 0.01f;
+	float flip_ratio_ = 0.95f;
+	float tolerance_ = 1e-4f;
+	int max_iterations_ = 200;
+	// Keeps the particles this far inside the box
+	float wall_margin_ = 0.001f;
+
+	int iterations_ = 0;
+	float max_acceleration_ = 0.f;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FORWARD_EULER_INTEGRATOR_H_
+#define FORWARD_EULER_INTEGRATOR_H_
+
+#include "IntegratorBase.hpp"
+
+namespace GLOO {
+template <class TSystem, class TState>
+class ForwardEulerIntegrator : public IntegratorBase<TSystem, TState> {
+  void Step(TSystem& system,
+            TState& state,
+            float start_time,
+            float dt) override {
+    system.ComputeTimeDerivative(state, start_time, derivative_);
+    state += dt * derivative_;
+    this->ApplyBoundary(state);
+  }
+
+  TState derivative_;
+};
+}  // namespace GLOO
+
+#endif
@@ -1,5 +1,7 @@
 #include "Grid.hpp"
+#include "ThreadPool.hpp"
 #include <iostream>
+#include <algorithm>
 #include <math.h>
 #include <sstream>
 #include <set>
@@ -89,50 +91,116 @@ void Grid::CalculateBlobs(std::vector<glm::vec3> positions,
 													std::vector<glm::vec3>& vertices,
 													std::vector<unsigned int>& indices,
 													std::vector<glm::vec3>& normals) {
-	
-	for (int x = 0; x < grid_x_res_; x++) {
-		for (int y = 0; y < grid_y_res_; y++) {
-			for (int z = 0; z < grid_z_res_; z++) {
-				values_[x][y][z] = 0.f;
-				gradients_[x][y][z] = glm::vec3(0.f);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	UpdateSlabBlocks(positions);
+
+	// Every block only writes its own slabs. The particles are checked by
+	// all of the blocks, which is cheap next to the corners each one adds
+	// to, and they add up in the same order whatever the blocks are.
+	float i_radius = range_*radius_;
+	pool.ParallelForBlocks(slab_blocks_, [&](int block, int begin, int end) {
+		for (int x = begin; x < end; x++) {
+			for (int y = 0; y < grid_y_res_; y++) {
+				for (int z = 0; z < grid_z_res_; z++) {
+					values_[x][y][z] = 0.f;
+					gradients_[x][y][z] = glm::vec3(0.f);
+				}
 			}
 		}
-	}
 
-	float i_radius = range_*radius_;
-	for (int i = 0; i < positions.size(); i++) {
-		auto p = positions[i] - origin_;
-		
-		// Calculate the min and max grid corners in this particles influence
-		int x_l = (int) std::max(0.f, ceil((p.x - i_radius)/cell_size_x_));
-		int x_h = (int) std::min((float)grid_x_res_, floor((p.x + i_radius)/cell_size_x_));
-		int y_l = (int) std::max(0.f, ceil((p.y - i_radius)/cell_size_y_));
-		int y_h = (int) std::min((float)grid_y_res_, floor((p.y + i_radius)/cell_size_y_));
-		int z_l = (int) std::max(0.f, ceil((p.z - i_radius)/cell_size_z_));
-		int z_h = (int) std::min((float)grid_z_res_, floor((p.z + i_radius)/cell_size_z_));
+		for (size_t i = 0; i < positions.size(); i++) {
+			int x_l = std::max(slab_lo_[i], begin);
+			int x_h = std::min(slab_hi_[i], end);
+			if (x_l >= x_h) {
+				continue;
+			}
+			auto p = positions[i] - origin_;
+
+			// Calculate the min and max grid corners in this particles influence
+			int y_l = (int) std::max(0.f, ceil((p.y - i_radius)/cell_size_y_));
+			int y_h = (int) std::min((float)grid_y_res_, floor((p.y + i_radius)/cell_size_y_));
+			int z_l = (int) std::max(0.f, ceil((p.z - i_radius)/cell_size_z_));
+			int z_h = (int) std::min((float)grid_z_res_, floor((p.z + i_radius)/cell_size_z_));
 
-		for (int x = x_l; x < x_h; x++) {
-			for (int y = y_l; y < y_h; y++) {
-				for (int z = z_l; z < z_h; z++) {
-					glm::vec3 point = glm::vec3(x*cell_size_x_, y*cell_size_y_, z*cell_size_z_);
-					values_[x][y][z] += pow(radius_,2.f)/pow(glm::distance(point, p),2.f);
-					gradients_[x][y][z] += (-2.f * (p - point) * pow(radius_,2.f))/(pow(glm::distance(point, p),4.f));
+			for (int x = x_l; x < x_h; x++) {
+				for (int y = y_l; y < y_h; y++) {
+					for (int z = z_l; z < z_h; z++) {
+						glm::vec3 point = glm::vec3(x*cell_size_x_, y*cell_size_y_, z*cell_size_z_);
+						values_[x][y][z] += pow(radius_,2.f)/pow(glm::distance(point, p),2.f);
+						gradients_[x][y][z] += (-2.f * (p - point) * pow(radius_,2.f))/(pow(glm::distance(point, p),4.f));
+					}
 				}
 			}
 		}
-	}
-	// Now calculate all of the vertices and indices
-	for (int x = 0; x < grid_x_res_; x++) {
-		for (int y = 0; y < grid_y_res_; y++) {
-			for (int z = 0; z < grid_z_res_; z++) {
-				if (smooth_) {
-					CalculateSmooth(x, y, z, vertices, indices, normals);
-				} else {
-					if (values_[x][y][z] >= 1.f)
-						CalculatePrimitive(x, y, z, vertices, indices);
+	});
+
+	// Now calculate all of the vertices and indices. Each block fills its own
+	// buffers, which are joined in order so the mesh matches a serial pass.
+	surface_blocks_.resize(slab_blocks_.size() - 1);
+	pool.ParallelForBlocks(slab_blocks_, [&](int block, int begin, int end) {
+		SurfaceBlock& surface = surface_blocks_[block];
+		surface.vertices.clear();
+		surface.indices.clear();
+		surface.normals.clear();
+		for (int x = begin; x < end; x++) {
+			for (int y = 0; y < grid_y_res_; y++) {
+				for (int z = 0; z < grid_z_res_; z++) {
+					if (smooth_) {
+						CalculateSmooth(x, y, z, surface.vertices, surface.indices, surface.normals);
+					} else {
+						if (values_[x][y][z] >= 1.f)
+							CalculatePrimitive(x, y, z, surface.vertices, surface.indices);
+					}
 				}
 			}
 		}
+	});
+	for (const SurfaceBlock& surface : surface_blocks_) {
+		unsigned int offset = vertices.size();
+		vertices.insert(vertices.end(), surface.vertices.begin(), surface.vertices.end());
+		for (unsigned int index : surface.indices) {
+			indices.push_back(offset + index);
+		}
+		normals.insert(normals.end(), surface.normals.begin(), surface.normals.end());
+	}
+}
+
+void Grid::UpdateSlabBlocks(const std::vector<glm::vec3>& positions) {
+	float i_radius = range_*radius_;
+	slab_lo_.resize(positions.size());
+	slab_hi_.resize(positions.size());
+	slab_weights_.assign(grid_x_res_ + 1, 0);
+	for (size_t i = 0; i < positions.size(); i++) {
+		float p_x = positions[i].x - origin_.x;
+		int x_l = (int) std::max(0.f, ceil((p_x - i_radius)/cell_size_x_));
+		int x_h = (int) std::min((float)grid_x_res_, floor((p_x + i_radius)/cell_size_x_));
+		slab_lo_[i] = x_l;
+		slab_hi_[i] = x_h;
+		if (x_l < x_h) {
+			slab_weights_[x_l]++;
+			slab_weights_[x_h]--;
+		}
+	}
+
+	// Turn the differences into particles per slab, plus one so that empty
+	// slabs still cost something to extract
+	int total = 0;
+	int in_slab = 0;
+	for (int x = 0; x < grid_x_res_; x++) {
+		in_slab += slab_weights_[x];
+		slab_weights_[x] = in_slab + 1;
+		total += slab_weights_[x];
+	}
+	int num_blocks = std::min(grid_x_res_, ThreadPool::GetInstance().GetNumThreads() * 4);
+	int target = (total + num_blocks - 1) / num_blocks;
+	slab_blocks_.assign(1, 0);
+	int block_weight = 0;
+	for (int x = 0; x < grid_x_res_; x++) {
+		block_weight += slab_weights_[x];
+		if (block_weight >= target || x == grid_x_res_ - 1) {
+			slab_blocks_.push_back(x + 1);
+			block_weight = 0;
+		}
 	}
 }
 
@@ -141,7 +209,7 @@ void Grid::CalculatePrimitive(int x, int y, int z,
 															std::vector<unsigned int>& indices) {
 
 	// Finds the faces that aren't surrounded by other blocks
-	for (int i = 0; i < face_vector_.size(); i++) {
+	for (size_t i = 0; i < face_vector_.size(); i++) {
 		auto vals = face_vector_[i];
 		int o_x = vals[0]; int o_y = vals[1]; int o_z = vals[2];
 
@@ -38,6 +38,25 @@ class Grid {
 	glm::vec3 VertexInterp(double isolevel, glm::vec3 p1, glm::vec3 p2,
 								 			 	 double valp1, double valp2);
 
+	// Splits the x slabs of corners into blocks of about the same number of
+	// particles influencing them, which both passes of CalculateBlobs are
+	// scheduled in
+	void UpdateSlabBlocks(const std::vector<glm::vec3>& positions);
+
+	// The x slabs slab_lo_[i] ... slab_hi_[i]-1 particle i influences
+	std::vector<int> slab_lo_;
+	std::vector<int> slab_hi_;
+	std::vector<int> slab_weights_;
+	std::vector<int> slab_blocks_;
+
+	// The triangles of one block of slabs, with indices from 0
+	struct SurfaceBlock {
+		std::vector<glm::vec3> vertices;
+		std::vector<unsigned int> indices;
+		std::vector<glm::vec3> normals;
+	};
+	std::vector<SurfaceBlock> surface_blocks_;
+
  	// All of the values of each corner
  	std::vector<std::vector<std::vector<float>>> values_;
  	std::vector<std::vector<std::vector<glm::vec3>>> gradients_;
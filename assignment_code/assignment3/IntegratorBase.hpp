@@ -2,6 +2,9 @@
 #define INTEGRATOR_BASE_H_
 
 #include "ParticleSystemBase.hpp"
+#include "BoundaryBase.hpp"
+#include "BoxBoundary.hpp"
+#include "SimulationBox.hpp"
 
 namespace GLOO {
 template <class TSystem, class TState>
@@ -10,10 +13,54 @@ class IntegratorBase {
   virtual ~IntegratorBase() {
   }
 
+  // Returns the state dt after start_time
   virtual TState Integrate(TSystem& system,
                            TState& state,
                            float start_time,
-                           float dt) = 0;
+                           float dt) {
+    TState new_state = state;
+    Step(system, new_state, start_time, dt);
+    return new_state;
+  }
+
+  // Advances state by dt in place. The integrators keep their stages in
+  // member buffers, so once the particle count settles this doesn't
+  // allocate.
+  virtual void Step(TSystem& system,
+                    TState& state,
+                    float start_time,
+                    float dt) = 0;
+
+  // Called after the particles of the state were reordered with
+  // ParticleState::Permute, for integrators that keep per-particle data
+  // between steps.
+  virtual void OnParticlesPermuted(const std::vector<int>& order) {
+  }
+
+  // Called after particles were exchanged with other processes, so the
+  // per-particle data kept between steps no longer matches the state
+  virtual void OnParticlesMigrated() {
+  }
+
+  // Colliders run after every step, the simulation box by default
+  void SetBoundaries(const BoundaryList& boundaries) {
+    boundaries_ = boundaries;
+  }
+  void AddBoundary(std::shared_ptr<BoundaryBase> boundary) {
+    boundaries_.push_back(boundary);
+  }
+  const BoundaryList& GetBoundaries() const {
+    return boundaries_;
+  }
+
+ protected:
+  // Moves the particles that crossed a boundary back, in one pass
+  void ApplyBoundary(TState& state) const {
+    ApplyBoundaries(boundaries_, state);
+  }
+
+ private:
+  BoundaryList boundaries_{std::make_shared<BoxBoundary>(BOX_MIN, BOX_MAX)};
 };
 }  // namespace GLOO
 
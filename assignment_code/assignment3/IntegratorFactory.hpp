@@ -8,6 +8,11 @@
 #include "gloo/utils.hpp"
 
 #include "IntegratorType.hpp"
+#include "ForwardEulerIntegrator.hpp"
+#include "TrapezoidalIntegrator.hpp"
+#include "RK4Integrator.hpp"
+#include "VerletIntegrator.hpp"
+#include "SolverStepIntegrator.hpp"
 
 namespace GLOO {
 class IntegratorFactory {
@@ -15,9 +20,19 @@ class IntegratorFactory {
   template <class TSystem, class TState>
   static std::unique_ptr<IntegratorBase<TSystem, TState>> CreateIntegrator(
       IntegratorType type) {
-    if (type == IntegratorType::RK4)
-      return make_unique<RK4Integrator<TSystem, TState>>();
-    return nullptr;
+    switch (type) {
+      case IntegratorType::Euler:
+        return make_unique<ForwardEulerIntegrator<TSystem, TState>>();
+      case IntegratorType::Trapezoidal:
+        return make_unique<TrapezoidalIntegrator<TSystem, TState>>();
+      case IntegratorType::RK4:
+        return make_unique<RK4Integrator<TSystem, TState>>();
+      case IntegratorType::Verlet:
+        return make_unique<VerletIntegrator<TSystem, TState>>();
+      case IntegratorType::SolverStep:
+        return make_unique<SolverStepIntegrator<TSystem, TState>>();
+    }
+    throw std::runtime_error("Unrecognized integrator type.");
   }
 };
 }  // namespace GLOO
@@ -2,7 +2,9 @@
 #define INTEGRATOR_TYPE_H_
 
 namespace GLOO {
-enum class IntegratorType { Euler, Trapezoidal, RK4 };
+// SolverStep lets systems that implement ParticleSystemBase::Advance, like
+// the PCISPH solver, take their steps themselves
+enum class IntegratorType { Euler, Trapezoidal, RK4, Verlet, SolverStep };
 }
 
 #endif
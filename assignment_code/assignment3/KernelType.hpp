@@ -0,0 +1,12 @@
+#ifndef KERNEL_TYPE_H_
+#define KERNEL_TYPE_H_
+
+namespace GLOO {
+// Smoothing kernels of the WCSPH solver, the policies of SmoothingKernels.hpp
+// Muller: MullerKernels, poly6, spiky and viscosity
+// CubicSpline: CubicSplineKernels, the cubic B-spline
+// Wendland: WendlandKernels, Wendland C2
+enum class KernelType { Muller, CubicSpline, Wendland };
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef MORTON_ORDER_H_
+#define MORTON_ORDER_H_
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "Vec3Array.hpp"
+
+namespace GLOO {
+
+// Spreads the lower 10 bits of v so that there are two zero bits between
+// each of them.
+inline uint32_t SpreadBits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// Interleaves three 10 bit coordinates into a 30 bit Z-order key.
+inline uint32_t MortonEncode(uint32_t x, uint32_t y, uint32_t z) {
+  return SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+}
+
+// Spreads the lower 21 bits of v so that there are two zero bits between
+// each of them.
+inline uint64_t SpreadBits64(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | (v << 32)) & 0x001f00000000ffffull;
+  v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+  v = (v | (v << 8)) & 0x100f00f00f00f00full;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+  v = (v | (v << 2)) & 0x1249249249249249ull;
+  return v;
+}
+
+// Interleaves three 21 bit coordinates into a 63 bit Z-order key.
+inline uint64_t MortonEncode64(uint32_t x, uint32_t y, uint32_t z) {
+  return SpreadBits64(x) | (SpreadBits64(y) << 1) | (SpreadBits64(z) << 2);
+}
+
+// Quantizes p inside the box [origin, origin + size] onto a 1024^3 lattice
+// and returns its Morton key. Points outside the box are clamped.
+inline uint32_t MortonKey(glm::vec3 p, glm::vec3 origin, glm::vec3 size) {
+  glm::vec3 q = glm::clamp((p - origin) / size, glm::vec3(0.f), glm::vec3(1.f));
+  glm::uvec3 c = glm::min(glm::uvec3(q * 1024.f), glm::uvec3(1023));
+  return MortonEncode(c.x, c.y, c.z);
+}
+
+// Returns the permutation that sorts positions along the Z-order curve:
+// element k of the result is the index of the particle that should move to
+// slot k. Ties keep their current relative order.
+inline std::vector<int> ComputeMortonOrder(
+    const Vec3Array& positions, glm::vec3 origin, glm::vec3 size) {
+  std::vector<std::pair<uint32_t, int>> keys(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    keys[i] = std::make_pair(MortonKey(positions[i], origin, size), (int)i);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<int> order(keys.size());
+  for (size_t k = 0; k < keys.size(); k++) {
+    order[k] = keys[k].second;
+  }
+  return order;
+}
+
+// Reorders values so that values[k] becomes the old values[order[k]].
+template <class T>
+void PermuteArray(std::vector<T>& values, const std::vector<int>& order) {
+  std::vector<T> permuted(values.size());
+  for (size_t k = 0; k < order.size(); k++) {
+    permuted[k] = values[order[k]];
+  }
+  values.swap(permuted);
+}
+}  // namespace GLOO
+
+#endif
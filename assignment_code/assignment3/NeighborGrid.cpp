@@ -0,0 +1,314 @@
+#include "NeighborGrid.hpp"
+#include "ThreadPool.hpp"
+#include <math.h>
+
+namespace GLOO {
+
+// Particles binned by one thread at once. Below two chunks the serial
+// counting sort runs, as there are no histograms to merge.
+const static int kBinGrain = 16384;
+
+const glm::ivec3 NeighborGrid::kHalfStencil[13] = {
+	glm::ivec3(0, 0, 1),
+	glm::ivec3(0, 1, -1), glm::ivec3(0, 1, 0), glm::ivec3(0, 1, 1),
+	glm::ivec3(1, -1, -1), glm::ivec3(1, -1, 0), glm::ivec3(1, -1, 1),
+	glm::ivec3(1, 0, -1), glm::ivec3(1, 0, 0), glm::ivec3(1, 0, 1),
+	glm::ivec3(1, 1, -1), glm::ivec3(1, 1, 0), glm::ivec3(1, 1, 1)
+};
+
+NeighborGrid::NeighborGrid(glm::vec3 origin, glm::vec3 size, float cell_size)
+		: origin_(origin), cell_size_(cell_size) {
+	res_ = glm::ivec3((int) (size.x/cell_size),
+										(int) (size.y/cell_size),
+										(int) (size.z/cell_size));
+	res_ = glm::max(res_, glm::ivec3(1));
+	cell_start_.assign(GetNumCells(), 0);
+	cell_count_.assign(GetNumCells(), 0);
+	cell_offset_.assign(GetNumCells(), 0);
+}
+
+void NeighborGrid::Build(const Vec3Array& positions) {
+	int n = positions.size();
+	ComputeCells(positions, particle_cells_);
+	SortByCell();
+	valid_ = true;
+	stats_.full_rebuilds++;
+	stats_.checked_particles += n;
+}
+
+void NeighborGrid::Update(const Vec3Array& positions) {
+	int n = positions.size();
+	if (!valid_ || n != (int) particle_cells_.size()) {
+		Build(positions);
+		return;
+	}
+	// Same binning loop as Build, then a separate pass for the particles
+	// that changed cell, leaving particle_cells_ at the new cells
+	ComputeCells(positions, new_cells_);
+	int max_movers = (int) (rebuild_fraction_ * n);
+	movers_.clear();
+	mover_old_cells_.clear();
+	for (int i = 0; i < n; i++) {
+		if (new_cells_[i] != particle_cells_[i]) {
+			movers_.push_back(i);
+			mover_old_cells_.push_back(particle_cells_[i]);
+		}
+	}
+	particle_cells_.swap(new_cells_);
+	stats_.checked_particles += n;
+	if ((int) movers_.size() > max_movers) {
+		SortByCell();
+		stats_.full_rebuilds++;
+		return;
+	}
+	stats_.incremental_updates++;
+	stats_.moved_particles += movers_.size();
+	if (movers_.empty()) {
+		return;
+	}
+
+	// Mark the slots the movers leave. A cell lists its particles in index
+	// order, so each one is a binary search within its old cell.
+	removed_.resize(n, 0);
+	int first_cell = GetNumCells();
+	int last_cell = -1;
+	for (size_t k = 0; k < movers_.size(); k++) {
+		int from = mover_old_cells_[k];
+		int to = particle_cells_[movers_[k]];
+		const int* cell_begin = &sorted_indices_[cell_start_[from]];
+		const int* slot = std::lower_bound(cell_begin, cell_begin + cell_count_[from], movers_[k]);
+		removed_[slot - sorted_indices_.data()] = 1;
+		first_cell = std::min(first_cell, std::min(from, to));
+		last_cell = std::max(last_cell, std::max(from, to));
+	}
+	for (size_t k = 0; k < movers_.size(); k++) {
+		cell_count_[mover_old_cells_[k]]--;
+		cell_count_[particle_cells_[movers_[k]]]++;
+	}
+
+	// Only the cells between the first and last one a particle left or
+	// entered change. The counts in between sum to the same total, so the
+	// ranges of the cells outside stay where they are.
+	int begin = cell_start_[first_cell];
+	int end = last_cell + 1 < GetNumCells() ? cell_start_[last_cell + 1] : n;
+	old_indices_.assign(sorted_indices_.begin() + begin, sorted_indices_.begin() + end);
+
+	// Merge the particles that stayed in each changed cell with the ones
+	// that arrived, both in index order, which is the order Build leaves
+	// them in. The unchanged cells in between only shift, as one block.
+	std::sort(movers_.begin(), movers_.end(), [&](int a, int b) {
+		int cell_a = particle_cells_[a];
+		int cell_b = particle_cells_[b];
+		return cell_a < cell_b || (cell_a == cell_b && a < b);
+	});
+	changed_cells_.clear();
+	for (size_t k = 0; k < movers_.size(); k++) {
+		changed_cells_.push_back(mover_old_cells_[k]);
+		changed_cells_.push_back(particle_cells_[movers_[k]]);
+	}
+	std::sort(changed_cells_.begin(), changed_cells_.end());
+	changed_cells_.erase(std::unique(changed_cells_.begin(), changed_cells_.end()), changed_cells_.end());
+
+	int mover_k = 0;
+	int num_movers = movers_.size();
+	int out = begin;
+	int c = first_cell;
+	for (int changed : changed_cells_) {
+		// cell_start_ still holds the old starts from c on
+		int block_begin = cell_start_[c];
+		int block_end = cell_start_[changed];
+		int shift = out - block_begin;
+		if (shift != 0) {
+			std::copy(old_indices_.begin() + (block_begin - begin),
+								old_indices_.begin() + (block_end - begin),
+								sorted_indices_.begin() + out);
+			for (; c < changed; c++) {
+				cell_start_[c] += shift;
+			}
+		}
+		out += block_end - block_begin;
+		c = changed;
+
+		int old_end = changed + 1 < GetNumCells() ? cell_start_[changed + 1] : n;
+		cell_start_[changed] = out;
+		for (int k = block_end; k < old_end; k++) {
+			if (removed_[k]) {
+				removed_[k] = 0;
+				continue;
+			}
+			int i = old_indices_[k - begin];
+			while (mover_k < num_movers && particle_cells_[movers_[mover_k]] == changed && movers_[mover_k] < i) {
+				sorted_indices_[out++] = movers_[mover_k++];
+			}
+			sorted_indices_[out++] = i;
+		}
+		while (mover_k < num_movers && particle_cells_[movers_[mover_k]] == changed) {
+			sorted_indices_[out++] = movers_[mover_k++];
+		}
+		c = changed + 1;
+	}
+}
+
+void NeighborGrid::ComputeCells(const Vec3Array& positions, std::vector<int>& cells) const {
+	int n = positions.size();
+	cells.resize(n);
+	// GetCell on the raw components. Truncation is floor once the negative
+	// values are clamped to 0, and unlike floor it vectorizes. The members
+	// are copied to locals since cells could alias them.
+	const float* px = positions.x();
+	const float* py = positions.y();
+	const float* pz = positions.z();
+	int* out = cells.data();
+	glm::vec3 origin = origin_;
+	float cell_size = cell_size_;
+	glm::ivec3 res = res_;
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			int x = std::min(res.x-1, (int) std::max(0.f, (px[i] - origin.x) / cell_size));
+			int y = std::min(res.y-1, (int) std::max(0.f, (py[i] - origin.y) / cell_size));
+			int z = std::min(res.z-1, (int) std::max(0.f, (pz[i] - origin.z) / cell_size));
+			out[i] = (x * res.y + y) * res.z + z;
+		}
+	}, kBinGrain);
+}
+
+void NeighborGrid::SortByCell() {
+	int n = particle_cells_.size();
+	// resize() only allocates when the particle count grows
+	sorted_indices_.resize(n);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	int num_chunks = std::min(pool.GetNumThreads(), n / kBinGrain);
+	if (num_chunks > 1) {
+		SortByCellParallel(num_chunks);
+		return;
+	}
+	std::fill(cell_count_.begin(), cell_count_.end(), 0);
+
+	// Histogram of the particles per cell
+	for (int i = 0; i < n; i++) {
+		cell_count_[particle_cells_[i]]++;
+	}
+
+	// Exclusive prefix sum gives the start of each cell
+	int start = 0;
+	for (int c = 0; c < GetNumCells(); c++) {
+		cell_start_[c] = start;
+		cell_offset_[c] = start;
+		start += cell_count_[c];
+	}
+
+	// Scatter the particles into their ranges, keeping them in index order
+	for (int i = 0; i < n; i++) {
+		sorted_indices_[cell_offset_[particle_cells_[i]]++] = i;
+	}
+}
+
+void NeighborGrid::SortByCellParallel(int num_chunks) {
+	int n = particle_cells_.size();
+	int num_cells = GetNumCells();
+	int chunk_size = (n + num_chunks - 1) / num_chunks;
+	ThreadPool& pool = ThreadPool::GetInstance();
+	// chunk_offsets_[t * num_cells + c] first counts the particles of chunk
+	// t in cell c, then becomes where chunk t writes its first one
+	chunk_offsets_.resize(num_chunks * num_cells);
+
+	// Histogram of every chunk of particles
+	pool.ParallelFor(0, num_chunks, [&](int begin, int end) {
+		for (int t = begin; t < end; t++) {
+			int* counts = &chunk_offsets_[t * num_cells];
+			std::fill(counts, counts + num_cells, 0);
+			int i_end = std::min(n, (t + 1) * chunk_size);
+			for (int i = t * chunk_size; i < i_end; i++) {
+				counts[particle_cells_[i]]++;
+			}
+		}
+	});
+
+	// Exclusive prefix sum over (cell, chunk) in two passes over blocks of
+	// cells: the total of each block, then the offsets within each block
+	// from its start. Chunk t of a cell goes after chunks 0 ... t-1, which
+	// keeps the particles of every cell in index order.
+	int num_blocks = num_chunks;
+	int block_size = (num_cells + num_blocks - 1) / num_blocks;
+	block_starts_.assign(num_blocks + 1, 0);
+	pool.ParallelFor(0, num_blocks, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			int total = 0;
+			int c_end = std::min(num_cells, (b + 1) * block_size);
+			for (int c = b * block_size; c < c_end; c++) {
+				for (int t = 0; t < num_chunks; t++) {
+					total += chunk_offsets_[t * num_cells + c];
+				}
+			}
+			block_starts_[b + 1] = total;
+		}
+	});
+	for (int b = 0; b < num_blocks; b++) {
+		block_starts_[b + 1] += block_starts_[b];
+	}
+	pool.ParallelFor(0, num_blocks, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			int start = block_starts_[b];
+			int c_end = std::min(num_cells, (b + 1) * block_size);
+			for (int c = b * block_size; c < c_end; c++) {
+				cell_start_[c] = start;
+				for (int t = 0; t < num_chunks; t++) {
+					int count = chunk_offsets_[t * num_cells + c];
+					chunk_offsets_[t * num_cells + c] = start;
+					start += count;
+				}
+				cell_count_[c] = start - cell_start_[c];
+			}
+		}
+	});
+
+	// Every chunk scatters into its own ranges, so no two threads write the
+	// same slot and no atomics are needed
+	pool.ParallelFor(0, num_chunks, [&](int begin, int end) {
+		for (int t = begin; t < end; t++) {
+			int* offsets = &chunk_offsets_[t * num_cells];
+			int i_end = std::min(n, (t + 1) * chunk_size);
+			for (int i = t * chunk_size; i < i_end; i++) {
+				sorted_indices_[offsets[particle_cells_[i]]++] = i;
+			}
+		}
+	});
+}
+
+void NeighborGrid::GetCandidateRuns(std::vector<int>& runs) const {
+	runs.resize(GetNumCells() * 18);
+	// Every x-slab of cells is independent
+	ThreadPool::GetInstance().ParallelFor(0, res_.x, [&](int x_begin, int x_end) {
+		for (int x = x_begin; x < x_end; x++) {
+			for (int y = 0; y < res_.y; y++) {
+				for (int z = 0; z < res_.z; z++) {
+					int* run = &runs[GetCellIndex(glm::ivec3(x, y, z)) * 18];
+					int z_begin = std::max(0, z-1);
+					int z_end = std::min(res_.z-1, z+1);
+					for (int dx = -1; dx <= 1; dx++) {
+						for (int dy = -1; dy <= 1; dy++, run += 2) {
+							if (x+dx < 0 || x+dx >= res_.x || y+dy < 0 || y+dy >= res_.y) {
+								run[0] = run[1] = 0;
+								continue;
+							}
+							int first = GetCellIndex(glm::ivec3(x+dx, y+dy, z_begin));
+							int last = GetCellIndex(glm::ivec3(x+dx, y+dy, z_end));
+							run[0] = cell_start_[first];
+							run[1] = cell_start_[last] + cell_count_[last];
+						}
+					}
+				}
+			}
+		}
+	});
+}
+
+glm::ivec3 NeighborGrid::GetCell(glm::vec3 p) const {
+	glm::vec3 q = (p - origin_)/cell_size_;
+	int x_cell = std::min(res_.x-1, std::max(0, (int)floor(q.x)));
+	int y_cell = std::min(res_.y-1, std::max(0, (int)floor(q.y)));
+	int z_cell = std::min(res_.z-1, std::max(0, (int)floor(q.z)));
+	return glm::ivec3(x_cell, y_cell, z_cell);
+}
+
+}  // namespace GLOO
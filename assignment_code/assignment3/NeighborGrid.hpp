@@ -0,0 +1,182 @@
+#ifndef NEIGHBOR_GRID_H_
+#define NEIGHBOR_GRID_H_
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "Vec3Array.hpp"
+
+namespace GLOO {
+
+// A uniform cell list over an axis aligned box. Particles are binned with a
+// counting sort, so the indices of every cell are one contiguous range of
+// GetSortedIndices() and rebuilding it reuses the same buffers every time.
+class NeighborGrid {
+ public:
+	// How the particles were rebinned since the last ResetRebinStats
+	struct RebinStats {
+		// Calls to Build, or Updates that fell back to it
+		int full_rebuilds = 0;
+		// Updates that only moved the particles that changed cell
+		int incremental_updates = 0;
+		// Particles that changed cell, over all incremental updates
+		long long moved_particles = 0;
+		// Particles checked by all updates
+		long long checked_particles = 0;
+	};
+
+	NeighborGrid() {}
+	// origin is the bottom corner of the box, size its extent along each
+	// axis. Points outside of the box are clamped into the border cells.
+	NeighborGrid(glm::vec3 origin, glm::vec3 size, float cell_size);
+
+	// Rebins all of the particles
+	void Build(const Vec3Array& positions);
+	// Same result as Build, but only relocates the particles that changed
+	// cell since the last Build or Update. Falls back to Build when more
+	// than the rebuild fraction of them did, or when the particles may have
+	// been added or reordered.
+	void Update(const Vec3Array& positions);
+	// Makes the next Update a full Build, e.g. after the particles were
+	// permuted
+	void Invalidate() { valid_ = false; }
+
+	void SetRebuildFraction(float fraction) { rebuild_fraction_ = fraction; }
+	const RebinStats& GetRebinStats() const { return stats_; }
+	void ResetRebinStats() { stats_ = RebinStats(); }
+
+	// Gets the grid cell a point is in
+	glm::ivec3 GetCell(glm::vec3 p) const;
+	int GetCellIndex(glm::ivec3 cell) const {
+		return (cell.x * res_.y + cell.y) * res_.z + cell.z;
+	}
+	glm::ivec3 GetCellCoordinates(int c) const {
+		return glm::ivec3(c / (res_.y * res_.z), (c / res_.z) % res_.y, c % res_.z);
+	}
+
+	// The particles of cell c are
+	// GetSortedIndices()[GetCellStart(c)] ... [GetCellStart(c) + GetCellCount(c) - 1]
+	int GetCellStart(int c) const { return cell_start_[c]; }
+	int GetCellCount(int c) const { return cell_count_[c]; }
+	const std::vector<int>& GetSortedIndices() const { return sorted_indices_; }
+	const std::vector<int>& GetCellStarts() const { return cell_start_; }
+	const std::vector<int>& GetCellCounts() const { return cell_count_; }
+	// The cell each particle was binned into by the last Build
+	int GetParticleCell(int i) const { return particle_cells_[i]; }
+
+	glm::ivec3 GetResolution() const { return res_; }
+	int GetNumCells() const { return res_.x * res_.y * res_.z; }
+
+	// Calls f(j) for every particle j in the 3x3x3 block of cells around p
+	template <class F>
+	void ForEachCandidate(glm::vec3 p, F f) const {
+		glm::ivec3 cell = GetCell(p);
+		for (int x = std::max(0, cell.x-1); x < std::min(res_.x, cell.x+2); x++) {
+			for (int y = std::max(0, cell.y-1); y < std::min(res_.y, cell.y+2); y++) {
+				for (int z = std::max(0, cell.z-1); z < std::min(res_.z, cell.z+2); z++) {
+					int c = GetCellIndex(glm::ivec3(x, y, z));
+					int end = cell_start_[c] + cell_count_[c];
+					for (int k = cell_start_[c]; k < end; k++) {
+						f(sorted_indices_[k]);
+					}
+				}
+			}
+		}
+	}
+
+	// For every cell, the 9 ranges of GetSortedIndices() that hold the
+	// particles of the 3x3x3 block of cells around it. Cells adjacent in z
+	// are adjacent in memory, so each z-column of the block is one range.
+	// Writes 18 ints per cell: begin and end of each range, empty ranges
+	// for columns outside of the grid.
+	void GetCandidateRuns(std::vector<int>& runs) const;
+
+	// Calls f(i, j) once for every unordered pair of distinct particles in
+	// the same or adjacent cells. This is the half stencil: each cell is
+	// paired with itself and with the 13 neighbors that come after it.
+	template <class F>
+	void ForEachPair(F f) const {
+		for (int x = 0; x < res_.x; x++) {
+			for (int y = 0; y < res_.y; y++) {
+				for (int z = 0; z < res_.z; z++) {
+					int c = GetCellIndex(glm::ivec3(x, y, z));
+					int begin = cell_start_[c];
+					int end = begin + cell_count_[c];
+					for (int a = begin; a < end; a++) {
+						for (int b = a+1; b < end; b++) {
+							f(sorted_indices_[a], sorted_indices_[b]);
+						}
+					}
+					for (int o = 0; o < 13; o++) {
+						glm::ivec3 n = glm::ivec3(x, y, z) + kHalfStencil[o];
+						if (n.x >= res_.x || n.y < 0 || n.y >= res_.y ||
+								n.z < 0 || n.z >= res_.z) {
+							continue;
+						}
+						int nc = GetCellIndex(n);
+						int n_begin = cell_start_[nc];
+						int n_end = n_begin + cell_count_[nc];
+						for (int a = begin; a < end; a++) {
+							for (int b = n_begin; b < n_end; b++) {
+								f(sorted_indices_[a], sorted_indices_[b]);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+ private:
+	// The cell index of every particle
+	void ComputeCells(const Vec3Array& positions, std::vector<int>& cells) const;
+	// Counting sort of the particles by particle_cells_
+	void SortByCell();
+	// The same sort over num_chunks chunks of particles in parallel, with a
+	// histogram per chunk
+	void SortByCellParallel(int num_chunks);
+
+	// The 13 cell offsets that are lexicographically greater than (0, 0, 0)
+	static const glm::ivec3 kHalfStencil[13];
+
+	glm::vec3 origin_;
+	float cell_size_ = 1.f;
+	glm::ivec3 res_ = glm::ivec3(0);
+
+	// Offset of the first particle of each cell in sorted_indices_ and the
+	// number of particles in it
+	std::vector<int> cell_start_;
+	std::vector<int> cell_count_;
+	// Particle indices ordered by cell
+	std::vector<int> sorted_indices_;
+	std::vector<int> particle_cells_;
+	// Scatter cursor for the counting sort
+	std::vector<int> cell_offset_;
+	// Per chunk histograms and scatter cursors of SortByCellParallel, and
+	// the first sorted slot of each block of cells
+	std::vector<int> chunk_offsets_;
+	std::vector<int> block_starts_;
+
+	// Whether particle_cells_ match the particles passed to Update
+	bool valid_ = false;
+	// Incremental updates beat the counting sort up to about 0.5% movers
+	// on coarse grids and 2% on fine ones
+	float rebuild_fraction_ = 0.01f;
+	RebinStats stats_;
+	// Cells computed by Update, swapped into particle_cells_
+	std::vector<int> new_cells_;
+	// Particles that changed cell in Update and the cells they left
+	std::vector<int> movers_;
+	std::vector<int> mover_old_cells_;
+	// Scratch copy of the slice of sorted_indices_ being rewritten, and
+	// the slots of it the movers left
+	std::vector<int> old_indices_;
+	std::vector<char> removed_;
+	// Cells that lost or gained particles in Update, in order
+	std::vector<int> changed_cells_;
+};
+}  // namespace GLOO
+
+#endif
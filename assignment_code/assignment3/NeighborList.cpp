@@ -0,0 +1,106 @@
+#include "NeighborList.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+#include "ThreadPool.hpp"
+
+namespace GLOO {
+
+// Smallest chunk of particles a thread takes
+const static int kListGrain = 64;
+
+void NeighborList::Build(const NeighborGrid& grid,
+												 const Vec3Array& positions,
+												 float radius,
+												 float skin,
+												 bool half) {
+	BuildFrom(grid, positions, radius, skin, half);
+}
+
+void NeighborList::Build(const SpatialHash& grid,
+												 const Vec3Array& positions,
+												 float radius,
+												 float skin,
+												 bool half) {
+	BuildFrom(grid, positions, radius, skin, half);
+}
+
+template <class TGrid>
+void NeighborList::BuildFrom(const TGrid& grid,
+														 const Vec3Array& positions,
+														 float radius,
+														 float skin,
+														 bool half) {
+	int n = positions.size();
+	float cutoff2 = (radius + skin) * (radius + skin);
+
+	ThreadPool& pool = ThreadPool::GetInstance();
+	// Counts every list first, so each particle knows where its list goes
+	// and the lists can be filled in parallel. start_[i+1] holds the count of
+	// particle i until the prefix sum.
+	start_.resize(n + 1);
+	start_[0] = 0;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = positions[i];
+			int count = 0;
+			grid.ForEachCandidate(p, [&](int j) {
+				if (half && j <= i) {
+					return;
+				}
+				glm::vec3 d = positions[j] - p;
+				count += glm::dot(d, d) < cutoff2;
+			});
+			start_[i + 1] = count;
+		}
+	}, kListGrain);
+	for (int i = 0; i < n; i++) {
+		start_[i + 1] += start_[i];
+	}
+
+	// resize() keeps the capacity, so steady state rebuilds don't allocate
+	neighbors_.resize(start_[n]);
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = positions[i];
+			int k = start_[i];
+			grid.ForEachCandidate(p, [&](int j) {
+				if (half && j <= i) {
+					return;
+				}
+				glm::vec3 d = positions[j] - p;
+				if (glm::dot(d, d) < cutoff2) {
+					neighbors_[k++] = j;
+				}
+			});
+		}
+	}, kListGrain);
+
+	reference_positions_ = positions;
+	skin_ = skin;
+	half_ = half;
+	valid_ = true;
+	num_builds_++;
+}
+
+bool NeighborList::NeedsRebuild(const Vec3Array& positions) const {
+	if (!valid_ || positions.size() != reference_positions_.size()) {
+		return true;
+	}
+	// The largest move of any particle since the last Build
+	float max_d2 = 0.f;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, positions.size(), [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 d = positions[i] - reference_positions_[i];
+			chunk_max = std::max(chunk_max, glm::dot(d, d));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_d2 = std::max(max_d2, chunk_max);
+	}, kListGrain);
+	return max_d2 > 0.25f * skin_ * skin_;
+}
+
+}  // namespace GLOO
@@ -0,0 +1,86 @@
+#ifndef NEIGHBOR_LIST_H_
+#define NEIGHBOR_LIST_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NeighborGrid.hpp"
+#include "SpatialHash.hpp"
+
+namespace GLOO {
+
+// Verlet neighbor lists: for every particle, all particles (itself
+// included, unless the lists are half lists) within radius + skin at the
+// time of the last Build. The lists
+// stay valid while no particle has moved more than skin/2 since then, so
+// they can be reused across integrator stages and time steps. Build and
+// NeedsRebuild run on the thread pool.
+class NeighborList {
+ public:
+	// grid has to be built from positions already. Half lists only store
+	// the neighbors j > i of each particle i, so every pair appears once.
+	void Build(const NeighborGrid& grid,
+						 const Vec3Array& positions,
+						 float radius,
+						 float skin,
+						 bool half = false);
+	void Build(const SpatialHash& grid,
+						 const Vec3Array& positions,
+						 float radius,
+						 float skin,
+						 bool half = false);
+
+	// Whether the particle count changed or some particle moved more than
+	// half the skin since the last Build.
+	bool NeedsRebuild(const Vec3Array& positions) const;
+
+	// Forces the next NeedsRebuild to return true
+	void Invalidate() { valid_ = false; }
+
+	// Calls f(j) for every neighbor j of particle i
+	template <class F>
+	void ForEachNeighbor(int i, F f) const {
+		for (int k = start_[i]; k < start_[i+1]; k++) {
+			f(neighbors_[k]);
+		}
+	}
+
+	// Calls f(i, j) for every stored pair. On half lists that is every
+	// unordered pair exactly once.
+	template <class F>
+	void ForEachPair(F f) const {
+		for (int i = 0; i + 1 < (int)start_.size(); i++) {
+			for (int k = start_[i]; k < start_[i+1]; k++) {
+				f(i, neighbors_[k]);
+			}
+		}
+	}
+
+	bool IsHalf() const { return half_; }
+	int GetNumBuilds() const { return num_builds_; }
+
+ private:
+	// Both Builds, for either cell structure
+	template <class TGrid>
+	void BuildFrom(const TGrid& grid,
+								 const Vec3Array& positions,
+								 float radius,
+								 float skin,
+								 bool half);
+
+	// The neighbors of particle i are neighbors_[start_[i]] ... neighbors_[start_[i+1] - 1]
+	std::vector<int> start_;
+	std::vector<int> neighbors_;
+
+	// Positions at the time of the last Build
+	Vec3Array reference_positions_;
+	float skin_ = 0.f;
+	bool half_ = false;
+	bool valid_ = false;
+
+	int num_builds_ = 0;
+};
+}  // namespace GLOO
+
+#endif
@@ -6,52 +6,226 @@
 
 #include <glm/glm.hpp>
 
+#include "Vec3Array.hpp"
+
 namespace GLOO {
+// Base of the lazy expressions built by the ParticleState operators below.
+// An expression such as state + dt * (k_1 + k_2) only holds pointers to its
+// operands, and is evaluated in a single pass once it is assigned or added
+// to a ParticleState. Component C of an expression is x, y, z of the
+// positions for C = 0, 1, 2 and of the velocities for C = 3, 4, 5.
+template <class E>
+struct StateExpr {
+  const E& self() const {
+    return static_cast<const E&>(*this);
+  }
+};
+
 struct ParticleState {
-  // The state of a particle system: positions and velocities.
-  std::vector<glm::vec3> positions;
-  std::vector<glm::vec3> velocities;
+  // The state of a particle system: positions and velocities, each stored
+  // as a structure of arrays.
+  Vec3Array positions;
+  Vec3Array velocities;
+
+  ParticleState() {
+  }
+  template <class E>
+  ParticleState(const StateExpr<E>& e) {
+    *this = e;
+  }
+
+  // Evaluates e into this state, reusing its storage
+  template <class E>
+  ParticleState& operator=(const StateExpr<E>& e) {
+    positions.resize(e.self().size());
+    velocities.resize(e.self().size());
+    Evaluate<false>(e.self());
+    return *this;
+  }
+
+  template <class E>
+  ParticleState& operator+=(const StateExpr<E>& e) {
+    if (positions.size() != e.self().size() ||
+        velocities.size() != e.self().size()) {
+      throw std::runtime_error(
+          "Cannot add particle states with inconsistent sizes!");
+    }
+    Evaluate<true>(e.self());
+    return *this;
+  }
 
   ParticleState& operator+=(const ParticleState& rhs) {
+    CheckSameSize(rhs);
+
+    // The padding is zero on both sides, so the loops can run over it.
+    ParallelForPadded(positions.GetPaddedSize(), [&](size_t begin, size_t end) {
+      for (int axis = 0; axis < 3; axis++) {
+        float* __restrict p = positions.component(axis);
+        float* __restrict v = velocities.component(axis);
+        const float* __restrict rhs_p = rhs.positions.component(axis);
+        const float* __restrict rhs_v = rhs.velocities.component(axis);
+        for (size_t i = begin; i < end; i++) {
+          p[i] += rhs_p[i];
+          v[i] += rhs_v[i];
+        }
+      }
+    });
+    return *this;
+  }
+
+  ParticleState& operator*=(float k) {
+    ParallelForPadded(positions.GetPaddedSize(), [&](size_t begin, size_t end) {
+      for (int axis = 0; axis < 3; axis++) {
+        float* __restrict p = positions.component(axis);
+        float* __restrict v = velocities.component(axis);
+        for (size_t i = begin; i < end; i++) {
+          p[i] *= k;
+          v[i] *= k;
+        }
+      }
+    });
+    return *this;
+  }
+
+  // Moves particle order[k] into slot k. Every per-particle array has to be
+  // permuted here so that particles stay consistent across arrays.
+  void Permute(const std::vector<int>& order) {
+    positions.Permute(order);
+    velocities.Permute(order);
+  }
+
+ private:
+  // Evaluates e over the whole padded range, including the zero padding,
+  // one component at a time so that every loop vectorizes.
+  template <bool kAdd, class E>
+  void Evaluate(const E& e) {
+    ParallelForPadded(positions.GetPaddedSize(), [&](size_t begin, size_t end) {
+      EvaluateComponent<kAdd, 0>(positions.x(), e, begin, end);
+      EvaluateComponent<kAdd, 1>(positions.y(), e, begin, end);
+      EvaluateComponent<kAdd, 2>(positions.z(), e, begin, end);
+      EvaluateComponent<kAdd, 3>(velocities.x(), e, begin, end);
+      EvaluateComponent<kAdd, 4>(velocities.y(), e, begin, end);
+      EvaluateComponent<kAdd, 5>(velocities.z(), e, begin, end);
+    });
+  }
+
+  // out may be one of the operands of e, which is fine since every element
+  // only depends on the same element of the operands.
+  template <bool kAdd, int C, class E>
+  static void EvaluateComponent(float* out, const E& e, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      float value = e.template Get<C>(i);
+      out[i] = kAdd ? out[i] + value : value;
+    }
+  }
+
+  void CheckSameSize(const ParticleState& rhs) const {
     if (positions.size() != rhs.positions.size() ||
         velocities.size() != rhs.velocities.size() ||
         positions.size() != rhs.velocities.size()) {
       throw std::runtime_error(
           "Cannot add particle states with inconsistent sizes!");
     }
+  }
+};
 
-    for (size_t i = 0; i < positions.size(); i++) {
-      positions[i] += rhs.positions[i];
-      velocities[i] += rhs.velocities[i];
+// A ParticleState as an operand of an expression
+class StateRef : public StateExpr<StateRef> {
+ public:
+  explicit StateRef(const ParticleState& state)
+      : size_(state.positions.size()) {
+    for (int axis = 0; axis < 3; axis++) {
+      data_[axis] = state.positions.component(axis);
+      data_[axis + 3] = state.velocities.component(axis);
     }
-    return *this;
   }
 
-  ParticleState& operator*=(float k) {
-    for (size_t i = 0; i < positions.size(); i++) {
-      positions[i] *= k;
-      velocities[i] *= k;
+  size_t size() const {
+    return size_;
+  }
+  template <int C>
+  float Get(size_t i) const {
+    return data_[C][i];
+  }
+
+ private:
+  const float* data_[6];
+  size_t size_;
+};
+
+template <class L, class R>
+class StateSum : public StateExpr<StateSum<L, R>> {
+ public:
+  StateSum(const L& l, const R& r) : l_(l), r_(r) {
+    if (l.size() != r.size()) {
+      throw std::runtime_error(
+          "Cannot add particle states with inconsistent sizes!");
     }
-    return *this;
   }
+
+  size_t size() const {
+    return l_.size();
+  }
+  template <int C>
+  float Get(size_t i) const {
+    return l_.template Get<C>(i) + r_.template Get<C>(i);
+  }
+
+ private:
+  // Held by value, the leaves are only a few pointers
+  L l_;
+  R r_;
+};
+
+template <class E>
+class StateScaled : public StateExpr<StateScaled<E>> {
+ public:
+  StateScaled(float k, const E& e) : k_(k), e_(e) {
+  }
+
+  size_t size() const {
+    return e_.size();
+  }
+  template <int C>
+  float Get(size_t i) const {
+    return k_ * e_.template Get<C>(i);
+  }
+
+ private:
+  float k_;
+  E e_;
 };
 
-// Operators, optimized via overloading + std::move.
-inline ParticleState operator+(ParticleState s1, const ParticleState& s2) {
-  s1 += s2;
-  return s1;
+// Operators, building expressions instead of temporary states.
+template <class L, class R>
+StateSum<L, R> operator+(const StateExpr<L>& l, const StateExpr<R>& r) {
+  return StateSum<L, R>(l.self(), r.self());
+}
+template <class R>
+StateSum<StateRef, R> operator+(const ParticleState& l, const StateExpr<R>& r) {
+  return StateSum<StateRef, R>(StateRef(l), r.self());
+}
+template <class L>
+StateSum<L, StateRef> operator+(const StateExpr<L>& l, const ParticleState& r) {
+  return StateSum<L, StateRef>(l.self(), StateRef(r));
+}
+inline StateSum<StateRef, StateRef> operator+(const ParticleState& l,
+                                              const ParticleState& r) {
+  return StateSum<StateRef, StateRef>(StateRef(l), StateRef(r));
+}
+template <class E>
+StateScaled<E> operator*(float k, const StateExpr<E>& e) {
+  return StateScaled<E>(k, e.self());
 }
-inline ParticleState operator+(const ParticleState& s1, ParticleState&& s2) {
-  s2 += s1;
-  return std::move(s2);
+template <class E>
+StateScaled<E> operator*(const StateExpr<E>& e, float k) {
+  return StateScaled<E>(k, e.self());
 }
-inline ParticleState operator*(ParticleState s1, float k) {
-  s1 *= k;
-  return s1;
+inline StateScaled<StateRef> operator*(float k, const ParticleState& s) {
+  return StateScaled<StateRef>(k, StateRef(s));
 }
-inline ParticleState operator*(float k, ParticleState s1) {
-  s1 *= k;
-  return s1;
+inline StateScaled<StateRef> operator*(const ParticleState& s, float k) {
+  return StateScaled<StateRef>(k, StateRef(s));
 }
 }  // namespace GLOO
 
@@ -11,6 +11,45 @@ class ParticleSystemBase {
 
   virtual ParticleState ComputeTimeDerivative(const ParticleState& state,
                                               float time) = 0;
+
+  // Same as above, but writes into derivative so that a caller reusing it
+  // across steps doesn't allocate. Systems should override this one when
+  // they can fill derivative in place.
+  virtual void ComputeTimeDerivative(const ParticleState& state,
+                                     float time,
+                                     ParticleState& derivative) {
+    derivative = ComputeTimeDerivative(state, time);
+  }
+
+  // Pressure projection solvers (PCISPH, ...) need to know the step size,
+  // so they advance the state by dt themselves and return true. Systems that
+  // only provide time derivatives return false and are stepped by one of
+  // the IntegratorBase subclasses instead.
+  virtual bool Advance(ParticleState& state, float time, float dt) {
+    return false;
+  }
+  // Iterations the last Advance took, for solvers that iterate
+  virtual int GetSolverIterations() const {
+    return 0;
+  }
+
+  // Called after the particles of the state were reordered with
+  // ParticleState::Permute, so that per-particle caches can follow.
+  virtual void OnParticlesPermuted(const std::vector<int>& order) {
+  }
+
+  // Used by TimeStepController to pick stable time steps. A system that
+  // returns 0 for any of them is not limited by the matching criterion.
+  virtual float GetSmoothingLength() const {
+    return 0.f;
+  }
+  virtual float GetKinematicViscosity() const {
+    return 0.f;
+  }
+  // Largest particle acceleration found by the last ComputeTimeDerivative
+  virtual float GetMaxAcceleration() const {
+    return 0.f;
+  }
 };
 }  // namespace GLOO
 
@@ -1,6 +1,8 @@
 #ifndef PARTICLE_SYSTEM_NODE_H_
 #define PARTICLE_SYSTEM_NODE_H_
 
+#include <bitset>
+
 #include "gloo/SceneNode.hpp"
 #include "gloo/debug/PrimitiveFactory.hpp"
 #include "gloo/components/RenderingComponent.hpp"
@@ -14,6 +16,9 @@
 #include "ParticleSystemBase.hpp"
 #include "ParticleState.hpp"
 #include "Grid.hpp"
+#include "MortonOrder.hpp"
+#include "TimeStepController.hpp"
+#include "SimulationBox.hpp"
 #include "stb_image.h"
 #include "stb_image_write.h"
 
@@ -31,16 +36,40 @@ class ParticleSystemNode : public SceneNode {
                      float dt);
   void Update(double delta_time) override;
 
+  // Sorts the particles along a Z-order curve every steps integration
+  // steps, so that particles close in space are close in memory. 0 disables
+  // the reordering.
+  void SetReorderInterval(int steps) {
+    reorder_interval_ = steps;
+  }
+
+  // Replaces the fixed dt by one chosen every step from the CFL, force and
+  // viscosity criteria, clamped to [min_dt, max_dt].
+  void UseAdaptiveTimeStep(float min_dt, float max_dt) {
+    adaptive_dt_ = true;
+    time_step_controller_.SetBounds(min_dt, max_dt);
+  }
+  // Prints the solver iterations of every step, for the solvers that
+  // iterate. Otherwise they only show up in the periodic status line.
+  void SetLogIterations(bool enabled) {
+    log_iterations_ = enabled;
+  }
+  // The dt of the last step
+  float GetTimeStep() const {
+    return dt_;
+  }
+
  private:
   void InitializeParticles();
+  void ReorderParticles();
   NormalArray CalculateNormals();
   void DrawWater();
 
   std::unique_ptr<IntegratorBase<TSystem, ParticleState>> integrator_;
   TSystem base_;
   ParticleState state_;
-  std::vector<glm::vec3> original_pos_;
-  std::vector<glm::vec3> original_vel_;
+  Vec3Array original_pos_;
+  Vec3Array original_vel_;
 
   std::shared_ptr<VertexObject> sphere_mesh_;
   std::shared_ptr<PhongShader> shader_;
@@ -48,21 +77,27 @@ class ParticleSystemNode : public SceneNode {
   std::shared_ptr<Material> material_comp_;
 
   std::vector<SceneNode*> particles;
+  // The stable id of the particle in each slot of state_, which indexes
+  // particles. Slots get shuffled by ReorderParticles, ids never change.
+  std::vector<int> particle_ids_;
 
 	Grid grid_;
 
   float dt_;
+	bool adaptive_dt_ = false;
+	TimeStepController time_step_controller_;
 	float fps_ = 1.f/120.f;
 	float fps_pos_ = 0.f;
 
   float cur_time_;
   int count = 0;
 
-	float box_width_ = 2.f; //TODO: This is also hardcoded in RK4 integrator and WaterSystem
-	float box_height_ = 2.f;
-
 	int frame_ = 0;
 
+	int reorder_interval_ = 0;
+	int step_ = 0;
+	bool log_iterations_ = false;
+
 	int width_;
 	int height_;
 };
@@ -86,8 +121,7 @@ ParticleSystemNode<TSystem>::ParticleSystemNode(
   original_pos_ = state.positions;
   original_vel_ = state.velocities;
 
-	grid_ = Grid(glm::vec3(-box_width_/2.f, -box_height_/2.f, -box_width_/2.f),
-							 glm::vec3(box_width_/2.f, box_height_/2.f, box_width_/2.f));
+	grid_ = Grid(BOX_MIN, BOX_MAX);
 
   cur_time_ = 0.;
   dt_ = dt;
@@ -107,7 +141,18 @@ ParticleSystemNode<TSystem>::ParticleSystemNode(
 template<class TSystem>
 void ParticleSystemNode<TSystem>::Update(double delta_time) {
   // Now just take one step everytime
-	state_ = integrator_->Integrate(base_, state_, cur_time_, dt_);
+	if (adaptive_dt_) {
+		dt_ = time_step_controller_.ComputeTimeStep(base_, state_);
+	}
+	integrator_->Step(base_, state_, cur_time_, dt_);
+	cur_time_ += dt_;
+	step_ += 1;
+	if (log_iterations_ && base_.GetSolverIterations() > 0) {
+		std::cout << "step " << step_ << ": " << base_.GetSolverIterations() << " solver iterations\n";
+	}
+	if (reorder_interval_ > 0 && step_ % reorder_interval_ == 0) {
+		ReorderParticles();
+	}
  	DrawWater();
 
 	if (fps_pos_ > fps_) {
@@ -130,6 +175,7 @@ void ParticleSystemNode<TSystem>::Update(double delta_time) {
     particle_node->CreateComponent<ShadingComponent>(shader_);
     // particle_node->CreateComponent<RenderingComponent>(sphere_mesh_);
     particle_node->CreateComponent<MaterialComponent>(material_comp_);
+    particle_ids_.push_back(particles.size());
     particles.push_back(particle_node.get());
     AddChild(std::move(particle_node));
     float r_x = (((float) rand()/RAND_MAX) - 0.5f) * 0.25f;
@@ -138,13 +184,17 @@ void ParticleSystemNode<TSystem>::Update(double delta_time) {
     state_.velocities.push_back(glm::vec3(0.f,-2.5f,0.f));
 
   	for (int i = 0; i < state_.positions.size(); i++) {
-      SceneNode* particle = particles[i];
+      SceneNode* particle = particles[particle_ids_[i]];
       particle->GetTransform().SetPosition(state_.positions[i]);
     }
     count = 0;
 
     if (state_.positions.size() % 250 == 0){
-      std::cout << state_.velocities.size() << '\n';
+      std::cout << state_.velocities.size() << " particles, dt " << dt_;
+      if (base_.GetSolverIterations() > 0) {
+        std::cout << ", " << base_.GetSolverIterations() << " solver iterations";
+      }
+      std::cout << '\n';
     }
 
   }
@@ -161,11 +211,21 @@ void ParticleSystemNode<TSystem>::InitializeParticles() {
     // particle_node->CreateComponent<ShadingComponent>(shader_);
     // particle_node->CreateComponent<RenderingComponent>(sphere_mesh_);
     // particle_node->CreateComponent<MaterialComponent>(material_comp_);
+    particle_ids_.push_back(particles.size());
     particles.push_back(particle_node.get());
     AddChild(std::move(particle_node));
   }
 }
 
+template<class TSystem>
+void ParticleSystemNode<TSystem>::ReorderParticles() {
+	std::vector<int> order = ComputeMortonOrder(state_.positions, BOX_MIN, BOX_SIZE);
+	state_.Permute(order);
+	PermuteArray(particle_ids_, order);
+	base_.OnParticlesPermuted(order);
+	integrator_->OnParticlesPermuted(order);
+}
+
 template<class TSystem>
 NormalArray ParticleSystemNode<TSystem>::CalculateNormals() {
   PositionArray positions = vertex_obj_->GetPositions();
@@ -202,7 +262,7 @@ void ParticleSystemNode<TSystem>::DrawWater() {
 	NormalArray n_array;
 	n_array.clear();
 
-	grid_.CalculateBlobs(state_.positions, p_array, i_array, n_array);
+	grid_.CalculateBlobs(state_.positions.ToVector(), p_array, i_array, n_array);
 
 	auto positions = make_unique<PositionArray>(p_array);
   auto indices = make_unique<IndexArray>(i_array);
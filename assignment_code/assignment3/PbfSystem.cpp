@@ -0,0 +1,207 @@
+#include "PbfSystem.hpp"
+#include "ThreadPool.hpp"
+#include "SimulationBox.hpp"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+
+namespace GLOO {
+
+PbfSystem::PbfSystem() {
+	grid_ = NeighborGrid(BOX_MIN, BOX_SIZE, grid_cell_size_);
+	walls_.SetRestDensity(rest_density_);
+}
+
+void PbfSystem::SetRestDensity(float rest_density) {
+	rest_density_ = rest_density;
+	walls_.SetRestDensity(rest_density);
+}
+
+ParticleState PbfSystem::ComputeTimeDerivative(const ParticleState& state,
+																							 float time) {
+	ParticleState derivative;
+	ComputeTimeDerivative(state, time, derivative);
+	return derivative;
+}
+
+void PbfSystem::ComputeTimeDerivative(const ParticleState& state,
+																			float time,
+																			ParticleState& derivative) {
+	Solve(state, time_step_);
+	// An Euler step of time_step_ lands on the projected positions
+	int n = state.positions.size();
+	float inv_dt = 1.f / time_step_;
+	derivative.positions.resize(n);
+	derivative.velocities.resize(n);
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			derivative.positions[i] = inv_dt * (glm::vec3(predicted_positions_[i]) - glm::vec3(state.positions[i]));
+			derivative.velocities[i] = inv_dt * (glm::vec3(velocities_[i]) - glm::vec3(state.velocities[i]));
+		}
+	}, kParticleGrain);
+}
+
+bool PbfSystem::Advance(ParticleState& state, float time, float dt) {
+	time_step_ = dt;
+	Solve(state, dt);
+	state.positions = predicted_positions_;
+	state.velocities = velocities_;
+	return true;
+}
+
+void PbfSystem::OnParticlesPermuted(const std::vector<int>& order) {
+	neighbors_.Invalidate();
+}
+
+void PbfSystem::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
+	state.positions.push_back(position);
+	state.velocities.push_back(velocity);
+}
+
+void PbfSystem::Solve(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	predicted_positions_.resize(n);
+	corrections_.resize(n);
+	velocities_.resize(n);
+	lambdas_.resize(n);
+	factors_.resize(n);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	glm::vec3 lo = BOX_MIN + wall_margin_;
+	glm::vec3 hi = BOX_MAX - wall_margin_;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 v = glm::vec3(state.velocities[i]) + dt*GRAVITY;
+			predicted_positions_[i] = glm::clamp(glm::vec3(state.positions[i]) + dt*v, lo, hi);
+		}
+	}, kParticleGrain);
+
+	// The neighbors are found once per step, at the predicted positions
+	if (neighbors_.NeedsRebuild(predicted_positions_)) {
+		grid_.Build(predicted_positions_);
+		neighbors_.Build(grid_, predicted_positions_, H, skin_);
+	}
+	for (int it = 0; it < iterations_; it++) {
+		density_error_ = ComputeLambdas();
+		ApplyCorrections();
+	}
+
+	float inv_dt = 1.f / dt;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			velocities_[i] = inv_dt * (glm::vec3(predicted_positions_[i]) - glm::vec3(state.positions[i]));
+		}
+	}, kParticleGrain);
+	ApplyViscosity();
+
+	float max_acceleration_sq = 0.f;
+	std::mutex max_mutex;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 dv = glm::vec3(velocities_[i]) - glm::vec3(state.velocities[i]);
+			chunk_max = std::max(chunk_max, glm::dot(dv, dv));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_acceleration_sq = std::max(max_acceleration_sq, chunk_max);
+	}, kParticleGrain);
+	max_acceleration_ = sqrt(max_acceleration_sq) * inv_dt;
+}
+
+float PbfSystem::ComputeLambdas() {
+	int n = predicted_positions_.size();
+	float error_sum = ThreadPool::GetInstance().ParallelSum<float>(0, n, [&](int begin, int end) {
+		float chunk_sum = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = predicted_positions_[i];
+			float rho = walls_.Density(p);
+			glm::vec3 grad_sum = walls_.PressureGradient(p);
+			float grad_sq_sum = 0.f;
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(predicted_positions_[j]);
+				float d2 = glm::dot(r, r);
+				if (d2 < HSQ) {
+					rho += MASS*MullerKernels::Density(d2);
+					float d = sqrt(d2);
+					if (d > 0.f) {
+						glm::vec3 grad = MASS*MullerKernels::PressureGradient(d) * r/d;
+						grad_sum += grad;
+						grad_sq_sum += glm::dot(grad, grad);
+					}
+				}
+			});
+			// Only compression is a violation, otherwise the free surface
+			// clumps together
+			float constraint = std::max(0.f, rho/rest_density_ - 1.f);
+			float denominator = glm::dot(grad_sum, grad_sum) + grad_sq_sum;
+			factors_[i] = denominator > 1e-6f ? rest_density_*rest_density_ / denominator : 0.f;
+			lambdas_[i] = -constraint * factors_[i];
+			chunk_sum += constraint;
+		}
+		return chunk_sum;
+	}, kParticleGrain);
+	return n > 0 ? error_sum / n : 0.f;
+}
+
+float PbfSystem::TensileCorrection(float d2) const {
+	float reference = HSQ - tensile_distance_*tensile_distance_*HSQ;
+	float t = (HSQ - d2) / reference;
+	float ratio = t*t*t;
+	return tensile_strength_ * ratio*ratio*ratio*ratio;
+}
+
+void PbfSystem::ApplyCorrections() {
+	int n = predicted_positions_.size();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = predicted_positions_[i];
+			float lambda = lambdas_[i];
+			// The fluid behind the walls has the particle's own lambda
+			glm::vec3 correction = lambda * walls_.PressureGradient(p);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(predicted_positions_[j]);
+				float d2 = glm::dot(r, r);
+				if (d2 < HSQ && d2 > 0.f) {
+					float d = sqrt(d2);
+					float tensile = -TensileCorrection(d2) * (factors_[i] + factors_[j])/2.f;
+					correction += (lambda + lambdas_[j] + tensile) * MASS*MullerKernels::PressureGradient(d) * r/d;
+				}
+			});
+			corrections_[i] = correction / rest_density_;
+		}
+	}, kParticleGrain);
+	glm::vec3 lo = BOX_MIN + wall_margin_;
+	glm::vec3 hi = BOX_MAX - wall_margin_;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = glm::vec3(predicted_positions_[i]) + glm::vec3(corrections_[i]);
+			predicted_positions_[i] = glm::clamp(p, lo, hi);
+		}
+	}, kParticleGrain);
+}
+
+void PbfSystem::ApplyViscosity() {
+	int n = predicted_positions_.size();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	// XSPH, averaging the velocities of the neighbors weighted by their
+	// share of the density. The corrections are free again, so they hold
+	// the new velocities until all are done.
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = predicted_positions_[i];
+			glm::vec3 v = velocities_[i];
+			glm::vec3 dv(0.f);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(predicted_positions_[j]);
+				float d2 = glm::dot(r, r);
+				if (d2 < HSQ) {
+					dv += MASS*MullerKernels::Density(d2)/rest_density_ * (glm::vec3(velocities_[j]) - v);
+				}
+			});
+			corrections_[i] = v + viscosity_*dv;
+		}
+	}, kParticleGrain);
+	velocities_ = corrections_;
+}
+
+}  // namespace GLOO
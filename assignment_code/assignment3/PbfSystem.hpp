@@ -0,0 +1,96 @@
+#ifndef PBF_SYSTEM_H_
+#define PBF_SYSTEM_H_
+
+#include <algorithm>
+
+#include "ParticleState.hpp"
+#include "ParticleSystemBase.hpp"
+#include "NeighborGrid.hpp"
+#include "NeighborList.hpp"
+#include "WaterSystem.hpp"
+#include "BoxWalls.hpp"
+
+namespace GLOO {
+
+// Position based fluids (Macklin and Müller 2013). Every step moves the
+// particles with gravity, then projects the predicted positions onto the
+// density constraints with a fixed number of Jacobi iterations and derives
+// the velocities from the displacement. It stays stable at frame-sized
+// steps; fewer iterations make the fluid more compressible, not unstable.
+class PbfSystem : public ParticleSystemBase {
+ public:
+	PbfSystem();
+	virtual ~PbfSystem() {
+	}
+
+	// The displacement and velocity change of a step of SetTimeStep, or the
+	// dt of the last Advance, divided by that step
+	ParticleState ComputeTimeDerivative(const ParticleState& state,
+																			float time) override;
+	void ComputeTimeDerivative(const ParticleState& state,
+														 float time,
+														 ParticleState& derivative) override;
+	bool Advance(ParticleState& state, float time, float dt) override;
+
+	void OnParticlesPermuted(const std::vector<int>& order) override;
+
+	float GetSmoothingLength() const override { return H; }
+	float GetMaxAcceleration() const override { return max_acceleration_; }
+	int GetSolverIterations() const override { return iterations_; }
+
+	void AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity);
+
+	void SetTimeStep(float dt) { time_step_ = dt; }
+	void SetRestDensity(float rest_density);
+	// The quality knob: each iteration costs about one density pass
+	void SetIterations(int iterations) { iterations_ = std::max(1, iterations); }
+	// XSPH viscosity, the fraction of the relative velocity to the
+	// neighbors removed every step
+	void SetViscosity(float viscosity) { viscosity_ = viscosity; }
+	// The average relative density error the last iteration corrected
+	float GetDensityError() const { return density_error_; }
+
+ private:
+	// Fills predicted_positions_ and velocities_ for a step of dt
+	void Solve(const ParticleState& state, float dt);
+	// Computes lambdas_ for the predicted positions and returns the average
+	// density error
+	float ComputeLambdas();
+	// Moves the predicted positions along the constraint gradients
+	void ApplyCorrections();
+	void ApplyViscosity();
+	// The repulsion between close pairs of the paper, as a density error
+	// of tensile_strength_ at a distance of tensile_distance_ * H
+	float TensileCorrection(float d2) const;
+
+	NeighborGrid grid_;
+	// The predicted positions move during the iterations
+	float grid_cell_size_ = 0.25f;
+	float skin_ = 0.08f;
+	NeighborList neighbors_;
+	BoxWalls walls_;
+
+	Vec3Array predicted_positions_;
+	Vec3Array corrections_;
+	Vec3Array velocities_;
+	std::vector<float> lambdas_;
+	// 1/sum of the squared constraint gradients, times rest density^2
+	std::vector<float> factors_;
+
+	// Same as PciSphSystem, REST_DENS is only the zero of the equation of
+	// state of WaterSystem
+	float rest_density_ = 30.f;
+	float time_step_ = 1.f / 60.f;
+	int iterations_ = 4;
+	float viscosity_ = 0.01f;
+	float tensile_strength_ = 0.1f;
+	float tensile_distance_ = 0.2f;
+	// Keeps the particles this far inside the box
+	float wall_margin_ = 0.001f;
+
+	float density_error_ = 0.f;
+	float max_acceleration_ = 0.f;
+};
+}  // namespace GLOO
+
+#endif
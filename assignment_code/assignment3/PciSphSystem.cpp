@@ -0,0 +1,280 @@
+#include "PciSphSystem.hpp"
+#include "ThreadPool.hpp"
+#include "SimulationBox.hpp"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+
+namespace GLOO {
+
+PciSphSystem::PciSphSystem() {
+	grid_ = NeighborGrid(BOX_MIN, BOX_SIZE, grid_cell_size_);
+	walls_.SetRestDensity(rest_density_);
+	ComputePrototypeStiffness();
+}
+
+void PciSphSystem::ComputePrototypeStiffness() {
+	// Find the lattice spacing at which a particle has the rest density,
+	// density falls as the spacing grows
+	int extent = 4;
+	auto lattice_density = [&](float spacing) {
+		float rho = 0.f;
+		for (int x = -extent; x <= extent; x++) {
+			for (int y = -extent; y <= extent; y++) {
+				for (int z = -extent; z <= extent; z++) {
+					float d2 = glm::dot(glm::vec3(x, y, z), glm::vec3(x, y, z)) * spacing * spacing;
+					if (d2 < HSQ) {
+						rho += MASS*MullerKernels::Density(d2);
+					}
+				}
+			}
+		}
+		return rho;
+	};
+	float lo = H / extent;
+	float hi = H;
+	for (int k = 0; k < 50; k++) {
+		float mid = (lo + hi) / 2.f;
+		if (lattice_density(mid) > rest_density_) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	float spacing = (lo + hi) / 2.f;
+
+	// The density responds to the POLY6 gradient, while the pressure
+	// accelerations follow the SPIKY one
+	glm::vec3 density_grad_sum(0.f);
+	glm::vec3 pressure_grad_sum(0.f);
+	float grad_dot_sum = 0.f;
+	for (int x = -extent; x <= extent; x++) {
+		for (int y = -extent; y <= extent; y++) {
+			for (int z = -extent; z <= extent; z++) {
+				glm::vec3 r = glm::vec3(x, y, z) * spacing;
+				float d = glm::length(r);
+				if (d > 0.f && d < H) {
+					glm::vec3 density_grad = MullerKernels::DensityGradient(d*d) * r;
+					glm::vec3 pressure_grad = MullerKernels::PressureGradient(d) * r/d;
+					density_grad_sum += density_grad;
+					pressure_grad_sum += pressure_grad;
+					grad_dot_sum += glm::dot(density_grad, pressure_grad);
+				}
+			}
+		}
+	}
+	prototype_stiffness_ = MASS*MASS * (glm::dot(density_grad_sum, pressure_grad_sum) + grad_dot_sum);
+}
+
+void PciSphSystem::SetRestDensity(float rest_density) {
+	rest_density_ = rest_density;
+	walls_.SetRestDensity(rest_density);
+	ComputePrototypeStiffness();
+}
+
+void PciSphSystem::SetIterationLimits(int min_iterations, int max_iterations) {
+	min_iterations_ = std::max(1, min_iterations);
+	max_iterations_ = std::max(min_iterations_, max_iterations);
+}
+
+ParticleState PciSphSystem::ComputeTimeDerivative(const ParticleState& state,
+																									float time) {
+	ParticleState derivative;
+	ComputeTimeDerivative(state, time, derivative);
+	return derivative;
+}
+
+void PciSphSystem::ComputeTimeDerivative(const ParticleState& state,
+																				 float time,
+																				 ParticleState& derivative) {
+	int n = state.positions.size();
+	UpdateNeighbors(state);
+	ComputeNonPressureAccelerations(state);
+
+	pressure_accelerations_.resize(n);
+	pressures_.assign(n, 0.f);
+	std::fill(pressure_accelerations_.x(), pressure_accelerations_.x() + n, 0.f);
+	std::fill(pressure_accelerations_.y(), pressure_accelerations_.y() + n, 0.f);
+	std::fill(pressure_accelerations_.z(), pressure_accelerations_.z() + n, 0.f);
+
+	// Correct the pressures until the predicted densities are close enough
+	// to the rest density
+	float inv_dt2 = 1.f / (time_step_*time_step_);
+	iterations_ = 0;
+	while (true) {
+		density_error_ = PredictDensityErrors(state, time_step_) / rest_density_;
+		if (iterations_ >= max_iterations_ ||
+				(iterations_ >= min_iterations_ && density_error_ < tolerance_)) {
+			break;
+		}
+		ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				// Negative pressures would pull the free surface together, but
+				// an overshoot may still lower the pressure again
+				pressures_[i] = std::max(0.f, pressures_[i] + inv_dt2 * deltas_[i] * density_errors_[i]);
+			}
+		}, kParticleGrain);
+		ComputePressureAccelerations();
+		iterations_++;
+	}
+
+	derivative.positions = state.velocities;
+	derivative.velocities.resize(n);
+	float max_acceleration_sq = 0.f;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 a = glm::vec3(non_pressure_accelerations_[i]) + glm::vec3(pressure_accelerations_[i]);
+			derivative.velocities[i] = a;
+			chunk_max = std::max(chunk_max, glm::dot(a, a));
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_acceleration_sq = std::max(max_acceleration_sq, chunk_max);
+	}, kParticleGrain);
+	max_acceleration_ = sqrt(max_acceleration_sq);
+}
+
+bool PciSphSystem::Advance(ParticleState& state, float time, float dt) {
+	time_step_ = dt;
+	ComputeTimeDerivative(state, time, derivative_);
+	// Symplectic Euler, which is what the densities were predicted with
+	ThreadPool::GetInstance().ParallelFor(0, state.positions.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 v = glm::vec3(state.velocities[i]) + dt*glm::vec3(derivative_.velocities[i]);
+			state.velocities[i] = v;
+			state.positions[i] = glm::vec3(state.positions[i]) + dt*v;
+		}
+	}, kParticleGrain);
+	return true;
+}
+
+void PciSphSystem::OnParticlesPermuted(const std::vector<int>& order) {
+	neighbors_.Invalidate();
+}
+
+void PciSphSystem::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
+	state.positions.push_back(position);
+	state.velocities.push_back(velocity);
+}
+
+void PciSphSystem::UpdateNeighbors(const ParticleState& state) {
+	if (neighbors_.NeedsRebuild(state.positions)) {
+		grid_.Build(state.positions);
+		neighbors_.Build(grid_, state.positions, H, skin_);
+	}
+}
+
+void PciSphSystem::ComputeNonPressureAccelerations(const ParticleState& state) {
+	int n = state.positions.size();
+	rhos_.resize(n);
+	deltas_.resize(n);
+	non_pressure_accelerations_.resize(n);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			float rho = 0.f;
+			glm::vec3 p = state.positions[i];
+			// Same sums as for the prototype, plus the walls, which push on
+			// the particle with its own pressure
+			glm::vec3 density_grad_sum = walls_.DensityGradient(p);
+			glm::vec3 pressure_grad_sum = walls_.PressureGradient(p);
+			float grad_dot_sum = 0.f;
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(state.positions[j]);
+				float d2 = glm::dot(r, r);
+				if (d2 < HSQ) {
+					rho += MASS*MullerKernels::Density(d2);
+					float d = sqrt(d2);
+					if (d > 0.f) {
+						glm::vec3 density_grad = MASS*MullerKernels::DensityGradient(d2) * r;
+						glm::vec3 pressure_grad = MASS*MullerKernels::PressureGradient(d) * r/d;
+						density_grad_sum += density_grad;
+						pressure_grad_sum += pressure_grad;
+						grad_dot_sum += glm::dot(density_grad, pressure_grad);
+					}
+				}
+			});
+			rhos_[i] = rho;
+			// Sparse neighborhoods barely respond to pressure, so they get the
+			// correction of a full one instead of a huge one
+			float stiffness = glm::dot(density_grad_sum, pressure_grad_sum) + grad_dot_sum;
+			deltas_[i] = relaxation_ * rest_density_*rest_density_ /
+									 (2.f*std::max(stiffness, prototype_stiffness_));
+		}
+	}, kParticleGrain);
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = state.positions[i];
+			glm::vec3 v = state.velocities[i];
+			glm::vec3 visc(0.f);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				float d = glm::length(glm::vec3(state.positions[j]) - p);
+				if (i != j && d < H) {
+					visc += VISC*MASS*(glm::vec3(state.velocities[j]) - v)/rhos_[j] * MullerKernels::ViscosityLaplacian(d);
+				}
+			});
+			non_pressure_accelerations_[i] = GRAVITY + visc/rhos_[i];
+		}
+	}, kParticleGrain);
+}
+
+float PciSphSystem::PredictDensityErrors(const ParticleState& state, float dt) {
+	int n = state.positions.size();
+	predicted_positions_.resize(n);
+	density_errors_.resize(n);
+	ThreadPool& pool = ThreadPool::GetInstance();
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 a = glm::vec3(non_pressure_accelerations_[i]) + glm::vec3(pressure_accelerations_[i]);
+			glm::vec3 v = glm::vec3(state.velocities[i]) + dt*a;
+			predicted_positions_[i] = glm::vec3(state.positions[i]) + dt*v;
+		}
+	}, kParticleGrain);
+
+	float max_error = 0.f;
+	std::mutex max_mutex;
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = predicted_positions_[i];
+			float rho = walls_.Density(p);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 d = glm::vec3(predicted_positions_[j]) - p;
+				float d2 = glm::dot(d, d);
+				if (d2 < HSQ) {
+					rho += MASS*MullerKernels::Density(d2);
+				}
+			});
+			float error = rho - rest_density_;
+			density_errors_[i] = error;
+			chunk_max = std::max(chunk_max, error);
+		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_error = std::max(max_error, chunk_max);
+	}, kParticleGrain);
+	return max_error;
+}
+
+void PciSphSystem::ComputePressureAccelerations() {
+	int n = predicted_positions_.size();
+	float scale = -MASS / (rest_density_*rest_density_);
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3 p = predicted_positions_[i];
+			glm::vec3 a(0.f);
+			neighbors_.ForEachNeighbor(i, [&](int j) {
+				glm::vec3 r = p - glm::vec3(predicted_positions_[j]);
+				float d = glm::length(r);
+				if (i != j && d > 0.f && d < H) {
+					a += (pressures_[i] + pressures_[j]) * MullerKernels::PressureGradient(d) * r/d;
+				}
+			});
+			// The walls push back with the pressure of the particle itself
+			a += 2.f/MASS * pressures_[i] * walls_.PressureGradient(p);
+			pressure_accelerations_[i] = scale * a;
+		}
+	}, kParticleGrain);
+}
+
+}  // namespace GLOO
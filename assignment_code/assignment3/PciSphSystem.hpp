@@ -0,0 +1,109 @@
+#ifndef PCISPH_SYSTEM_H_
+#define PCISPH_SYSTEM_H_
+
+#include "ParticleState.hpp"
+#include "ParticleSystemBase.hpp"
+#include "NeighborGrid.hpp"
+#include "NeighborList.hpp"
+#include "WaterSystem.hpp"
+#include "BoxWalls.hpp"
+
+namespace GLOO {
+
+// Predictive-corrective incompressible SPH (Solenthaler and Pajarola 2009).
+// Uses the same fluid and kernels as WaterSystem, but instead of an
+// equation of state the pressures are corrected iteratively until the
+// densities predicted for the end of the step are within a tolerance of the
+// rest density. That keeps the fluid within about 1% of its rest density,
+// where the soft equation of state of WaterSystem compresses it severalfold.
+class PciSphSystem : public ParticleSystemBase {
+ public:
+	PciSphSystem();
+	virtual ~PciSphSystem() {
+	}
+
+	// The accelerations with the pressures solved for the step set by
+	// SetTimeStep, or the dt of the last Advance.
+	ParticleState ComputeTimeDerivative(const ParticleState& state,
+																			float time) override;
+	void ComputeTimeDerivative(const ParticleState& state,
+														 float time,
+														 ParticleState& derivative) override;
+	// Solves the pressures for dt and takes a symplectic Euler step
+	bool Advance(ParticleState& state, float time, float dt) override;
+
+	void OnParticlesPermuted(const std::vector<int>& order) override;
+
+	float GetSmoothingLength() const override { return H; }
+	float GetKinematicViscosity() const override { return VISC/rest_density_; }
+	float GetMaxAcceleration() const override { return max_acceleration_; }
+	int GetSolverIterations() const override { return iterations_; }
+
+	void AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity);
+
+	void SetTimeStep(float dt) { time_step_ = dt; }
+	void SetRestDensity(float rest_density);
+	// The correction loop stops once the largest density error is below
+	// tolerance * rest density, after at least min and at most max iterations.
+	void SetTolerance(float tolerance) { tolerance_ = tolerance; }
+	void SetIterationLimits(int min_iterations, int max_iterations);
+	// The largest relative density error left after the last solve
+	float GetDensityError() const { return density_error_; }
+
+ private:
+	void UpdateNeighbors(const ParticleState& state);
+	// Densities at the current positions, and gravity plus viscosity
+	void ComputeNonPressureAccelerations(const ParticleState& state);
+	// Moves the particles by dt with the current accelerations and returns
+	// the largest density error there, storing each particle's error.
+	float PredictDensityErrors(const ParticleState& state, float dt);
+	// Pressure accelerations at the predicted positions
+	void ComputePressureAccelerations();
+
+	// Fills the neighborhood of a particle in a lattice at rest density and
+	// computes how strongly its density responds to its own pressure.
+	void ComputePrototypeStiffness();
+
+	NeighborGrid grid_;
+	// Predicted positions may drift from the positions the lists were built
+	// for, so use a larger skin than WaterSystem
+	float grid_cell_size_ = 0.25f;
+	float skin_ = 0.08f;
+	NeighborList neighbors_;
+	BoxWalls walls_;
+
+	std::vector<float> rhos_;
+	std::vector<float> pressures_;
+	std::vector<float> density_errors_;
+	Vec3Array non_pressure_accelerations_;
+	Vec3Array pressure_accelerations_;
+	Vec3Array predicted_positions_;
+	ParticleState derivative_;
+
+	// REST_DENS is only the zero of the equation of state of WaterSystem,
+	// whose fluid settles at two to three times that. PCISPH holds the
+	// fluid at its rest density, so it uses what WaterSystem settles at.
+	float rest_density_ = 30.f;
+	// The density change per pressure of a particle is this stiffness times
+	// 2 dt^2/rest density^2. The paper takes delta from the prototype for
+	// every particle, which overshoots at the walls and in disordered
+	// regions, so each particle uses its own neighborhood, but never less
+	// than the prototype.
+	float prototype_stiffness_ = 0.f;
+	// The pressure update is a Jacobi iteration, which only damps errors
+	// that alternate between neighbors when relaxed below 1
+	float relaxation_ = 0.5f;
+	// Pressure change per unit density error, for a step of 1
+	std::vector<float> deltas_;
+	float time_step_ = 0.005f;
+	float tolerance_ = 0.01f;
+	int min_iterations_ = 3;
+	int max_iterations_ = 50;
+
+	int iterations_ = 0;
+	float density_error_ = 0.f;
+	float max_acceleration_ = 0.f;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PLANE_BOUNDARY_H_
+#define PLANE_BOUNDARY_H_
+
+#include <vector>
+
+#include "BoundaryBase.hpp"
+
+namespace GLOO {
+// Keeps the particles on the front side of a set of planes, e.g. a tilted
+// floor or the faces of a convex container.
+class PlaneBoundary : public BoundaryBase {
+ public:
+  explicit PlaneBoundary(float restitution = 0.3f) : restitution_(restitution) {
+  }
+
+  // Adds the plane through point whose front side normal points to
+  void AddPlane(glm::vec3 normal, glm::vec3 point) {
+    normal = glm::normalize(normal);
+    planes_.push_back({normal, glm::dot(normal, point)});
+  }
+  size_t GetNumPlanes() const {
+    return planes_.size();
+  }
+
+  void Apply(ParticleState& state, size_t begin, size_t end) const override {
+    for (const Plane& plane : planes_) {
+      ApplyPlane(plane, end - begin,
+                 state.positions.x() + begin, state.positions.y() + begin,
+                 state.positions.z() + begin, state.velocities.x() + begin,
+                 state.velocities.y() + begin, state.velocities.z() + begin);
+    }
+  }
+
+ private:
+  // The points x with dot(normal, x) >= offset are inside
+  struct Plane {
+    glm::vec3 normal;
+    float offset;
+  };
+
+  // Computes the depth and normal velocity of every particle and masks
+  // them, so the loop has no branches and vectorizes.
+  void ApplyPlane(const Plane& plane, size_t n,
+                  float* __restrict px, float* __restrict py, float* __restrict pz,
+                  float* __restrict vx, float* __restrict vy, float* __restrict vz) const {
+    float nx = plane.normal.x;
+    float ny = plane.normal.y;
+    float nz = plane.normal.z;
+    float eps = eps_;
+    float offset = plane.offset + eps;
+    // Removes the normal velocity and adds back -restitution of it
+    float reflect = -(1.f + restitution_);
+    for (size_t i = 0; i < n; i++) {
+      float depth = offset - (nx * px[i] + ny * py[i] + nz * pz[i]);
+      float vdotn = nx * vx[i] + ny * vy[i] + nz * vz[i];
+      float mask = depth > eps ? 1.f : 0.f;
+      float push = depth * mask;
+      // Particles already moving out of the wall keep their velocity
+      float vn = vdotn * reflect * (depth > eps && vdotn < 0.f ? 1.f : 0.f);
+      px[i] += push * nx;
+      py[i] += push * ny;
+      pz[i] += push * nz;
+      vx[i] += vn * nx;
+      vy[i] += vn * ny;
+      vz[i] += vn * nz;
+    }
+  }
+
+  std::vector<Plane> planes_;
+  float restitution_;
+  float eps_ = 0.001f;
+};
+}  // namespace GLOO
+
+#endif
@@ -6,39 +6,31 @@
 namespace GLOO {
 template <class TSystem, class TState>
 class RK4Integrator : public IntegratorBase<TSystem, TState> {
-	float box_width_ = 2.f; //TODO: This is also hardcoded into ParticleSystemNode
-	float box_height_ = 2.f;
-	float bound_damping_ = -0.3f;
-	float eps = 0.001f;
+  void Step(TSystem& system,
+            TState& state,
+            float start_time,
+            float dt) override {
+    system.ComputeTimeDerivative(state, start_time, k_1_);
+    stage_ = state + dt/2.f*k_1_;
+    system.ComputeTimeDerivative(stage_, start_time + dt/2.f, k_2_);
+    stage_ = state + dt/2.f*k_2_;
+    system.ComputeTimeDerivative(stage_, start_time + dt/2.f, k_3_);
+    stage_ = state + dt*k_3_;
+    system.ComputeTimeDerivative(stage_, start_time + dt, k_4_);
 
-  TState Integrate(TSystem& system,
-                   TState& state,
-                   float start_time,
-                   float dt) override {
-    TState k_1 = system.ComputeTimeDerivative(state, start_time);
-    TState k_2 = system.ComputeTimeDerivative(state + dt/2.*k_1, start_time + dt/2.);
-    TState k_3 = system.ComputeTimeDerivative(state + dt/2.*k_2, start_time + dt/2.);
-    TState k_4 = system.ComputeTimeDerivative(state + dt*k_3, start_time + dt);
+    // A single pass over all four stages
+    state += (dt/6.f) * (k_1_ + 2.f*k_2_ + 2.f*k_3_ + k_4_);
 
 		// Check the boundary conditions (ie where the box is)
-		TState new_state = state + (dt/6.) * (k_1 + 2*k_2 + 2*k_3 + k_4);
-		for (int i = 0; i < new_state.positions.size(); i++) {
-			glm::vec3 p = new_state.positions[i];
-			if (p.x > box_width_/2. || p.x < -box_width_/2.) {
-				new_state.velocities[i].x *= bound_damping_;
-				new_state.positions[i].x = glm::clamp(new_state.positions[i].x, -box_width_/2.f+eps, box_width_/2.f-eps);
-			}
-			if (p.z > box_width_/2. || p.z < -box_width_/2.) {
-				new_state.velocities[i].z *= bound_damping_;
-				new_state.positions[i].z = glm::clamp(new_state.positions[i].z, -box_width_/2.f+eps, box_width_/2.f-eps);
-			}
-			if (p.y > box_height_/2. || p.y < -box_height_/2.) {
-				new_state.velocities[i].y *= bound_damping_;
-				new_state.positions[i].y = glm::clamp(new_state.positions[i].y, -box_height_/2.f+eps, box_height_/2.f-eps);
-			}
-		}
-    return new_state;
+		this->ApplyBoundary(state);
   }
+
+  TState k_1_;
+  TState k_2_;
+  TState k_3_;
+  TState k_4_;
+  // The state each of k_2_..k_4_ is evaluated at
+  TState stage_;
 };
 }  // namespace GLOO
 
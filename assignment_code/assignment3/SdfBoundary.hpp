@@ -0,0 +1,59 @@
+#ifndef SDF_BOUNDARY_H_
+#define SDF_BOUNDARY_H_
+
+#include <memory>
+
+#include "BoundaryBase.hpp"
+#include "SignedDistanceField.hpp"
+
+namespace GLOO {
+// Keeps the particles at least thickness outside of a solid described by a
+// signed distance field. Each particle costs one trilinear lookup, plus a
+// gradient lookup when it is too close.
+class SdfBoundary : public BoundaryBase {
+ public:
+  SdfBoundary(std::shared_ptr<const SignedDistanceField> sdf,
+              float thickness = 0.02f,
+              float restitution = 0.3f)
+      : sdf_(sdf), thickness_(thickness), restitution_(restitution) {
+  }
+
+  void Apply(ParticleState& state, size_t begin, size_t end) const override {
+    if (sdf_->IsEmpty()) {
+      return;
+    }
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 p = state.positions[i];
+      if (!sdf_->Contains(p)) {
+        // Far away from the surface
+        continue;
+      }
+      float d = sdf_->Sample(p);
+      if (d >= thickness_) {
+        continue;
+      }
+      glm::vec3 g = sdf_->SampleGradient(p);
+      float length = glm::length(g);
+      if (length == 0.f) {
+        // Exactly on a ridge between equally close surfaces, which the
+        // particle leaves with its next move
+        continue;
+      }
+      glm::vec3 n = g / length;
+      state.positions[i] = p + (thickness_ - d) * n;
+      glm::vec3 v = state.velocities[i];
+      float vn = glm::dot(v, n);
+      if (vn < 0.f) {
+        state.velocities[i] = v - (1.f + restitution_) * vn * n;
+      }
+    }
+  }
+
+ private:
+  std::shared_ptr<const SignedDistanceField> sdf_;
+  float thickness_;
+  float restitution_;
+};
+}  // namespace GLOO
+
+#endif
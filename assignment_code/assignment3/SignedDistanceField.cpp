@@ -0,0 +1,317 @@
+#include "SignedDistanceField.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "ThreadPool.hpp"
+#include "TriangleGeometry.hpp"
+
+namespace GLOO {
+
+namespace {
+const char kFileMagic[4] = {'S', 'D', 'F', '2'};
+
+struct Triangle {
+  glm::vec3 a;
+  glm::vec3 b;
+  glm::vec3 c;
+  glm::vec3 lo;
+  glm::vec3 hi;
+};
+
+// FNV-1a over the raw bytes of the baking input
+void HashBytes(uint64_t& hash, const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+}
+
+uint64_t HashInput(const PositionArray& positions, const IndexArray& indices,
+                   float cell_size, int band_cells) {
+  uint64_t hash = 14695981039346656037ull;
+  HashBytes(hash, kFileMagic, sizeof(kFileMagic));
+  if (!positions.empty()) {
+    HashBytes(hash, &positions[0], positions.size() * sizeof(glm::vec3));
+  }
+  if (!indices.empty()) {
+    HashBytes(hash, &indices[0], indices.size() * sizeof(unsigned int));
+  }
+  HashBytes(hash, &cell_size, sizeof(cell_size));
+  HashBytes(hash, &band_cells, sizeof(band_cells));
+  return hash;
+}
+}
+
+SignedDistanceField SignedDistanceField::Bake(const PositionArray& positions,
+                                              const IndexArray& indices,
+                                              float cell_size,
+                                              int band_cells) {
+  std::vector<Triangle> triangles;
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(-std::numeric_limits<float>::max());
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    Triangle tri;
+    tri.a = positions[indices[t]];
+    tri.b = positions[indices[t+1]];
+    tri.c = positions[indices[t+2]];
+    if (glm::length(glm::cross(tri.b - tri.a, tri.c - tri.a)) == 0.f) {
+      continue;
+    }
+    tri.lo = glm::min(tri.a, glm::min(tri.b, tri.c));
+    tri.hi = glm::max(tri.a, glm::max(tri.b, tri.c));
+    lo = glm::min(lo, tri.lo);
+    hi = glm::max(hi, tri.hi);
+    triangles.push_back(tri);
+  }
+
+  SignedDistanceField sdf;
+  sdf.key_ = HashInput(positions, indices, cell_size, band_cells);
+  if (triangles.empty()) {
+    return sdf;
+  }
+
+  // Leave a full band plus a cell of outside space around the mesh
+  float band = band_cells * cell_size;
+  sdf.cell_size_ = cell_size;
+  sdf.origin_ = lo - glm::vec3(band + cell_size);
+  glm::vec3 extent = hi + glm::vec3(band + cell_size) - sdf.origin_;
+  sdf.resolution_ = glm::ivec3(glm::ceil(extent / cell_size)) + 1;
+  glm::ivec3 res = sdf.resolution_;
+  sdf.values_.assign((size_t)res.x * res.y * res.z, std::numeric_limits<float>::max());
+  // The triangle each node is closest to, -1 until one is known
+  std::vector<int> closest(sdf.values_.size(), -1);
+
+  // Offers triangle t to the node at n, keeping it if it is closer
+  auto offer = [&](glm::ivec3 n, int t) {
+    const Triangle& tri = triangles[t];
+    glm::vec3 p = sdf.origin_ + glm::vec3(n) * cell_size;
+    float d = glm::length(p - ClosestPointOnTriangle(p, tri.a, tri.b, tri.c));
+    int i = sdf.GetNodeIndex(n.x, n.y, n.z);
+    if (d < sdf.values_[i]) {
+      sdf.values_[i] = d;
+      closest[i] = t;
+    }
+  };
+
+  ThreadPool& pool = ThreadPool::GetInstance();
+
+  // Exact unsigned distances within the band. Each chunk owns a slab of x so
+  // that no two threads write the same node.
+  pool.ParallelFor(0, res.x, [&](int x_begin, int x_end) {
+    for (int t = 0; t < (int)triangles.size(); t++) {
+      const Triangle& tri = triangles[t];
+      glm::ivec3 n_lo = glm::ivec3(glm::ceil((tri.lo - band - sdf.origin_) / cell_size));
+      glm::ivec3 n_hi = glm::ivec3(glm::floor((tri.hi + band - sdf.origin_) / cell_size));
+      n_lo = glm::max(n_lo, glm::ivec3(x_begin, 0, 0));
+      n_hi = glm::min(n_hi, glm::ivec3(x_end - 1, res.y - 1, res.z - 1));
+      for (int x = n_lo.x; x <= n_hi.x; x++) {
+        for (int y = n_lo.y; y <= n_hi.y; y++) {
+          for (int z = n_lo.z; z <= n_hi.z; z++) {
+            offer(glm::ivec3(x, y, z), t);
+          }
+        }
+      }
+    }
+  });
+
+  // Beyond the band, every node tries the closest triangles of its
+  // neighbors, sweeping each axis both ways. Deep inside nodes get their
+  // distance to the surface, so the gradient still points out of the mesh.
+  // Each chunk owns whole lines along the swept axis.
+  for (int round = 0; round < 2; round++) {
+    for (int axis = 0; axis < 3; axis++) {
+      int u = (axis + 1) % 3;
+      int v = (axis + 2) % 3;
+      pool.ParallelFor(0, res[u] * res[v], [&](int line_begin, int line_end) {
+        for (int line = line_begin; line < line_end; line++) {
+          glm::ivec3 n;
+          n[u] = line / res[v];
+          n[v] = line % res[v];
+          for (int step : {1, -1}) {
+            for (int k = step > 0 ? 1 : res[axis] - 2; k >= 0 && k < res[axis]; k += step) {
+              n[axis] = k - step;
+              int t = closest[sdf.GetNodeIndex(n.x, n.y, n.z)];
+              n[axis] = k;
+              if (t >= 0 && t != closest[sdf.GetNodeIndex(n.x, n.y, n.z)]) {
+                offer(n, t);
+              }
+            }
+          }
+        }
+      });
+    }
+  }
+
+  // Signs, from the number of surface crossings of a ray along +x through
+  // each column of nodes. The ray is nudged off the node so that it doesn't
+  // pass exactly through shared edges and vertices.
+  glm::vec2 nudge = glm::vec2(0.7071f, 0.3183f) * (1e-3f * cell_size);
+  pool.ParallelFor(0, res.y, [&](int y_begin, int y_end) {
+    std::vector<const Triangle*> row;
+    std::vector<float> crossings;
+    for (int y = y_begin; y < y_end; y++) {
+      float ray_y = sdf.origin_.y + y * cell_size + nudge.x;
+      row.clear();
+      for (const Triangle& tri : triangles) {
+        if (tri.lo.y <= ray_y && ray_y <= tri.hi.y) {
+          row.push_back(&tri);
+        }
+      }
+      for (int z = 0; z < res.z; z++) {
+        float ray_z = sdf.origin_.z + z * cell_size + nudge.y;
+        crossings.clear();
+        for (const Triangle* tri : row) {
+          if (ray_z < tri->lo.z || ray_z > tri->hi.z) {
+            continue;
+          }
+          // Barycentric coordinates of the ray in the yz projection
+          glm::vec2 a(tri->a.y, tri->a.z);
+          glm::vec2 b(tri->b.y, tri->b.z);
+          glm::vec2 c(tri->c.y, tri->c.z);
+          glm::vec2 q(ray_y, ray_z);
+          float area = (b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x);
+          if (area == 0.f) {
+            continue;
+          }
+          float u = ((b.x - q.x)*(c.y - q.y) - (b.y - q.y)*(c.x - q.x)) / area;
+          float v = ((c.x - q.x)*(a.y - q.y) - (c.y - q.y)*(a.x - q.x)) / area;
+          float w = 1.f - u - v;
+          if (u < 0.f || v < 0.f || w < 0.f) {
+            continue;
+          }
+          crossings.push_back(u*tri->a.x + v*tri->b.x + w*tri->c.x);
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        size_t passed = 0;
+        for (int x = 0; x < res.x; x++) {
+          float node_x = sdf.origin_.x + x * cell_size;
+          while (passed < crossings.size() && crossings[passed] < node_x) {
+            passed++;
+          }
+          if (passed % 2 == 1) {
+            float& value = sdf.values_[sdf.GetNodeIndex(x, y, z)];
+            value = -value;
+          }
+        }
+      }
+    }
+  });
+  return sdf;
+}
+
+SignedDistanceField SignedDistanceField::LoadOrBake(const PositionArray& positions,
+                                                    const IndexArray& indices,
+                                                    float cell_size,
+                                                    const std::string& cache_path,
+                                                    int band_cells) {
+  SignedDistanceField sdf;
+  if (sdf.Load(cache_path, HashInput(positions, indices, cell_size, band_cells))) {
+    return sdf;
+  }
+  sdf = Bake(positions, indices, cell_size, band_cells);
+  if (!sdf.Save(cache_path)) {
+    std::cerr << "Could not write the SDF cache " << cache_path << std::endl;
+  }
+  return sdf;
+}
+
+bool SignedDistanceField::Save(const std::string& path) const {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+  out.write(kFileMagic, sizeof(kFileMagic));
+  out.write(reinterpret_cast<const char*>(&key_), sizeof(key_));
+  out.write(reinterpret_cast<const char*>(&resolution_), sizeof(resolution_));
+  out.write(reinterpret_cast<const char*>(&origin_), sizeof(origin_));
+  out.write(reinterpret_cast<const char*>(&cell_size_), sizeof(cell_size_));
+  if (!values_.empty()) {
+    out.write(reinterpret_cast<const char*>(&values_[0]), values_.size() * sizeof(float));
+  }
+  return (bool)out;
+}
+
+bool SignedDistanceField::Load(const std::string& path, uint64_t key) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  char magic[sizeof(kFileMagic)];
+  uint64_t file_key;
+  glm::ivec3 resolution;
+  glm::vec3 origin;
+  float cell_size;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&file_key), sizeof(file_key));
+  in.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+  in.read(reinterpret_cast<char*>(&origin), sizeof(origin));
+  in.read(reinterpret_cast<char*>(&cell_size), sizeof(cell_size));
+  if (!in || std::memcmp(magic, kFileMagic, sizeof(magic)) != 0 ||
+      file_key != key || glm::any(glm::lessThan(resolution, glm::ivec3(0)))) {
+    return false;
+  }
+
+  std::vector<float> values((size_t)resolution.x * resolution.y * resolution.z);
+  if (!values.empty()) {
+    in.read(reinterpret_cast<char*>(&values[0]), values.size() * sizeof(float));
+  }
+  if (!in) {
+    return false;
+  }
+  key_ = file_key;
+  resolution_ = resolution;
+  origin_ = origin;
+  cell_size_ = cell_size;
+  values_.swap(values);
+  return true;
+}
+
+void SignedDistanceField::Locate(glm::vec3 p, glm::ivec3& cell, glm::vec3& t) const {
+  glm::vec3 g = glm::clamp((p - origin_) / cell_size_, glm::vec3(0.f),
+                           glm::vec3(resolution_ - 1));
+  cell = glm::min(glm::ivec3(g), resolution_ - 2);
+  t = g - glm::vec3(cell);
+}
+
+float SignedDistanceField::Sample(glm::vec3 p) const {
+  glm::ivec3 c;
+  glm::vec3 t;
+  Locate(p, c, t);
+  float c00 = glm::mix(values_[GetNodeIndex(c.x, c.y, c.z)], values_[GetNodeIndex(c.x+1, c.y, c.z)], t.x);
+  float c10 = glm::mix(values_[GetNodeIndex(c.x, c.y+1, c.z)], values_[GetNodeIndex(c.x+1, c.y+1, c.z)], t.x);
+  float c01 = glm::mix(values_[GetNodeIndex(c.x, c.y, c.z+1)], values_[GetNodeIndex(c.x+1, c.y, c.z+1)], t.x);
+  float c11 = glm::mix(values_[GetNodeIndex(c.x, c.y+1, c.z+1)], values_[GetNodeIndex(c.x+1, c.y+1, c.z+1)], t.x);
+  return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+}
+
+glm::vec3 SignedDistanceField::SampleGradient(glm::vec3 p) const {
+  glm::ivec3 c;
+  glm::vec3 t;
+  Locate(p, c, t);
+  float v[2][2][2];
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      for (int k = 0; k < 2; k++) {
+        v[i][j][k] = values_[GetNodeIndex(c.x+i, c.y+j, c.z+k)];
+      }
+    }
+  }
+  // Derivatives of the trilinear interpolant along each axis
+  glm::vec3 g;
+  g.x = glm::mix(glm::mix(v[1][0][0] - v[0][0][0], v[1][1][0] - v[0][1][0], t.y),
+                 glm::mix(v[1][0][1] - v[0][0][1], v[1][1][1] - v[0][1][1], t.y), t.z);
+  g.y = glm::mix(glm::mix(v[0][1][0] - v[0][0][0], v[1][1][0] - v[1][0][0], t.x),
+                 glm::mix(v[0][1][1] - v[0][0][1], v[1][1][1] - v[1][0][1], t.x), t.z);
+  g.z = glm::mix(glm::mix(v[0][0][1] - v[0][0][0], v[1][0][1] - v[1][0][0], t.x),
+                 glm::mix(v[0][1][1] - v[0][1][0], v[1][1][1] - v[1][1][0], t.x), t.y);
+  return g / cell_size_;
+}
+
+}  // namespace GLOO
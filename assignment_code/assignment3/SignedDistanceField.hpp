@@ -0,0 +1,84 @@
+#ifndef SIGNED_DISTANCE_FIELD_H_
+#define SIGNED_DISTANCE_FIELD_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "gloo/alias_types.hpp"
+
+namespace GLOO {
+// Signed distances to a closed triangle mesh, sampled on the nodes of a
+// regular grid: negative inside the mesh, positive outside. A band of a
+// few cells around the surface holds exact distances, further nodes the
+// distance to a triangle that was closest to one of their neighbors.
+class SignedDistanceField {
+ public:
+  SignedDistanceField() {
+  }
+
+  // Voxelizes the mesh given by positions and indices (three per
+  // triangle). Distances are exact within band_cells cells of the surface
+  // and propagated from there by sweeps, signs come from the parity of ray
+  // crossings along x.
+  static SignedDistanceField Bake(const PositionArray& positions,
+                                  const IndexArray& indices,
+                                  float cell_size,
+                                  int band_cells = 4);
+
+  // Loads the field from cache_path if it was baked from the same mesh and
+  // settings, otherwise bakes it and writes it there.
+  static SignedDistanceField LoadOrBake(const PositionArray& positions,
+                                        const IndexArray& indices,
+                                        float cell_size,
+                                        const std::string& cache_path,
+                                        int band_cells = 4);
+
+  bool Save(const std::string& path) const;
+  // Returns false if the file is missing, corrupt, or was baked from
+  // different input than key.
+  bool Load(const std::string& path, uint64_t key);
+
+  // Hash of the mesh and settings the field was baked from
+  uint64_t GetKey() const {
+    return key_;
+  }
+  bool IsEmpty() const {
+    return values_.empty();
+  }
+  bool Contains(glm::vec3 p) const {
+    return glm::all(glm::greaterThanEqual(p, origin_)) &&
+           glm::all(glm::lessThanEqual(p, GetMax()));
+  }
+  glm::vec3 GetMin() const {
+    return origin_;
+  }
+  glm::vec3 GetMax() const {
+    return origin_ + glm::vec3(resolution_ - 1) * cell_size_;
+  }
+
+  // Trilinear interpolation of the distance, and its gradient. p is clamped
+  // into the grid.
+  float Sample(glm::vec3 p) const;
+  glm::vec3 SampleGradient(glm::vec3 p) const;
+
+ private:
+  int GetNodeIndex(int x, int y, int z) const {
+    return (x*resolution_.y + y)*resolution_.z + z;
+  }
+  // The cell containing p and the position of p inside of it
+  void Locate(glm::vec3 p, glm::ivec3& cell, glm::vec3& t) const;
+
+  glm::vec3 origin_ = glm::vec3(0.f);
+  float cell_size_ = 1.f;
+  // Number of nodes along each axis
+  glm::ivec3 resolution_ = glm::ivec3(0);
+  std::vector<float> values_;
+  // Hash of the input the field was baked from, to validate caches
+  uint64_t key_ = 0;
+};
+}  // namespace GLOO
+
+#endif
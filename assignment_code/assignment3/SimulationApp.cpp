@@ -1,9 +1,18 @@
 #include "SimulationApp.hpp"
 
+#include <iostream>
+#include <stdexcept>
+
 #include "RK4Integrator.hpp"
 #include "ParticleSystemNode.hpp"
 #include "WaterSystem.hpp"
+#include "PciSphSystem.hpp"
+#include "DfSphSystem.hpp"
+#include "PbfSystem.hpp"
+#include "FlipSystem.hpp"
 #include "IntegratorFactory.hpp"
+#include "SdfBoundary.hpp"
+#include "PlaneBoundary.hpp"
 
 #include "glm/gtx/string_cast.hpp"
 
@@ -14,6 +23,7 @@
 #include "gloo/components/LightComponent.hpp"
 #include "gloo/components/MaterialComponent.hpp"
 #include "gloo/MeshLoader.hpp"
+#include "gloo/parsers/ObjParser.hpp"
 #include "gloo/lights/PointLight.hpp"
 #include "gloo/lights/AmbientLight.hpp"
 #include "gloo/cameras/ArcBallCameraNode.hpp"
@@ -21,6 +31,29 @@
 
 
 namespace GLOO {
+namespace {
+// Parses an OBJ file and bakes it into a collider, caching the field next to
+// the OBJ as <file_path>.sdf
+std::shared_ptr<SignedDistanceField> LoadObstacle(const std::string& file_path,
+                                                  float cell_size) {
+  bool success;
+  ObjParser::ParsedData parsed = ObjParser::Parse(file_path, success);
+  if (!success || !parsed.positions) {
+    throw std::runtime_error("Failed to load the collision mesh " + file_path + ".");
+  }
+  IndexArray indices;
+  if (parsed.indices) {
+    indices = *parsed.indices;
+  } else {
+    for (size_t i = 0; i < parsed.positions->size(); i++) {
+      indices.push_back(i);
+    }
+  }
+  return std::make_shared<SignedDistanceField>(SignedDistanceField::LoadOrBake(
+      *parsed.positions, indices, cell_size, file_path + ".sdf"));
+}
+}  // namespace
+
 SimulationApp::SimulationApp(const std::string& app_name,
                              glm::ivec2 window_size,
                              IntegratorType integrator_type,
@@ -33,6 +66,60 @@ SimulationApp::SimulationApp(const std::string& app_name,
   // warnings.
 }
 
+void SimulationApp::UseAdaptiveTimeStep(float min_dt, float max_dt) {
+  adaptive_dt_ = true;
+  min_dt_ = min_dt;
+  max_dt_ = max_dt;
+}
+
+void SimulationApp::AddObstacle(const std::string& obj_filename) {
+  obstacles_.push_back(obj_filename);
+}
+
+void SimulationApp::SetSolverType(SolverType solver_type) {
+  solver_type_ = solver_type;
+}
+
+void SimulationApp::SetPbfIterations(int iterations) {
+  pbf_iterations_ = iterations;
+}
+
+void SimulationApp::SetFlipRatio(float flip_ratio) {
+  flip_ratio_ = flip_ratio;
+}
+
+void SimulationApp::UseOpenDomain() {
+  open_domain_ = true;
+}
+
+void SimulationApp::UseIncrementalRebinning(float rebuild_fraction) {
+  rebuild_fraction_ = rebuild_fraction;
+}
+
+void SimulationApp::UseSfcPartitioning(int interval) {
+  sfc_interval_ = interval;
+}
+
+void SimulationApp::UseSimdKernels() {
+  simd_kernels_ = true;
+}
+
+void SimulationApp::UseSymmetricPairs() {
+  symmetric_pairs_ = true;
+}
+
+void SimulationApp::SetKernelType(KernelType kernel_type) {
+  kernel_type_ = kernel_type;
+}
+
+void SimulationApp::LogSolverIterations() {
+  log_iterations_ = true;
+}
+
+void SimulationApp::SetReorderInterval(int steps) {
+  reorder_interval_ = steps;
+}
+
 int IndexOf(int x, int y, int particle_x) {
   return x + y * particle_x;
 }
@@ -59,9 +146,95 @@ void SimulationApp::SetupScene() {
   point_light_node->GetTransform().SetPosition(glm::vec3(0.0f, 0.0f, 3.0f));
   root.AddChild(std::move(point_light_node));
 
+  if (open_domain_ && solver_type_ != SolverType::WCSPH) {
+    std::cout << "Open domain needs the WCSPH solver, keeping the box"
+              << std::endl;
+  }
+  if (solver_type_ == SolverType::PCISPH) {
+    std::cout << "Pressure solver: PCISPH" << std::endl;
+    AddParticleNode(root, PciSphSystem(), IntegratorType::SolverStep);
+    return;
+  }
+  if (solver_type_ == SolverType::DFSPH) {
+    std::cout << "Pressure solver: DFSPH" << std::endl;
+    AddParticleNode(root, DfSphSystem(), IntegratorType::SolverStep);
+    return;
+  }
+  if (solver_type_ == SolverType::PBF) {
+    std::cout << "Pressure solver: PBF, " << pbf_iterations_ << " iterations"
+              << std::endl;
+    PbfSystem base;
+    base.SetIterations(pbf_iterations_);
+    AddParticleNode(root, base, IntegratorType::SolverStep);
+    return;
+  }
+  if (solver_type_ == SolverType::FLIP) {
+    std::cout << "Pressure solver: FLIP, ratio " << flip_ratio_ << std::endl;
+    FlipSystem base;
+    base.SetFlipRatio(flip_ratio_);
+    AddParticleNode(root, base, IntegratorType::SolverStep);
+    return;
+  }
+
+  if (kernel_type_ == KernelType::CubicSpline) {
+    std::cout << "Smoothing kernels: cubic spline" << std::endl;
+    AddWaterSystemNode<CubicSplineKernels>(root);
+  } else if (kernel_type_ == KernelType::Wendland) {
+    std::cout << "Smoothing kernels: Wendland C2" << std::endl;
+    AddWaterSystemNode<WendlandKernels>(root);
+  } else {
+    AddWaterSystemNode<MullerKernels>(root);
+  }
+}
+
+template <class TKernels>
+void SimulationApp::AddWaterSystemNode(SceneNode& root) {
+  BasicWaterSystem<TKernels> base;
+  if (simd_kernels_ && symmetric_pairs_) {
+    std::cout << "Symmetric pairs have no vectorized version, keeping the"
+              << " scalar kernels" << std::endl;
+  } else if (simd_kernels_) {
+    base.SetSimdLevel(DetectSimdLevel());
+    std::cout << "SPH kernels: " << GetSimdLevelName(base.GetSimdLevel())
+              << std::endl;
+  }
+  if (symmetric_pairs_) {
+    base.UseSymmetricPairs(true);
+  }
+  // Also when the CPU or the kernels have no vectorized version
+  if (base.GetSimdLevel() == SimdLevel::Scalar) {
+    base.UseNeighborLists(true);
+  }
+  base.UseSpatialHash(open_domain_);
+  if (rebuild_fraction_ >= 0.f) {
+    base.UseIncrementalRebinning(true, rebuild_fraction_);
+  }
+  if (sfc_interval_ > 0 && symmetric_pairs_) {
+    std::cout << "Symmetric pairs run on a single thread, ignoring the SFC"
+              << " partitions" << std::endl;
+  } else if (sfc_interval_ > 0) {
+    base.UseSfcPartitioning(true, sfc_interval_);
+  }
+  AddParticleNode(root, base, integrator_type_);
+}
+
+template <class TSystem>
+void SimulationApp::AddParticleNode(SceneNode& root,
+                                    const TSystem& base,
+                                    IntegratorType integrator_type) {
 	auto integrator =
-   IntegratorFactory::CreateIntegrator<WaterSystem, ParticleState>(integrator_type_);
-  WaterSystem base;
+   IntegratorFactory::CreateIntegrator<TSystem, ParticleState>(integrator_type);
+  // The solvers that advance themselves model the box walls internally
+  if (open_domain_ && integrator_type != IntegratorType::SolverStep) {
+    auto floor = std::make_shared<PlaneBoundary>();
+    floor->AddPlane(glm::vec3(0.f, 1.f, 0.f), BOX_MIN);
+    integrator->SetBoundaries({floor});
+  }
+  for (const std::string& obstacle : obstacles_) {
+    // Cells of an eighth of the kernel radius
+    auto sdf = LoadObstacle(GetAssetDir() + obstacle, H / 8.f);
+    integrator->AddBoundary(std::make_shared<SdfBoundary>(sdf));
+  }
   ParticleState state;
 
   // int particle_number = 2000;
@@ -74,8 +247,13 @@ void SimulationApp::SetupScene() {
 	// }
 
   auto particle_node =
-             make_unique<ParticleSystemNode<WaterSystem>>
+             make_unique<ParticleSystemNode<TSystem>>
                         (std::move(integrator), base, state, integration_step_);
+  particle_node->SetReorderInterval(reorder_interval_);
+  particle_node->SetLogIterations(log_iterations_);
+  if (adaptive_dt_) {
+    particle_node->UseAdaptiveTimeStep(min_dt_, max_dt_);
+  }
   particle_node->GetTransform().SetPosition(glm::vec3(0.f, 0.f, 0.f));
   root.AddChild(std::move(particle_node));
 }
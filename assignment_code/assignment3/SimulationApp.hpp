@@ -1,9 +1,14 @@
 #ifndef SIMULATION_APP_H_
 #define SIMULATION_APP_H_
 
+#include <string>
+#include <vector>
+
 #include "gloo/Application.hpp"
 
 #include "IntegratorType.hpp"
+#include "SolverType.hpp"
+#include "KernelType.hpp"
 
 namespace GLOO {
 class SimulationApp : public Application {
@@ -14,9 +19,81 @@ class SimulationApp : public Application {
                 float integration_step);
   void SetupScene() override;
 
+  // Lets the simulation choose every step in [min_dt, max_dt] instead of
+  // always taking integration_step. Must be called before SetupScene.
+  void UseAdaptiveTimeStep(float min_dt, float max_dt);
+  // Adds a static obstacle from an OBJ file in the assets directory, given
+  // in simulation coordinates. Its distance field is cached next to it.
+  // Must be called before SetupScene.
+  void AddObstacle(const std::string& obj_filename);
+  // Selects the pressure solver. PCISPH, DFSPH, PBF and FLIP advance the
+  // particles themselves and ignore the integrator type. Must be called before SetupScene.
+  void SetSolverType(SolverType solver_type);
+  // Constraint iterations per step of the PBF solver, more give a stiffer
+  // fluid at a proportional cost. Must be called before SetupScene.
+  void SetPbfIterations(int iterations);
+  // Share of FLIP in the grid to particle transfer of the FLIP solver, the
+  // rest is PIC. Must be called before SetupScene.
+  void SetFlipRatio(float flip_ratio);
+  // Replaces the walls of the simulation box with its floor only, and bins
+  // the particles with a spatial hash so they can splash anywhere. Only the
+  // WCSPH solver supports it, the others keep their box. Must be called
+  // before SetupScene.
+  void UseOpenDomain();
+  // Lets the WCSPH solver rebin only the particles that changed grid cell,
+  // unless more than rebuild_fraction of them did. Must be called before
+  // SetupScene.
+  void UseIncrementalRebinning(float rebuild_fraction);
+  // Lets the WCSPH solver split the cells between the threads along a
+  // Morton curve, rebalanced every interval evaluations. Has no effect
+  // with symmetric pairs. Must be called before SetupScene.
+  void UseSfcPartitioning(int interval);
+  // Runs the WCSPH solver with the vectorized kernels the CPU supports
+  // instead of the scalar passes over neighbor lists. Only the Müller
+  // kernels are vectorized. Must be called before SetupScene.
+  void UseSimdKernels();
+  // Lets the WCSPH solver visit every interacting pair once instead of
+  // from both sides. The pair passes run on a single thread, so this only
+  // pays off with --threads=1, and it rules out the vectorized kernels.
+  // Must be called before SetupScene.
+  void UseSymmetricPairs();
+  // Selects the smoothing kernels of the WCSPH solver. Only the Müller
+  // kernels are vectorized. Must be called before SetupScene.
+  void SetKernelType(KernelType kernel_type);
+  // Prints the iterations of PCISPH, DFSPH and PBF after every step. Must be
+  // called before SetupScene.
+  void LogSolverIterations();
+  // Sorts the particles along a Z-order curve every steps steps, 0 never
+  // does. Must be called before SetupScene.
+  void SetReorderInterval(int steps);
+
  private:
+  // Adds the node simulating a TSystem with the integrator and obstacles
+  template <class TSystem>
+  void AddParticleNode(SceneNode& root, const TSystem& base, IntegratorType integrator_type);
+  // Adds the node of the WCSPH solver with the kernels of TKernels
+  template <class TKernels>
+  void AddWaterSystemNode(SceneNode& root);
+
   IntegratorType integrator_type_;
   float integration_step_;
+  SolverType solver_type_ = SolverType::WCSPH;
+  int pbf_iterations_ = 4;
+  float flip_ratio_ = 0.95f;
+  bool open_domain_ = false;
+  // Negative while incremental rebinning is off
+  float rebuild_fraction_ = -1.f;
+  // 0 while Morton partitioning is off
+  int sfc_interval_ = 0;
+  bool simd_kernels_ = false;
+  bool symmetric_pairs_ = false;
+  KernelType kernel_type_ = KernelType::Muller;
+  bool log_iterations_ = false;
+  int reorder_interval_ = 100;
+  bool adaptive_dt_ = false;
+  float min_dt_;
+  float max_dt_;
+  std::vector<std::string> obstacles_;
 };
 }  // namespace GLOO
 
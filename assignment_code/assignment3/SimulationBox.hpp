@@ -0,0 +1,16 @@
+#ifndef SIMULATION_BOX_H_
+#define SIMULATION_BOX_H_
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+// The box the fluid is simulated in, centered on the origin. Shared by the
+// solver's grid, the default boundary and the renderer.
+const static float BOX_WIDTH = 2.f;
+const static float BOX_HEIGHT = 2.f;
+const static glm::vec3 BOX_SIZE = glm::vec3(BOX_WIDTH, BOX_HEIGHT, BOX_WIDTH);
+const static glm::vec3 BOX_MIN = -BOX_SIZE/2.f;
+const static glm::vec3 BOX_MAX = BOX_SIZE/2.f;
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,175 @@
+#include "SlabDecomposition.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace GLOO {
+
+namespace {
+// Particles travel as 6 floats: position, then velocity
+const int kParticleBytes = 6 * sizeof(float);
+
+void PackParticle(std::vector<char>& message, glm::vec3 p, glm::vec3 v) {
+	float values[6] = {p.x, p.y, p.z, v.x, v.y, v.z};
+	size_t offset = message.size();
+	message.resize(offset + kParticleBytes);
+	memcpy(message.data() + offset, values, kParticleBytes);
+}
+
+// Appends the particles of message from byte offset on
+void UnpackParticles(const std::vector<char>& message, size_t offset,
+										 ParticleState& state) {
+	for (; offset + kParticleBytes <= message.size(); offset += kParticleBytes) {
+		float values[6];
+		memcpy(values, message.data() + offset, kParticleBytes);
+		state.positions.push_back(glm::vec3(values[0], values[1], values[2]));
+		state.velocities.push_back(glm::vec3(values[3], values[4], values[5]));
+	}
+}
+}
+
+SlabDecomposition::SlabDecomposition(std::shared_ptr<Transport> transport,
+																		 glm::vec3 origin, glm::vec3 size,
+																		 float radius, float skin)
+		: transport_(transport), origin_x_(origin.x), skin_(skin), halo_(2.f * radius + skin) {
+	slab_width_ = size.x / GetNumRanks();
+	if (GetNumRanks() > 1 && slab_width_ < halo_ + skin_) {
+		int max_ranks = std::max(1, (int)(size.x / (halo_ + skin_)));
+		throw std::runtime_error(
+				"Too many ranks: " + std::to_string(GetNumRanks()) + " slabs are " +
+				std::to_string(slab_width_) + " wide, narrower than the halo plus skin of " +
+				std::to_string(halo_ + skin_) + ". At most " + std::to_string(max_ranks) +
+				" ranks fit this box.");
+	}
+	outgoing_.resize(GetNumRanks());
+}
+
+int SlabDecomposition::GetOwner(glm::vec3 p) const {
+	int slab = (int)floor((p.x - origin_x_) / slab_width_);
+	return std::max(0, std::min(GetNumRanks() - 1, slab));
+}
+
+bool SlabDecomposition::NeedsMigration(const ParticleState& state) {
+	int rank = GetRank();
+	float lower = GetSlabBegin(rank) - skin_;
+	float upper = GetSlabEnd(rank) + skin_;
+	bool drifted = false;
+	for (int i = 0; i < (int)state.positions.size() && !drifted; i++) {
+		float x = state.positions[i].x;
+		drifted = (rank > 0 && x < lower) || (rank + 1 < GetNumRanks() && x >= upper);
+	}
+	std::vector<double> votes = Gather(drifted ? 1.0 : 0.0);
+	return *std::max_element(votes.begin(), votes.end()) > 0.0;
+}
+
+int SlabDecomposition::Migrate(ParticleState& state) {
+	int rank = GetRank();
+	for (std::vector<char>& message : outgoing_) {
+		message.clear();
+	}
+	// Every message starts with the number of particles its sender gives
+	// away, so all processes add up the same total
+	int sent = 0;
+	int kept = 0;
+	for (int i = 0; i < (int)state.positions.size(); i++) {
+		glm::vec3 p = state.positions[i];
+		glm::vec3 v = state.velocities[i];
+		int owner = GetOwner(p);
+		if (owner == rank) {
+			state.positions[kept] = p;
+			state.velocities[kept] = v;
+			kept++;
+		} else {
+			PackParticle(outgoing_[owner], p, v);
+			sent++;
+		}
+	}
+	state.positions.resize(kept);
+	state.velocities.resize(kept);
+
+	int moved = sent;
+	std::vector<char> message;
+	for (int peer = 0; peer < GetNumRanks(); peer++) {
+		if (peer == rank) {
+			continue;
+		}
+		message.resize(sizeof(int));
+		memcpy(message.data(), &sent, sizeof(int));
+		message.insert(message.end(), outgoing_[peer].begin(), outgoing_[peer].end());
+		transport_->Exchange(peer, message, incoming_);
+		int peer_sent;
+		memcpy(&peer_sent, incoming_.data(), sizeof(int));
+		moved += peer_sent;
+		UnpackParticles(incoming_, sizeof(int), state);
+	}
+	return moved;
+}
+
+void SlabDecomposition::ExchangeGhosts(const ParticleState& state,
+																			 ParticleState& with_ghosts) {
+	int rank = GetRank();
+	std::vector<char>& to_lower = outgoing_[std::max(0, rank - 1)];
+	std::vector<char>& to_upper = outgoing_[std::min(GetNumRanks() - 1, rank + 1)];
+	to_lower.clear();
+	to_upper.clear();
+	// Particles that drifted out of the slab since the last migration are
+	// sent to the neighbor on that side, which always needs them
+	float lower_face = GetSlabBegin(rank) + halo_;
+	float upper_face = GetSlabEnd(rank) - halo_;
+	for (int i = 0; i < (int)state.positions.size(); i++) {
+		glm::vec3 p = state.positions[i];
+		if (rank > 0 && p.x < lower_face) {
+			PackParticle(to_lower, p, state.velocities[i]);
+		}
+		if (rank + 1 < GetNumRanks() && p.x >= upper_face) {
+			PackParticle(to_upper, p, state.velocities[i]);
+		}
+	}
+
+	with_ghosts = state;
+	// Lower neighbor first, the rank order Exchange asks for
+	if (rank > 0) {
+		transport_->Exchange(rank - 1, to_lower, incoming_);
+		UnpackParticles(incoming_, 0, with_ghosts);
+	}
+	if (rank + 1 < GetNumRanks()) {
+		transport_->Exchange(rank + 1, to_upper, incoming_);
+		UnpackParticles(incoming_, 0, with_ghosts);
+	}
+}
+
+std::vector<double> SlabDecomposition::Gather(double value) {
+	std::vector<double> values(GetNumRanks());
+	values[GetRank()] = value;
+	std::vector<char> message(sizeof(double));
+	memcpy(message.data(), &value, sizeof(double));
+	for (int peer = 0; peer < GetNumRanks(); peer++) {
+		if (peer != GetRank()) {
+			transport_->Exchange(peer, message, incoming_);
+			memcpy(&values[peer], incoming_.data(), sizeof(double));
+		}
+	}
+	return values;
+}
+
+void SlabDecomposition::GatherParticles(const ParticleState& state,
+																				ParticleState& all) {
+	std::vector<char>& message = outgoing_[GetRank()];
+	message.clear();
+	for (int i = 0; i < (int)state.positions.size(); i++) {
+		PackParticle(message, state.positions[i], state.velocities[i]);
+	}
+	all = ParticleState();
+	for (int peer = 0; peer < GetNumRanks(); peer++) {
+		if (peer == GetRank()) {
+			UnpackParticles(message, 0, all);
+		} else {
+			transport_->Exchange(peer, message, incoming_);
+			UnpackParticles(incoming_, 0, all);
+		}
+	}
+}
+
+}  // namespace GLOO
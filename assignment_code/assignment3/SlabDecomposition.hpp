@@ -0,0 +1,72 @@
+#ifndef SLAB_DECOMPOSITION_H_
+#define SLAB_DECOMPOSITION_H_
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ParticleState.hpp"
+#include "Transport.hpp"
+
+namespace GLOO {
+
+// Splits a box into equal slabs along x, one per process of a Transport.
+// Each process owns the particles in its slab and sees the particles of
+// the neighboring slabs within 2 radius + skin of the shared faces as
+// ghosts: the forces on the owned particles need the densities of the
+// ghosts within radius, which in turn need the ghosts within radius of
+// those. Owned particles may drift up to skin out of their slab before
+// they have to migrate, as with the skin of NeighborList. Every call below
+// is collective: all processes make it together.
+class SlabDecomposition {
+ public:
+	// Slabs have to be at least as wide as the halo plus the skin, so that
+	// ghosts only ever come from the two neighboring slabs, even once the
+	// particles of those drifted skin towards this one. Throws when there
+	// are too many ranks for that.
+	SlabDecomposition(std::shared_ptr<Transport> transport,
+										glm::vec3 origin, glm::vec3 size,
+										float radius, float skin);
+
+	int GetRank() const { return transport_->GetRank(); }
+	int GetNumRanks() const { return transport_->GetNumRanks(); }
+	// The process owning a point, points outside of the box go to the
+	// nearest slab
+	int GetOwner(glm::vec3 p) const;
+	bool Owns(glm::vec3 p) const { return GetOwner(p) == GetRank(); }
+
+	// Whether a particle of any process drifted more than skin out of its
+	// slab
+	bool NeedsMigration(const ParticleState& state);
+	// Sends the particles that left this slab to the processes owning them
+	// and appends the ones that arrived. The particles that stay keep their
+	// order. Returns how many particles moved between any two processes,
+	// the same number on all of them.
+	int Migrate(ParticleState& state);
+
+	// Copies state into with_ghosts and appends the ghosts
+	void ExchangeGhosts(const ParticleState& state, ParticleState& with_ghosts);
+
+	// The value of every process, indexed by rank
+	std::vector<double> Gather(double value);
+	// The particles of every process, in rank order
+	void GatherParticles(const ParticleState& state, ParticleState& all);
+
+ private:
+	float GetSlabBegin(int rank) const { return origin_x_ + rank * slab_width_; }
+	float GetSlabEnd(int rank) const { return origin_x_ + (rank + 1) * slab_width_; }
+
+	std::shared_ptr<Transport> transport_;
+	float origin_x_;
+	float slab_width_;
+	float skin_;
+	float halo_;
+
+	// Message buffers, one per peer
+	std::vector<std::vector<char>> outgoing_;
+	std::vector<char> incoming_;
+};
+}  // namespace GLOO
+
+#endif
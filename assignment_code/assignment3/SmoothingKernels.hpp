@@ -0,0 +1,120 @@
+#ifndef SMOOTHING_KERNELS_H_
+#define SMOOTHING_KERNELS_H_
+
+#include <math.h>
+
+namespace GLOO {
+
+constexpr float H = .16f; // kernel radius
+constexpr float HSQ = H*H; // radius^2 for optimization
+
+// x^n for n >= 0, folded by the compiler when x is a constant
+constexpr double IntPow(double x, int n) {
+	return n == 0 ? 1.0 : x * IntPow(x, n - 1);
+}
+
+// Smoothing kernel policies for BasicWaterSystem. Each one is a set of
+// static functions of a neighbor at distance d < H, with d2 = d*d:
+//   Density(d2): the kernel W the densities are summed with
+//   PressureGradient(d): dW/dr of the kernel the pressure force uses, so
+//     the gradient towards the neighbor is PressureGradient(d) * r/d
+//   ViscosityLaplacian(d): the weight of v_j - v_i in the viscosity force
+// The normalizations are computed at compile time and the kernels are
+// plain polynomials, so the inner loops inline them without any pow.
+//
+// REST_DENS and GAS_CONST were tuned with the Müller kernels at a hundredth
+// of their textbook normalization, so the other kernels use the same scale.
+constexpr double kKernelScale = 0.01;
+constexpr double kKernelPi = 3.14159265358979;
+
+// Müller et al. 2003: poly6 for the density, the spiky gradient for the
+// pressure and the Laplacian of the viscosity kernel. Keeps the constants
+// the solver was tuned with, 65 for 64 and 3.1415 for pi included. The
+// only policy the vectorized kernels implement.
+struct MullerKernels {
+	static constexpr float kPoly6 = 3.15 / (65.0 * 3.1415 * IntPow(H, 9));
+	static constexpr float kSpikyGrad = -.45 / (3.1415 * IntPow(H, 6));
+	static constexpr float kViscLap = .45 / (3.1415 * IntPow(H, 6));
+
+	static float Density(float d2) {
+		float t = HSQ - d2;
+		return kPoly6 * t * t * t;
+	}
+	// Gradient of Density over r, so the gradient is DensityGradient(d2) * r.
+	// PCISPH predicts the density response with it.
+	static float DensityGradient(float d2) {
+		float t = HSQ - d2;
+		return -6.f * kPoly6 * t * t;
+	}
+	static float PressureGradient(float d) {
+		float t = H - d;
+		return kSpikyGrad * t * t;
+	}
+	static float ViscosityLaplacian(float d) {
+		return kViscLap * (H - d);
+	}
+};
+
+// The cubic B-spline of Monaghan 1992, scaled to reach zero at H. Its
+// Laplacian changes sign, so viscosity takes the Laplacian from the first
+// derivative instead: -2/r dW/dr, as in Brookshaw 1985.
+struct CubicSplineKernels {
+	static constexpr float kInvH = 1.0 / H;
+	static constexpr float kSigma = kKernelScale * 8.0 / (kKernelPi * IntPow(H, 3));
+	static constexpr float kGradSigma = kSigma / H;
+	static constexpr float kLapSigma = kSigma / IntPow(H, 2);
+
+	static float Density(float d2) {
+		float q = sqrt(d2) * kInvH;
+		if (q <= .5f) {
+			return kSigma * (1.f + 6.f*q*q*(q - 1.f));
+		}
+		float t = 1.f - q;
+		return kSigma * 2.f*t*t*t;
+	}
+	static float PressureGradient(float d) {
+		float q = d * kInvH;
+		if (q <= .5f) {
+			return kGradSigma * 6.f*q*(3.f*q - 2.f);
+		}
+		float t = 1.f - q;
+		return kGradSigma * -6.f*t*t;
+	}
+	static float ViscosityLaplacian(float d) {
+		float q = d * kInvH;
+		if (q <= .5f) {
+			return kLapSigma * 12.f*(2.f - 3.f*q);
+		}
+		float t = 1.f - q;
+		return kLapSigma * 12.f*t*t/q;
+	}
+};
+
+// Wendland C2 (Wendland 1995, Dehnen and Aly 2012). Smooth and positive
+// definite, so particles don't pair up. Viscosity as for the cubic spline.
+struct WendlandKernels {
+	static constexpr float kInvH = 1.0 / H;
+	static constexpr float kSigma = kKernelScale * 21.0 / (2.0 * kKernelPi * IntPow(H, 3));
+	static constexpr float kGradSigma = kSigma / H;
+	static constexpr float kLapSigma = kSigma / IntPow(H, 2);
+
+	static float Density(float d2) {
+		float q = sqrt(d2) * kInvH;
+		float t = 1.f - q;
+		float t2 = t * t;
+		return kSigma * t2*t2*(1.f + 4.f*q);
+	}
+	static float PressureGradient(float d) {
+		float q = d * kInvH;
+		float t = 1.f - q;
+		return kGradSigma * -20.f*q*t*t*t;
+	}
+	static float ViscosityLaplacian(float d) {
+		float t = 1.f - d * kInvH;
+		return kLapSigma * 40.f*t*t*t;
+	}
+};
+
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,152 @@
+#include "SocketTransport.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+namespace GLOO {
+
+namespace {
+void ThrowSystemError(const std::string& what) {
+	throw std::runtime_error(what + " failed with errno " + std::to_string(errno) + ".");
+}
+}
+
+std::shared_ptr<SocketTransport> SocketTransport::Fork(int num_ranks) {
+	if (num_ranks < 1) {
+		throw std::runtime_error("A distributed run needs at least one rank.");
+	}
+	// ends[a][b] is the socket rank a talks to rank b through
+	std::vector<std::vector<int>> ends(num_ranks, std::vector<int>(num_ranks, -1));
+	for (int a = 0; a < num_ranks; a++) {
+		for (int b = a + 1; b < num_ranks; b++) {
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+				ThrowSystemError("socketpair");
+			}
+			ends[a][b] = pair[0];
+			ends[b][a] = pair[1];
+		}
+	}
+
+	// Otherwise buffered output would be printed once per process
+	fflush(stdout);
+	fflush(stderr);
+	int rank = 0;
+	std::vector<pid_t> children;
+	for (int r = 1; r < num_ranks; r++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			ThrowSystemError("fork");
+		}
+		if (pid == 0) {
+			rank = r;
+			children.clear();
+			break;
+		}
+		children.push_back(pid);
+	}
+
+	// Keep only this process' ends
+	for (int a = 0; a < num_ranks; a++) {
+		for (int b = 0; b < num_ranks; b++) {
+			if (a != rank && ends[a][b] >= 0) {
+				close(ends[a][b]);
+			}
+		}
+	}
+	for (int socket : ends[rank]) {
+		if (socket >= 0) {
+			fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+		}
+	}
+	return std::shared_ptr<SocketTransport>(new SocketTransport(rank, ends[rank], children));
+}
+
+SocketTransport::SocketTransport(int rank, const std::vector<int>& sockets,
+																 const std::vector<pid_t>& children)
+		: rank_(rank), sockets_(sockets), children_(children) {
+}
+
+SocketTransport::~SocketTransport() {
+	for (int socket : sockets_) {
+		if (socket >= 0) {
+			close(socket);
+		}
+	}
+	for (pid_t child : children_) {
+		waitpid(child, nullptr, 0);
+	}
+}
+
+void SocketTransport::Exchange(int peer, const std::vector<char>& send,
+															 std::vector<char>& receive) {
+	int socket = sockets_[peer];
+	if (socket < 0) {
+		receive = send;
+		return;
+	}
+
+	// Each message is its size followed by its bytes. Writing and reading
+	// are interleaved, otherwise two large messages crossing each other
+	// would both block on full socket buffers.
+	uint64_t send_size = send.size();
+	uint64_t receive_size = 0;
+	const size_t header = sizeof(uint64_t);
+	size_t sent = 0;
+	size_t received = 0;
+	size_t send_total = header + send.size();
+	size_t receive_total = header;
+	while (sent < send_total || received < receive_total) {
+		pollfd fd = {socket, 0, 0};
+		if (sent < send_total) {
+			fd.events |= POLLOUT;
+		}
+		if (received < receive_total) {
+			fd.events |= POLLIN;
+		}
+		if (poll(&fd, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ThrowSystemError("poll");
+		}
+
+		if (fd.revents & POLLOUT) {
+			const char* data = sent < header ? (const char*)&send_size + sent : send.data() + (sent - header);
+			size_t length = sent < header ? header - sent : send_total - sent;
+			ssize_t written = ::send(socket, data, length, MSG_NOSIGNAL);
+			if (written > 0) {
+				sent += written;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				ThrowSystemError("send");
+			}
+		}
+		if (received < receive_total && (fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+			char* data = received < header ? (char*)&receive_size + received : receive.data() + (received - header);
+			size_t length = received < header ? header - received : receive_total - received;
+			ssize_t read = recv(socket, data, length, 0);
+			if (read == 0) {
+				throw std::runtime_error("Rank " + std::to_string(peer) + " closed its connection.");
+			}
+			if (read > 0) {
+				received += read;
+				if (received == header) {
+					receive.resize(receive_size);
+					receive_total = header + receive_size;
+				}
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				ThrowSystemError("recv");
+			}
+		}
+	}
+}
+
+}  // namespace GLOO
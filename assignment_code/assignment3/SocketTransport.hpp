@@ -0,0 +1,41 @@
+#ifndef SOCKET_TRANSPORT_H_
+#define SOCKET_TRANSPORT_H_
+
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+
+#include "Transport.hpp"
+
+namespace GLOO {
+
+// Transport between processes forked on one machine, connected pairwise by
+// Unix domain sockets. Needs nothing besides POSIX.
+class SocketTransport : public Transport {
+ public:
+	// Forks num_ranks-1 children and returns the transport of whichever
+	// process it returns in, rank 0 in the caller. Only the calling thread
+	// survives a fork, so this has to happen before the thread pool starts
+	// its workers.
+	static std::shared_ptr<SocketTransport> Fork(int num_ranks);
+	// Closes the sockets, and in rank 0 waits for the children to exit
+	~SocketTransport();
+
+	int GetRank() const override { return rank_; }
+	int GetNumRanks() const override { return sockets_.size(); }
+
+	void Exchange(int peer, const std::vector<char>& send,
+								std::vector<char>& receive) override;
+
+ private:
+	SocketTransport(int rank, const std::vector<int>& sockets,
+									const std::vector<pid_t>& children);
+
+	int rank_;
+	// Non-blocking socket to each peer, -1 for this process
+	std::vector<int> sockets_;
+	std::vector<pid_t> children_;
+};
+}  // namespace GLOO
+
+#endif
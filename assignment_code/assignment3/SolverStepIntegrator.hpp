@@ -0,0 +1,25 @@
+#ifndef SOLVER_STEP_INTEGRATOR_H_
+#define SOLVER_STEP_INTEGRATOR_H_
+
+#include <stdexcept>
+
+#include "IntegratorBase.hpp"
+
+namespace GLOO {
+// Lets a system that implements ParticleSystemBase::Advance take the step
+// itself, then handles the boundaries like every other integrator.
+template <class TSystem, class TState>
+class SolverStepIntegrator : public IntegratorBase<TSystem, TState> {
+  void Step(TSystem& system,
+            TState& state,
+            float start_time,
+            float dt) override {
+    if (!system.Advance(state, start_time, dt)) {
+      throw std::runtime_error("The particle system cannot advance itself!");
+    }
+    this->ApplyBoundary(state);
+  }
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SOLVER_TYPE_H_
+#define SOLVER_TYPE_H_
+
+namespace GLOO {
+// WCSPH: WaterSystem, pressures from an equation of state
+// PCISPH: PciSphSystem, pressures iterated to a density error tolerance
+// DFSPH: DfSphSystem, velocities corrected to constant density and zero
+// divergence
+// PBF: PbfSystem, positions projected onto the density constraints with a
+// fixed number of iterations
+// FLIP: FlipSystem, velocities made divergence free on a grid and blended
+// back into the particles
+enum class SolverType { WCSPH, PCISPH, DFSPH, PBF, FLIP };
+}
+
+#endif
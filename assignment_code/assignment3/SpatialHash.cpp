@@ -0,0 +1,170 @@
+#include "SpatialHash.hpp"
+#include <math.h>
+#include <algorithm>
+
+namespace GLOO {
+
+const static int kKeyBits = 21;
+const static int kKeyBias = 1 << (kKeyBits - 1);
+const static uint64_t kKeyMask = (1ull << kKeyBits) - 1;
+// No packed key has all bits set
+const static uint64_t kEmptyKey = ~0ull;
+
+const glm::ivec3 SpatialHash::kHalfStencil[13] = {
+	glm::ivec3(0, 0, 1),
+	glm::ivec3(0, 1, -1), glm::ivec3(0, 1, 0), glm::ivec3(0, 1, 1),
+	glm::ivec3(1, -1, -1), glm::ivec3(1, -1, 0), glm::ivec3(1, -1, 1),
+	glm::ivec3(1, 0, -1), glm::ivec3(1, 0, 0), glm::ivec3(1, 0, 1),
+	glm::ivec3(1, 1, -1), glm::ivec3(1, 1, 0), glm::ivec3(1, 1, 1)
+};
+
+SpatialHash::SpatialHash(float cell_size) : cell_size_(cell_size) {
+}
+
+uint64_t SpatialHash::PackKey(glm::ivec3 cell) {
+	return ((uint64_t) (cell.x + kKeyBias) << (2 * kKeyBits)) |
+				 ((uint64_t) (cell.y + kKeyBias) << kKeyBits) |
+				 (uint64_t) (cell.z + kKeyBias);
+}
+
+glm::ivec3 SpatialHash::UnpackKey(uint64_t key) {
+	return glm::ivec3((int) ((key >> (2 * kKeyBits)) & kKeyMask) - kKeyBias,
+										(int) ((key >> kKeyBits) & kKeyMask) - kKeyBias,
+										(int) (key & kKeyMask) - kKeyBias);
+}
+
+uint64_t SpatialHash::Hash(uint64_t key) {
+	// The finalizer of MurmurHash3, so that neighboring cells spread over
+	// the whole table
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+	return key;
+}
+
+int SpatialHash::FindSlot(uint64_t key) const {
+	int mask = table_keys_.size() - 1;
+	int slot = Hash(key) & mask;
+	while (table_keys_[slot] != key && table_keys_[slot] != kEmptyKey) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+glm::ivec3 SpatialHash::GetCell(glm::vec3 p) const {
+	glm::vec3 q = glm::floor(p / cell_size_);
+	q = glm::clamp(q, glm::vec3(1 - kKeyBias), glm::vec3(kKeyBias - 2));
+	return glm::ivec3(q);
+}
+
+int SpatialHash::FindCell(glm::ivec3 cell) const {
+	if (table_keys_.empty()) {
+		return -1;
+	}
+	int slot = FindSlot(PackKey(cell));
+	return table_keys_[slot] == kEmptyKey ? -1 : table_cells_[slot];
+}
+
+void SpatialHash::Build(const Vec3Array& positions) {
+	int n = positions.size();
+	sorted_indices_.resize(n);
+	particle_cells_.resize(n);
+
+	// At most n cells are occupied, so the table is at most half full
+	size_t slots = 16;
+	while (slots < 2 * (size_t) n) {
+		slots *= 2;
+	}
+	table_keys_.assign(slots, kEmptyKey);
+	table_cells_.resize(slots);
+
+	// Insert the cells in the order they are first seen, counting particles
+	unsorted_keys_.clear();
+	unsorted_counts_.clear();
+	for (int i = 0; i < n; i++) {
+		uint64_t key = PackKey(GetCell(positions[i]));
+		int slot = FindSlot(key);
+		if (table_keys_[slot] == kEmptyKey) {
+			table_keys_[slot] = key;
+			table_cells_[slot] = unsorted_keys_.size();
+			unsorted_keys_.push_back(key);
+			unsorted_counts_.push_back(0);
+		}
+		int c = table_cells_[slot];
+		particle_cells_[i] = c;
+		unsorted_counts_[c]++;
+	}
+
+	// Sort only the occupied cells, the particles follow with a counting
+	// sort as in NeighborGrid
+	int m = unsorted_keys_.size();
+	cell_order_.resize(m);
+	for (int c = 0; c < m; c++) {
+		cell_order_[c] = c;
+	}
+	std::sort(cell_order_.begin(), cell_order_.end(), [&](int a, int b) {
+		return unsorted_keys_[a] < unsorted_keys_[b];
+	});
+	cell_rank_.resize(m);
+	cell_keys_.resize(m);
+	cell_start_.resize(m);
+	cell_count_.resize(m);
+	int start = 0;
+	for (int c = 0; c < m; c++) {
+		int old_c = cell_order_[c];
+		cell_rank_[old_c] = c;
+		cell_keys_[c] = unsorted_keys_[old_c];
+		cell_count_[c] = unsorted_counts_[old_c];
+		cell_start_[c] = start;
+		start += cell_count_[c];
+	}
+	for (size_t slot = 0; slot < table_keys_.size(); slot++) {
+		if (table_keys_[slot] != kEmptyKey) {
+			table_cells_[slot] = cell_rank_[table_cells_[slot]];
+		}
+	}
+
+	// Scatter the particles into their ranges, keeping them in index order.
+	// cell_order_ is free again and becomes the scatter cursor.
+	for (int c = 0; c < m; c++) {
+		cell_order_[c] = cell_start_[c];
+	}
+	for (int i = 0; i < n; i++) {
+		int c = cell_rank_[particle_cells_[i]];
+		particle_cells_[i] = c;
+		sorted_indices_[cell_order_[c]++] = i;
+	}
+}
+
+void SpatialHash::GetCandidateRuns(std::vector<int>& runs) const {
+	runs.resize(GetNumCells() * 18);
+	for (int c = 0; c < GetNumCells(); c++) {
+		int* run = &runs[c * 18];
+		glm::ivec3 cell = GetCellCoordinates(c);
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++, run += 2) {
+				// The occupied cells of a z-column are consecutive in the sorted
+				// order, so the first and last one bound the run
+				int first = -1;
+				int last = -1;
+				for (int dz = -1; dz <= 1; dz++) {
+					int nc = FindCell(cell + glm::ivec3(dx, dy, dz));
+					if (nc >= 0) {
+						first = first < 0 ? nc : first;
+						last = nc;
+					}
+				}
+				if (first < 0) {
+					run[0] = run[1] = 0;
+				} else {
+					run[0] = cell_start_[first];
+					run[1] = cell_start_[last] + cell_count_[last];
+				}
+			}
+		}
+	}
+}
+
+}  // namespace GLOO
@@ -0,0 +1,134 @@
+#ifndef SPATIAL_HASH_H_
+#define SPATIAL_HASH_H_
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "Vec3Array.hpp"
+
+namespace GLOO {
+
+// A cell list over unbounded space that only stores the occupied cells.
+// They are found through an open addressing hash table of the cell
+// coordinates, so lookups stay constant time while memory grows with the
+// particle count instead of the volume of the domain.
+//
+// Build orders the occupied cells lexicographically by (x, y, z), the same
+// order NeighborGrid uses, so cells adjacent in z are adjacent in
+// GetSortedIndices() and the accessors below match NeighborGrid's.
+class SpatialHash {
+ public:
+	SpatialHash() {}
+	explicit SpatialHash(float cell_size);
+
+	// Rebins all of the particles
+	void Build(const Vec3Array& positions);
+
+	// Gets the cell a point is in. Coordinates are limited to +-2^20 cells.
+	glm::ivec3 GetCell(glm::vec3 p) const;
+	// Index of an occupied cell, or -1 if no particle is in it
+	int FindCell(glm::ivec3 cell) const;
+
+	// The particles of occupied cell c are
+	// GetSortedIndices()[GetCellStart(c)] ... [GetCellStart(c) + GetCellCount(c) - 1]
+	int GetCellStart(int c) const { return cell_start_[c]; }
+	int GetCellCount(int c) const { return cell_count_[c]; }
+	const std::vector<int>& GetSortedIndices() const { return sorted_indices_; }
+	const std::vector<int>& GetCellStarts() const { return cell_start_; }
+	const std::vector<int>& GetCellCounts() const { return cell_count_; }
+	// The occupied cell each particle was binned into by the last Build
+	int GetParticleCell(int i) const { return particle_cells_[i]; }
+	glm::ivec3 GetCellCoordinates(int c) const { return UnpackKey(cell_keys_[c]); }
+
+	// Number of occupied cells
+	int GetNumCells() const { return cell_keys_.size(); }
+	// Slots of the hash table, about twice the particle count
+	int GetTableSize() const { return table_keys_.size(); }
+
+	// Calls f(j) for every particle j in the 3x3x3 block of cells around p
+	template <class F>
+	void ForEachCandidate(glm::vec3 p, F f) const {
+		glm::ivec3 cell = GetCell(p);
+		for (int x = cell.x-1; x <= cell.x+1; x++) {
+			for (int y = cell.y-1; y <= cell.y+1; y++) {
+				for (int z = cell.z-1; z <= cell.z+1; z++) {
+					int c = FindCell(glm::ivec3(x, y, z));
+					if (c < 0) {
+						continue;
+					}
+					int end = cell_start_[c] + cell_count_[c];
+					for (int k = cell_start_[c]; k < end; k++) {
+						f(sorted_indices_[k]);
+					}
+				}
+			}
+		}
+	}
+
+	// Same as NeighborGrid::GetCandidateRuns, 18 ints per occupied cell
+	void GetCandidateRuns(std::vector<int>& runs) const;
+
+	// Calls f(i, j) once for every unordered pair of distinct particles in
+	// the same or adjacent cells, with the half stencil of NeighborGrid
+	template <class F>
+	void ForEachPair(F f) const {
+		for (int c = 0; c < GetNumCells(); c++) {
+			int begin = cell_start_[c];
+			int end = begin + cell_count_[c];
+			for (int a = begin; a < end; a++) {
+				for (int b = a+1; b < end; b++) {
+					f(sorted_indices_[a], sorted_indices_[b]);
+				}
+			}
+			glm::ivec3 cell = GetCellCoordinates(c);
+			for (int o = 0; o < 13; o++) {
+				int nc = FindCell(cell + kHalfStencil[o]);
+				if (nc < 0) {
+					continue;
+				}
+				int n_begin = cell_start_[nc];
+				int n_end = n_begin + cell_count_[nc];
+				for (int a = begin; a < end; a++) {
+					for (int b = n_begin; b < n_end; b++) {
+						f(sorted_indices_[a], sorted_indices_[b]);
+					}
+				}
+			}
+		}
+	}
+
+ private:
+	// 21 bits per axis, biased to be unsigned, x in the highest bits so
+	// that the numeric order of the keys is the lexicographic order
+	static uint64_t PackKey(glm::ivec3 cell);
+	static glm::ivec3 UnpackKey(uint64_t key);
+	static uint64_t Hash(uint64_t key);
+	// Slot of key in the table, or of the empty slot it would go to
+	int FindSlot(uint64_t key) const;
+
+	static const glm::ivec3 kHalfStencil[13];
+
+	float cell_size_ = 1.f;
+
+	// Open addressing with linear probing, a power of two number of slots
+	std::vector<uint64_t> table_keys_;
+	std::vector<int> table_cells_;
+
+	// Key, first particle and particle count of every occupied cell
+	std::vector<uint64_t> cell_keys_;
+	std::vector<int> cell_start_;
+	std::vector<int> cell_count_;
+	// Particle indices ordered by cell
+	std::vector<int> sorted_indices_;
+	std::vector<int> particle_cells_;
+	// Scratch for sorting the occupied cells and the scatter
+	std::vector<int> cell_order_;
+	std::vector<int> cell_rank_;
+	std::vector<uint64_t> unsorted_keys_;
+	std::vector<int> unsorted_counts_;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,312 @@
+#include "SphKernels.hpp"
+
+#include <stdexcept>
+
+// The vectorized kernels are compiled for their instruction set with
+// function attributes, so the rest of the program stays portable and the
+// CPU is only asked for AVX2 or AVX-512 once we know it has them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPH_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace GLOO {
+
+SimdLevel DetectSimdLevel() {
+#ifdef SPH_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return SimdLevel::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return SimdLevel::AVX2;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+const char* GetSimdLevelName(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::AVX2:
+			return "AVX2";
+		case SimdLevel::AVX512:
+			return "AVX-512";
+		default:
+			return "scalar";
+	}
+}
+
+#ifdef SPH_X86_KERNELS
+
+// Candidates of particle s are 9 runs of consecutive sorted particles.
+// Every run is processed 8 (AVX2) or 16 (AVX-512) candidates at a time, with
+// the lanes past the end of the run masked out of loads and sums.
+
+__attribute__((target("avx2,fma")))
+static inline float HorizontalSum(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static void ComputeDensitiesAvx2(const SphKernelInput& in,
+																 const SphKernelParams& params,
+																 int cell_begin, int cell_end,
+																 float* rho) {
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 hsq = _mm256_set1_ps(params.hsq);
+	for (int c = cell_begin; c < cell_end; c++) {
+		const int* runs = in.runs + 18 * c;
+		int end_s = in.cell_start[c] + in.cell_count[c];
+		for (int s = in.cell_start[c]; s < end_s; s++) {
+			__m256 x = _mm256_set1_ps(in.px[s]);
+			__m256 y = _mm256_set1_ps(in.py[s]);
+			__m256 z = _mm256_set1_ps(in.pz[s]);
+			__m256 sum = _mm256_setzero_ps();
+			for (int r = 0; r < 9; r++) {
+				int end = runs[2*r+1];
+				for (int k = runs[2*r]; k < end; k += 8) {
+					__m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(end - k), lanes);
+					__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(in.px + k, active), x);
+					__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(in.py + k, active), y);
+					__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(in.pz + k, active), z);
+					__m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+					__m256 t = _mm256_sub_ps(hsq, d2);
+					__m256 w = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+					__m256 mask = _mm256_and_ps(_mm256_castsi256_ps(active),
+																			_mm256_cmp_ps(d2, hsq, _CMP_LT_OQ));
+					sum = _mm256_add_ps(sum, _mm256_and_ps(mask, w));
+				}
+			}
+			rho[s] = params.mass * params.poly6 * HorizontalSum(sum);
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void ComputeForcesAvx2(const SphKernelInput& in,
+															const SphKernelParams& params,
+															int cell_begin, int cell_end,
+															float* fx, float* fy, float* fz) {
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 h = _mm256_set1_ps(params.h);
+	const __m256 hsq = _mm256_set1_ps(params.hsq);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 pressure_coeff = _mm256_set1_ps(0.5f * params.mass * params.spiky_grad);
+	const __m256 visc_coeff = _mm256_set1_ps(params.visc * params.mass * params.visc_lap);
+	for (int c = cell_begin; c < cell_end; c++) {
+		const int* runs = in.runs + 18 * c;
+		int end_s = in.cell_start[c] + in.cell_count[c];
+		for (int s = in.cell_start[c]; s < end_s; s++) {
+			__m256 x = _mm256_set1_ps(in.px[s]);
+			__m256 y = _mm256_set1_ps(in.py[s]);
+			__m256 z = _mm256_set1_ps(in.pz[s]);
+			__m256 vx = _mm256_set1_ps(in.vx[s]);
+			__m256 vy = _mm256_set1_ps(in.vy[s]);
+			__m256 vz = _mm256_set1_ps(in.vz[s]);
+			__m256 pressure = _mm256_set1_ps(in.pressure[s]);
+			__m256i self = _mm256_set1_epi32(s);
+			__m256 sum_x = zero;
+			__m256 sum_y = zero;
+			__m256 sum_z = zero;
+			for (int r = 0; r < 9; r++) {
+				int end = runs[2*r+1];
+				for (int k = runs[2*r]; k < end; k += 8) {
+					__m256i index = _mm256_add_epi32(_mm256_set1_epi32(k), lanes);
+					__m256i active = _mm256_andnot_si256(_mm256_cmpeq_epi32(index, self),
+																							 _mm256_cmpgt_epi32(_mm256_set1_epi32(end), index));
+					__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(in.px + k, active), x);
+					__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(in.py + k, active), y);
+					__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(in.pz + k, active), z);
+					__m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+					__m256 mask = _mm256_and_ps(_mm256_castsi256_ps(active),
+																			_mm256_and_ps(_mm256_cmp_ps(d2, hsq, _CMP_LT_OQ),
+																										_mm256_cmp_ps(d2, zero, _CMP_GT_OQ)));
+					if (_mm256_testz_ps(mask, mask)) {
+						continue;
+					}
+					__m256 rho = _mm256_maskload_ps(in.rho + k, active);
+					__m256 p = _mm256_maskload_ps(in.pressure + k, active);
+					__m256 d = _mm256_sqrt_ps(d2);
+					__m256 hd = _mm256_sub_ps(h, d);
+					// Masked lanes may divide by zero, the and clears them afterwards
+					__m256 pressure_term = _mm256_div_ps(
+							_mm256_mul_ps(_mm256_mul_ps(pressure_coeff, _mm256_add_ps(pressure, p)),
+														_mm256_mul_ps(hd, hd)),
+							_mm256_mul_ps(d, rho));
+					__m256 visc_term = _mm256_div_ps(_mm256_mul_ps(visc_coeff, hd), rho);
+					pressure_term = _mm256_and_ps(mask, pressure_term);
+					visc_term = _mm256_and_ps(mask, visc_term);
+					__m256 dvx = _mm256_sub_ps(_mm256_maskload_ps(in.vx + k, active), vx);
+					__m256 dvy = _mm256_sub_ps(_mm256_maskload_ps(in.vy + k, active), vy);
+					__m256 dvz = _mm256_sub_ps(_mm256_maskload_ps(in.vz + k, active), vz);
+					sum_x = _mm256_fmadd_ps(dx, pressure_term, _mm256_fmadd_ps(dvx, visc_term, sum_x));
+					sum_y = _mm256_fmadd_ps(dy, pressure_term, _mm256_fmadd_ps(dvy, visc_term, sum_y));
+					sum_z = _mm256_fmadd_ps(dz, pressure_term, _mm256_fmadd_ps(dvz, visc_term, sum_z));
+				}
+			}
+			fx[s] = HorizontalSum(sum_x);
+			fy[s] = HorizontalSum(sum_y);
+			fz[s] = HorizontalSum(sum_z);
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 ActiveLanes(int remaining) {
+	return remaining >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << remaining) - 1);
+}
+
+// _mm512_reduce_add_ps and the unmasked sqrt pass undefined registers
+// through their masks, which -Wall flags, so the 512-bit kernels use the
+// zero-masked forms instead.
+__attribute__((target("avx512f")))
+static inline float HorizontalSum(__m512 v) {
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 0),
+																		 _mm512_maskz_extractf32x4_ps(0xf, v, 2)),
+													_mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 1),
+																		 _mm512_maskz_extractf32x4_ps(0xf, v, 3)));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx512f")))
+static void ComputeDensitiesAvx512(const SphKernelInput& in,
+																	 const SphKernelParams& params,
+																	 int cell_begin, int cell_end,
+																	 float* rho) {
+	const __m512 hsq = _mm512_set1_ps(params.hsq);
+	for (int c = cell_begin; c < cell_end; c++) {
+		const int* runs = in.runs + 18 * c;
+		int end_s = in.cell_start[c] + in.cell_count[c];
+		for (int s = in.cell_start[c]; s < end_s; s++) {
+			__m512 x = _mm512_set1_ps(in.px[s]);
+			__m512 y = _mm512_set1_ps(in.py[s]);
+			__m512 z = _mm512_set1_ps(in.pz[s]);
+			__m512 sum = _mm512_setzero_ps();
+			for (int r = 0; r < 9; r++) {
+				int end = runs[2*r+1];
+				for (int k = runs[2*r]; k < end; k += 16) {
+					__mmask16 active = ActiveLanes(end - k);
+					__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.px + k), x);
+					__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.py + k), y);
+					__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.pz + k), z);
+					__m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+					__m512 t = _mm512_sub_ps(hsq, d2);
+					__m512 w = _mm512_mul_ps(_mm512_mul_ps(t, t), t);
+					__mmask16 mask = _mm512_mask_cmp_ps_mask(active, d2, hsq, _CMP_LT_OQ);
+					sum = _mm512_mask_add_ps(sum, mask, sum, w);
+				}
+			}
+			rho[s] = params.mass * params.poly6 * HorizontalSum(sum);
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static void ComputeForcesAvx512(const SphKernelInput& in,
+																const SphKernelParams& params,
+																int cell_begin, int cell_end,
+																float* fx, float* fy, float* fz) {
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+																					8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512 h = _mm512_set1_ps(params.h);
+	const __m512 hsq = _mm512_set1_ps(params.hsq);
+	const __m512 zero = _mm512_setzero_ps();
+	const __m512 pressure_coeff = _mm512_set1_ps(0.5f * params.mass * params.spiky_grad);
+	const __m512 visc_coeff = _mm512_set1_ps(params.visc * params.mass * params.visc_lap);
+	for (int c = cell_begin; c < cell_end; c++) {
+		const int* runs = in.runs + 18 * c;
+		int end_s = in.cell_start[c] + in.cell_count[c];
+		for (int s = in.cell_start[c]; s < end_s; s++) {
+			__m512 x = _mm512_set1_ps(in.px[s]);
+			__m512 y = _mm512_set1_ps(in.py[s]);
+			__m512 z = _mm512_set1_ps(in.pz[s]);
+			__m512 vx = _mm512_set1_ps(in.vx[s]);
+			__m512 vy = _mm512_set1_ps(in.vy[s]);
+			__m512 vz = _mm512_set1_ps(in.vz[s]);
+			__m512 pressure = _mm512_set1_ps(in.pressure[s]);
+			__m512i self = _mm512_set1_epi32(s);
+			__m512 sum_x = zero;
+			__m512 sum_y = zero;
+			__m512 sum_z = zero;
+			for (int r = 0; r < 9; r++) {
+				int end = runs[2*r+1];
+				for (int k = runs[2*r]; k < end; k += 16) {
+					__m512i index = _mm512_add_epi32(_mm512_set1_epi32(k), lanes);
+					__mmask16 active = _mm512_mask_cmpneq_epi32_mask(ActiveLanes(end - k), index, self);
+					__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.px + k), x);
+					__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.py + k), y);
+					__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(active, in.pz + k), z);
+					__m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+					__mmask16 mask = _mm512_mask_cmp_ps_mask(
+							_mm512_mask_cmp_ps_mask(active, d2, hsq, _CMP_LT_OQ), d2, zero, _CMP_GT_OQ);
+					if (mask == 0) {
+						continue;
+					}
+					__m512 rho = _mm512_maskz_loadu_ps(mask, in.rho + k);
+					__m512 p = _mm512_maskz_loadu_ps(mask, in.pressure + k);
+					__m512 d = _mm512_maskz_sqrt_ps(mask, d2);
+					__m512 hd = _mm512_sub_ps(h, d);
+					__m512 pressure_term = _mm512_maskz_div_ps(mask,
+							_mm512_mul_ps(_mm512_mul_ps(pressure_coeff, _mm512_add_ps(pressure, p)),
+														_mm512_mul_ps(hd, hd)),
+							_mm512_mul_ps(d, rho));
+					__m512 visc_term = _mm512_maskz_div_ps(mask, _mm512_mul_ps(visc_coeff, hd), rho);
+					__m512 dvx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, in.vx + k), vx);
+					__m512 dvy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, in.vy + k), vy);
+					__m512 dvz = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, in.vz + k), vz);
+					sum_x = _mm512_fmadd_ps(dx, pressure_term, _mm512_fmadd_ps(dvx, visc_term, sum_x));
+					sum_y = _mm512_fmadd_ps(dy, pressure_term, _mm512_fmadd_ps(dvy, visc_term, sum_y));
+					sum_z = _mm512_fmadd_ps(dz, pressure_term, _mm512_fmadd_ps(dvz, visc_term, sum_z));
+				}
+			}
+			fx[s] = HorizontalSum(sum_x);
+			fy[s] = HorizontalSum(sum_y);
+			fz[s] = HorizontalSum(sum_z);
+		}
+	}
+}
+
+#endif
+
+void ComputeDensities(SimdLevel level,
+											const SphKernelInput& in,
+											const SphKernelParams& params,
+											int cell_begin, int cell_end,
+											float* rho) {
+#ifdef SPH_X86_KERNELS
+	if (level == SimdLevel::AVX512) {
+		ComputeDensitiesAvx512(in, params, cell_begin, cell_end, rho);
+		return;
+	}
+	if (level == SimdLevel::AVX2) {
+		ComputeDensitiesAvx2(in, params, cell_begin, cell_end, rho);
+		return;
+	}
+#endif
+	throw std::runtime_error("No vectorized SPH kernels for this SIMD level!");
+}
+
+void ComputeForces(SimdLevel level,
+									 const SphKernelInput& in,
+									 const SphKernelParams& params,
+									 int cell_begin, int cell_end,
+									 float* fx, float* fy, float* fz) {
+#ifdef SPH_X86_KERNELS
+	if (level == SimdLevel::AVX512) {
+		ComputeForcesAvx512(in, params, cell_begin, cell_end, fx, fy, fz);
+		return;
+	}
+	if (level == SimdLevel::AVX2) {
+		ComputeForcesAvx2(in, params, cell_begin, cell_end, fx, fy, fz);
+		return;
+	}
+#endif
+	throw std::runtime_error("No vectorized SPH kernels for this SIMD level!");
+}
+
+}  // namespace GLOO
@@ -0,0 +1,59 @@
+#ifndef SPH_KERNELS_H_
+#define SPH_KERNELS_H_
+
+namespace GLOO {
+
+// Instruction sets the density and force kernels are implemented for.
+// Scalar means the reference implementation in WaterSystem.
+enum class SimdLevel { Scalar, AVX2, AVX512 };
+
+// The best level the CPU we are running on supports, found with CPUID.
+SimdLevel DetectSimdLevel();
+const char* GetSimdLevelName(SimdLevel level);
+
+// Constants of the SPH formulation
+struct SphKernelParams {
+	float h;
+	float hsq;
+	float mass;
+	float poly6;
+	float spiky_grad;
+	float visc_lap;
+	float visc;
+};
+
+// Particles sorted by grid cell
+struct SphKernelInput {
+	const int* cell_start;
+	const int* cell_count;
+	// 18 ints per cell from NeighborGrid::GetCandidateRuns, in sorted order
+	const int* runs;
+
+	const float* px;
+	const float* py;
+	const float* pz;
+	const float* vx;
+	const float* vy;
+	const float* vz;
+	// Only read by the force kernel
+	const float* rho;
+	const float* pressure;
+};
+
+// Densities of the sorted particles in cells [cell_begin, cell_end).
+// level may not be Scalar.
+void ComputeDensities(SimdLevel level,
+											const SphKernelInput& in,
+											const SphKernelParams& params,
+											int cell_begin, int cell_end,
+											float* rho);
+// Pressure and viscosity forces, without gravity, of the sorted particles
+// in cells [cell_begin, cell_end). level may not be Scalar.
+void ComputeForces(SimdLevel level,
+									 const SphKernelInput& in,
+									 const SphKernelParams& params,
+									 int cell_begin, int cell_end,
+									 float* fx, float* fy, float* fz);
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,243 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace GLOO {
+
+namespace {
+// Set on the workers and on a thread while it runs a parallel loop, so that
+// nested loops don't wait on workers that are busy with the outer one.
+thread_local bool in_parallel_loop = false;
+}
+
+ThreadPool::ThreadPool(int num_threads)
+		: next_chunk_(0), finished_chunks_(0), steals_(0) {
+	StartWorkers(std::max(1, num_threads) - 1);
+}
+
+ThreadPool::~ThreadPool() {
+	StopWorkers();
+}
+
+ThreadPool& ThreadPool::GetInstance() {
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
+
+void ThreadPool::SetNumThreads(int num_threads) {
+	StopWorkers();
+	StartWorkers(std::max(1, num_threads) - 1);
+}
+
+void ThreadPool::StartWorkers(int num_workers) {
+	std::vector<BlockQueue>(num_workers + 1).swap(queues_);
+	for (int i = 0; i < num_workers; i++) {
+		workers_.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+	}
+}
+
+void ThreadPool::StopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	work_ready_.notify_all();
+	for (std::thread& worker : workers_) {
+		worker.join();
+	}
+	workers_.clear();
+	stop_ = false;
+}
+
+void ThreadPool::RunLoop(int begin, int end, ChunkFunction f,
+												 const void* context, int grain) {
+	int n = end - begin;
+	if (n <= 0) {
+		return;
+	}
+	grain = std::max(1, grain);
+	if (workers_.empty() || in_parallel_loop || n <= grain) {
+		f(context, begin, end);
+		return;
+	}
+
+	// A few chunks per thread, so that uneven chunks even out
+	int num_chunks = std::min((n + grain - 1) / grain, GetNumThreads() * 4);
+	int chunk_size = (n + num_chunks - 1) / num_chunks;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		job_ = f;
+		job_context_ = context;
+		job_begin_ = begin;
+		job_end_ = end;
+		chunk_size_ = chunk_size;
+		num_chunks_ = (n + chunk_size - 1) / chunk_size;
+		next_chunk_ = 0;
+		finished_chunks_ = 0;
+		generation_++;
+	}
+	work_ready_.notify_all();
+
+	in_parallel_loop = true;
+	RunChunks();
+	in_parallel_loop = false;
+
+	// Wait for the other chunks and for every worker to leave RunChunks, so
+	// none of them touches the job once the next loop is set up.
+	std::unique_lock<std::mutex> lock(mutex_);
+	work_done_.wait(lock, [this] {
+		return finished_chunks_ == num_chunks_ && active_workers_ == 0;
+	});
+	job_ = nullptr;
+}
+
+void ThreadPool::RunBlocks(int num_blocks, BlockFunction f,
+													 const void* context) {
+	if (num_blocks <= 0) {
+		return;
+	}
+	if (workers_.empty() || in_parallel_loop || num_blocks == 1) {
+		for (int block = 0; block < num_blocks; block++) {
+			f(context, block);
+		}
+		return;
+	}
+
+	int num_threads = GetNumThreads();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		block_job_ = f;
+		job_context_ = context;
+		num_chunks_ = num_blocks;
+		finished_chunks_ = 0;
+		for (int t = 0; t < num_threads; t++) {
+			uint64_t head = (int64_t)num_blocks * t / num_threads;
+			uint64_t tail = (int64_t)num_blocks * (t + 1) / num_threads;
+			queues_[t].range = (head << 32) | tail;
+		}
+		generation_++;
+	}
+	work_ready_.notify_all();
+
+	in_parallel_loop = true;
+	RunShare(0);
+	in_parallel_loop = false;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	work_done_.wait(lock, [this] {
+		return finished_chunks_ == num_chunks_ && active_workers_ == 0;
+	});
+	block_job_ = nullptr;
+}
+
+void ThreadPool::WorkerLoop(int thread) {
+	in_parallel_loop = true;
+	std::unique_lock<std::mutex> lock(mutex_);
+	unsigned int seen_generation = generation_;
+	while (true) {
+		work_ready_.wait(lock, [&] {
+			return stop_ || generation_ != seen_generation;
+		});
+		if (stop_) {
+			return;
+		}
+		seen_generation = generation_;
+		if (job_ == nullptr && block_job_ == nullptr) {
+			// Woke up after the loop was already finished
+			continue;
+		}
+		active_workers_++;
+		bool blocks = block_job_ != nullptr;
+		lock.unlock();
+		if (blocks) {
+			RunShare(thread);
+		} else {
+			RunChunks();
+		}
+		lock.lock();
+		active_workers_--;
+		if (active_workers_ == 0) {
+			work_done_.notify_all();
+		}
+	}
+}
+
+void ThreadPool::RunChunks() {
+	while (true) {
+		int chunk = next_chunk_++;
+		if (chunk >= num_chunks_) {
+			return;
+		}
+		int begin = job_begin_ + chunk * chunk_size_;
+		int end = std::min(job_end_, begin + chunk_size_);
+		job_(job_context_, begin, end);
+		if (++finished_chunks_ == num_chunks_) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			work_done_.notify_all();
+		}
+	}
+}
+
+void ThreadPool::RunShare(int thread) {
+	while (true) {
+		int block = PopBlock(thread);
+		if (block < 0) {
+			block = StealBlock(thread);
+		}
+		if (block < 0) {
+			return;
+		}
+		block_job_(job_context_, block);
+		if (++finished_chunks_ == num_chunks_) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			work_done_.notify_all();
+		}
+	}
+}
+
+int ThreadPool::PopBlock(int thread) {
+	std::atomic<uint64_t>& range = queues_[thread].range;
+	uint64_t current = range.load();
+	while (true) {
+		uint32_t head = current >> 32;
+		uint32_t tail = (uint32_t)current;
+		if (head >= tail) {
+			return -1;
+		}
+		if (range.compare_exchange_weak(current, ((uint64_t)(head + 1) << 32) | tail)) {
+			return head;
+		}
+	}
+}
+
+int ThreadPool::StealBlock(int thread) {
+	// Shares only ever shrink, so once all of them look empty nothing is left
+	while (true) {
+		int victim = -1;
+		uint32_t most = 0;
+		for (int t = 0; t < (int)queues_.size(); t++) {
+			uint64_t current = queues_[t].range.load();
+			uint32_t head = current >> 32;
+			uint32_t tail = (uint32_t)current;
+			if (t != thread && tail > head && tail - head > most) {
+				victim = t;
+				most = tail - head;
+			}
+		}
+		if (victim < 0) {
+			return -1;
+		}
+		// Taking from the tail keeps away from the blocks the owner is on
+		std::atomic<uint64_t>& range = queues_[victim].range;
+		uint64_t current = range.load();
+		uint32_t head = current >> 32;
+		uint32_t tail = (uint32_t)current;
+		if (head < tail &&
+				range.compare_exchange_weak(current, ((uint64_t)head << 32) | (tail - 1))) {
+			steals_++;
+			return tail - 1;
+		}
+	}
+}
+
+}  // namespace GLOO
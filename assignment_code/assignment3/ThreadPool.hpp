@@ -0,0 +1,159 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+namespace GLOO {
+
+// A fixed set of worker threads that are started once and then reused for
+// every parallel loop of the simulation. The thread calling ParallelFor
+// takes part in the work, so a pool of n threads has n-1 workers.
+class ThreadPool {
+ public:
+	explicit ThreadPool(int num_threads = 1);
+	~ThreadPool();
+
+	// The pool shared by the whole simulation
+	static ThreadPool& GetInstance();
+
+	// Stops the current workers and starts num_threads-1 new ones
+	void SetNumThreads(int num_threads);
+	int GetNumThreads() const { return (int)workers_.size() + 1; }
+
+	// Calls f(chunk_begin, chunk_end) on disjoint chunks covering
+	// [begin, end) in parallel and returns once all of them are done. Chunks
+	// hold at least grain indices. Calls from inside a parallel loop run
+	// serially on the calling thread. f is called through a plain function
+	// pointer rather than a std::function, so starting a loop never allocates.
+	template <class F>
+	void ParallelFor(int begin, int end, const F& f, int grain = 1) {
+		RunLoop(begin, end, &CallChunk<F>, &f, grain);
+	}
+
+	// Calls f(block, block_begin, block_end) for every block
+	// [bounds[block], bounds[block+1]) in parallel and returns once all of
+	// them are done. Each thread starts on its own contiguous share of the
+	// blocks and, once that is used up, steals blocks from the end of the
+	// share with the most left, so blocks of very different cost still
+	// balance out. Calls from inside a parallel loop run serially.
+	template <class F>
+	void ParallelForBlocks(const std::vector<int>& bounds, const F& f) {
+		auto call = [&](int block) { f(block, bounds[block], bounds[block+1]); };
+		RunBlocks((int)bounds.size() - 1, &CallBlock<decltype(call)>, &call);
+	}
+	// Blocks that ran on another thread than the one they were assigned to
+	int GetNumSteals() const { return steals_; }
+
+	// Returns the sum of f(chunk_begin, chunk_end) over disjoint chunks
+	// covering [begin, end). Floating point sums depend on where the chunks
+	// are cut and the order they are added in. Normally the chunks follow
+	// the thread count and are added as they finish. In deterministic mode
+	// every chunk is grain indices and they are added in order, so the sum
+	// comes out the same for any number of threads.
+	template <class T, class F>
+	T ParallelSum(int begin, int end, const F& f, int grain = 1) {
+		T total = T(0);
+		if (!deterministic_) {
+			std::mutex sum_mutex;
+			ParallelFor(begin, end, [&](int chunk_begin, int chunk_end) {
+				T chunk_sum = f(chunk_begin, chunk_end);
+				std::lock_guard<std::mutex> lock(sum_mutex);
+				total += chunk_sum;
+			}, grain);
+			return total;
+		}
+		if (end <= begin) {
+			return total;
+		}
+		grain = std::max(1, grain);
+		std::vector<T> chunk_sums((end - begin + grain - 1) / grain);
+		ParallelFor(0, chunk_sums.size(), [&](int first, int last) {
+			for (int c = first; c < last; c++) {
+				int chunk_begin = begin + c * grain;
+				chunk_sums[c] = f(chunk_begin, std::min(end, chunk_begin + grain));
+			}
+		});
+		for (const T& chunk_sum : chunk_sums) {
+			total += chunk_sum;
+		}
+		return total;
+	}
+
+	// Whether results have to be reproducible bit for bit for any number of
+	// threads, which ParallelSum needs to know
+	void SetDeterministic(bool deterministic) { deterministic_ = deterministic; }
+	bool IsDeterministic() const { return deterministic_; }
+
+ private:
+	typedef void (*ChunkFunction)(const void* context, int begin, int end);
+
+	template <class F>
+	static void CallChunk(const void* context, int begin, int end) {
+		(*static_cast<const F*>(context))(begin, end);
+	}
+
+	typedef void (*BlockFunction)(const void* context, int block);
+
+	template <class F>
+	static void CallBlock(const void* context, int block) {
+		(*static_cast<const F*>(context))(block);
+	}
+
+	void RunLoop(int begin, int end, ChunkFunction f, const void* context,
+							 int grain);
+	void RunBlocks(int num_blocks, BlockFunction f, const void* context);
+	void StartWorkers(int num_workers);
+	void StopWorkers();
+	// Thread 0 is the one calling the loops, workers are 1 and up
+	void WorkerLoop(int thread);
+	// Runs chunks of the current loop until there are none left
+	void RunChunks();
+	// Runs the blocks of thread's share, then steals until none are left
+	void RunShare(int thread);
+	// Next block of thread's share, or -1 once it is used up
+	int PopBlock(int thread);
+	// Last block of the largest share of another thread, or -1
+	int StealBlock(int thread);
+
+	// A share of blocks, [head, tail) packed into one word so that the owner
+	// taking from the head and a thief taking from the tail can't both get
+	// the last block. Padded to a cache line so owners don't contend.
+	struct BlockQueue {
+		std::atomic<uint64_t> range;
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable work_ready_;
+	std::condition_variable work_done_;
+
+	// The current loop, only changed while no worker is inside RunChunks
+	ChunkFunction job_ = nullptr;
+	BlockFunction block_job_ = nullptr;
+	const void* job_context_ = nullptr;
+	int job_begin_ = 0;
+	int job_end_ = 0;
+	int chunk_size_ = 1;
+	int num_chunks_ = 0;
+	std::atomic<int> next_chunk_;
+	std::atomic<int> finished_chunks_;
+	// One share per thread, the blocks are counted in the chunk counters
+	std::vector<BlockQueue> queues_;
+	std::atomic<int> steals_;
+	// Workers currently inside RunChunks
+	int active_workers_ = 0;
+	// Incremented for every loop, so sleeping workers can tell there is work
+	unsigned int generation_ = 0;
+	bool stop_ = false;
+	bool deterministic_ = false;
+};
+}  // namespace GLOO
+
+#endif
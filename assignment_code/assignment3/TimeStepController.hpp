@@ -0,0 +1,89 @@
+#ifndef TIME_STEP_CONTROLLER_H_
+#define TIME_STEP_CONTROLLER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "ParticleSystemBase.hpp"
+#include "ParticleState.hpp"
+
+namespace GLOO {
+// Picks the time step of every integration step from the current state:
+//   CFL:       dt <= cfl * h / max |v|
+//   force:     dt <= force * sqrt(h / max |a|)
+//   viscosity: dt <= viscosity * h^2 / nu
+// and clamps the smallest of them to [min_dt, max_dt].
+class TimeStepController {
+ public:
+  TimeStepController(float min_dt = 1e-4f, float max_dt = 1e-2f) {
+    SetBounds(min_dt, max_dt);
+  }
+
+  void SetBounds(float min_dt, float max_dt) {
+    min_dt_ = std::max(0.f, std::min(min_dt, max_dt));
+    max_dt_ = std::max(min_dt, max_dt);
+    dt_ = max_dt_;
+  }
+  float GetMinTimeStep() const {
+    return min_dt_;
+  }
+  float GetMaxTimeStep() const {
+    return max_dt_;
+  }
+
+  // Accelerations are taken from the last ComputeTimeDerivative of system,
+  // which is the end of the previous step.
+  float ComputeTimeStep(const ParticleSystemBase& system, const ParticleState& state) {
+    float h = system.GetSmoothingLength();
+    float dt = std::numeric_limits<float>::infinity();
+    if (h > 0.f) {
+      max_speed_ = ComputeMaxSpeed(state);
+      if (max_speed_ > 0.f) {
+        dt = std::min(dt, cfl_factor_ * h / max_speed_);
+      }
+      float max_acceleration = system.GetMaxAcceleration();
+      if (max_acceleration > 0.f) {
+        dt = std::min(dt, force_factor_ * std::sqrt(h / max_acceleration));
+      }
+      float nu = system.GetKinematicViscosity();
+      if (nu > 0.f) {
+        dt = std::min(dt, viscosity_factor_ * h * h / nu);
+      }
+    }
+    dt_ = std::max(min_dt_, std::min(dt, max_dt_));
+    return dt_;
+  }
+
+  // The step chosen by the last ComputeTimeStep and the speed it was based on
+  float GetTimeStep() const {
+    return dt_;
+  }
+  float GetMaxSpeed() const {
+    return max_speed_;
+  }
+
+ private:
+  static float ComputeMaxSpeed(const ParticleState& state) {
+    const float* vx = state.velocities.x();
+    const float* vy = state.velocities.y();
+    const float* vz = state.velocities.z();
+    float max_sq = 0.f;
+    for (size_t i = 0; i < state.velocities.size(); i++) {
+      max_sq = std::max(max_sq, vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+    }
+    return std::sqrt(max_sq);
+  }
+
+  float cfl_factor_ = 0.4f;
+  float force_factor_ = 0.25f;
+  float viscosity_factor_ = 0.125f;
+
+  float min_dt_;
+  float max_dt_;
+  float dt_;
+  float max_speed_ = 0.f;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <vector>
+
+namespace GLOO {
+
+// Moves messages between the processes of a distributed run. Each process
+// has a rank from 0 to GetNumRanks()-1.
+class Transport {
+ public:
+	virtual ~Transport() {}
+
+	virtual int GetRank() const = 0;
+	virtual int GetNumRanks() const = 0;
+
+	// Sends send to peer and returns what peer sent in its matching call in
+	// receive. Both directions make progress at once, so two processes
+	// exchanging with each other never wait on one another. A process that
+	// exchanges with several peers goes through them in increasing rank
+	// order, which keeps any number of processes from deadlocking.
+	virtual void Exchange(int peer, const std::vector<char>& send,
+												std::vector<char>& receive) = 0;
+};
+}  // namespace GLOO
+
+#endif
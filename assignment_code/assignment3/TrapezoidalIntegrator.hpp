@@ -0,0 +1,27 @@
+#ifndef TRAPEZOIDAL_INTEGRATOR_H_
+#define TRAPEZOIDAL_INTEGRATOR_H_
+
+#include "IntegratorBase.hpp"
+
+namespace GLOO {
+template <class TSystem, class TState>
+class TrapezoidalIntegrator : public IntegratorBase<TSystem, TState> {
+  void Step(TSystem& system,
+            TState& state,
+            float start_time,
+            float dt) override {
+    system.ComputeTimeDerivative(state, start_time, f_0_);
+    stage_ = state + dt * f_0_;
+    system.ComputeTimeDerivative(stage_, start_time + dt, f_1_);
+    state += (dt / 2.f) * (f_0_ + f_1_);
+    this->ApplyBoundary(state);
+  }
+
+  TState f_0_;
+  TState f_1_;
+  // The forward Euler prediction f_1_ is evaluated at
+  TState stage_;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRIANGLE_GEOMETRY_H_
+#define TRIANGLE_GEOMETRY_H_
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+// Closest point to p on the triangle abc, from Ericson's Real-Time Collision
+// Detection, 5.1.5.
+inline glm::vec3 ClosestPointOnTriangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+  glm::vec3 ab = b - a;
+  glm::vec3 ac = c - a;
+  glm::vec3 ap = p - a;
+  float d1 = glm::dot(ab, ap);
+  float d2 = glm::dot(ac, ap);
+  if (d1 <= 0.f && d2 <= 0.f) {
+    return a;
+  }
+  glm::vec3 bp = p - b;
+  float d3 = glm::dot(ab, bp);
+  float d4 = glm::dot(ac, bp);
+  if (d3 >= 0.f && d4 <= d3) {
+    return b;
+  }
+  float vc = d1*d4 - d3*d2;
+  if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+    return a + ab * (d1 / (d1 - d3));
+  }
+  glm::vec3 cp = p - c;
+  float d5 = glm::dot(ab, cp);
+  float d6 = glm::dot(ac, cp);
+  if (d6 >= 0.f && d5 <= d6) {
+    return c;
+  }
+  float vb = d5*d2 - d1*d6;
+  if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+    return a + ac * (d2 / (d2 - d6));
+  }
+  float va = d3*d6 - d5*d4;
+  if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) {
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  float denom = 1.f / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,138 @@
+#include "TriangleMeshBoundary.hpp"
+#include "TriangleGeometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace GLOO {
+
+TriangleMeshBoundary::TriangleMeshBoundary(const PositionArray& positions,
+                                           const IndexArray& indices,
+                                           float thickness,
+                                           float restitution)
+    : thickness_(thickness), restitution_(restitution) {
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(-std::numeric_limits<float>::max());
+  float total_edge = 0.f;
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    Triangle tri;
+    tri.a = positions[indices[t]];
+    tri.b = positions[indices[t+1]];
+    tri.c = positions[indices[t+2]];
+    glm::vec3 n = glm::cross(tri.b - tri.a, tri.c - tri.a);
+    float area = glm::length(n);
+    if (area == 0.f) {
+      // Degenerate triangles can't be hit
+      continue;
+    }
+    tri.normal = n / area;
+    triangles_.push_back(tri);
+    lo = glm::min(lo, glm::min(tri.a, glm::min(tri.b, tri.c)));
+    hi = glm::max(hi, glm::max(tri.a, glm::max(tri.b, tri.c)));
+    total_edge += glm::length(tri.b - tri.a) + glm::length(tri.c - tri.b) + glm::length(tri.a - tri.c);
+  }
+  if (triangles_.empty()) {
+    origin_ = glm::vec3(0.f);
+    cell_size_ = 1.f;
+    resolution_ = glm::ivec3(1);
+    cell_start_.assign(2, 0);
+    return;
+  }
+
+  // Cells about as large as the average edge, but not so many that the
+  // grid dwarfs the mesh
+  lo -= glm::vec3(thickness_);
+  hi += glm::vec3(thickness_);
+  glm::vec3 extent = hi - lo;
+  cell_size_ = std::max(total_edge / (3.f * triangles_.size()), 2.f * thickness_);
+  float max_cells = 128.f;
+  cell_size_ = std::max(cell_size_, std::max(extent.x, std::max(extent.y, extent.z)) / max_cells);
+  origin_ = lo;
+  resolution_ = glm::max(glm::ivec3(glm::ceil(extent / cell_size_)), glm::ivec3(1));
+
+  // Count, prefix sum and fill, as in NeighborGrid::Build
+  int num_cells = resolution_.x * resolution_.y * resolution_.z;
+  std::vector<int> count(num_cells, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t t = 0; t < triangles_.size(); t++) {
+      const Triangle& tri = triangles_[t];
+      glm::vec3 t_lo = glm::min(tri.a, glm::min(tri.b, tri.c)) - thickness_;
+      glm::vec3 t_hi = glm::max(tri.a, glm::max(tri.b, tri.c)) + thickness_;
+      glm::ivec3 c_lo = GetCell(t_lo);
+      glm::ivec3 c_hi = GetCell(t_hi);
+      for (int x = c_lo.x; x <= c_hi.x; x++) {
+        for (int y = c_lo.y; y <= c_hi.y; y++) {
+          for (int z = c_lo.z; z <= c_hi.z; z++) {
+            int c = GetCellIndex(glm::ivec3(x, y, z));
+            if (pass == 0) {
+              count[c]++;
+            } else {
+              cell_triangles_[cell_start_[c] + count[c]++] = t;
+            }
+          }
+        }
+      }
+    }
+    if (pass == 0) {
+      cell_start_.assign(num_cells + 1, 0);
+      for (int c = 0; c < num_cells; c++) {
+        cell_start_[c+1] = cell_start_[c] + count[c];
+      }
+      cell_triangles_.resize(cell_start_[num_cells]);
+      count.assign(num_cells, 0);
+    }
+  }
+}
+
+glm::ivec3 TriangleMeshBoundary::GetCell(glm::vec3 p) const {
+  glm::ivec3 cell = glm::ivec3(glm::floor((p - origin_) / cell_size_));
+  return glm::clamp(cell, glm::ivec3(0), resolution_ - 1);
+}
+
+int TriangleMeshBoundary::GetCellIndex(glm::ivec3 cell) const {
+  return (cell.x*resolution_.y + cell.y)*resolution_.z + cell.z;
+}
+
+void TriangleMeshBoundary::Apply(ParticleState& state, size_t begin, size_t end) const {
+  glm::vec3 grid_hi = origin_ + glm::vec3(resolution_) * cell_size_;
+  for (size_t i = begin; i < end; i++) {
+    glm::vec3 p = state.positions[i];
+    if (glm::any(glm::lessThan(p, origin_)) || glm::any(glm::greaterThan(p, grid_hi))) {
+      // Too far from every triangle
+      continue;
+    }
+
+    // The closest point on the nearby triangles
+    int c = GetCellIndex(GetCell(p));
+    float best_d2 = thickness_ * thickness_;
+    int best = -1;
+    glm::vec3 best_q;
+    for (int k = cell_start_[c]; k < cell_start_[c+1]; k++) {
+      const Triangle& tri = triangles_[cell_triangles_[k]];
+      glm::vec3 q = ClosestPointOnTriangle(p, tri.a, tri.b, tri.c);
+      glm::vec3 d = p - q;
+      float d2 = glm::dot(d, d);
+      if (d2 < best_d2) {
+        best_d2 = d2;
+        best = cell_triangles_[k];
+        best_q = q;
+      }
+    }
+    if (best < 0) {
+      continue;
+    }
+
+    // Push the particle out to thickness along the direction it came from
+    float d = std::sqrt(best_d2);
+    glm::vec3 n = d > 1e-6f ? (p - best_q) / d : triangles_[best].normal;
+    state.positions[i] = best_q + n * thickness_;
+    glm::vec3 v = state.velocities[i];
+    float vn = glm::dot(v, n);
+    if (vn < 0.f) {
+      state.velocities[i] = v - (1.f + restitution_) * vn * n;
+    }
+  }
+}
+
+}  // namespace GLOO
@@ -0,0 +1,52 @@
+#ifndef TRIANGLE_MESH_BOUNDARY_H_
+#define TRIANGLE_MESH_BOUNDARY_H_
+
+#include "gloo/alias_types.hpp"
+
+#include "BoundaryBase.hpp"
+
+namespace GLOO {
+// Keeps the particles at least thickness away from the triangles of a mesh,
+// on whichever side they are. Works for open meshes too, as long as no
+// particle moves more than thickness in one step. The triangles are binned
+// into a uniform grid so that each particle only tests the ones nearby.
+class TriangleMeshBoundary : public BoundaryBase {
+ public:
+  // positions are in simulation space, indices hold three per triangle
+  TriangleMeshBoundary(const PositionArray& positions,
+                       const IndexArray& indices,
+                       float thickness = 0.02f,
+                       float restitution = 0.3f);
+
+  void Apply(ParticleState& state, size_t begin, size_t end) const override;
+
+  size_t GetNumTriangles() const {
+    return triangles_.size();
+  }
+
+ private:
+  struct Triangle {
+    glm::vec3 a;
+    glm::vec3 b;
+    glm::vec3 c;
+    glm::vec3 normal;
+  };
+
+  glm::ivec3 GetCell(glm::vec3 p) const;
+  int GetCellIndex(glm::ivec3 cell) const;
+
+  std::vector<Triangle> triangles_;
+  float thickness_;
+  float restitution_;
+
+  // Every cell lists the triangles whose bounds, grown by thickness_,
+  // overlap it: cell_triangles_[cell_start_[c] .. cell_start_[c+1])
+  glm::vec3 origin_;
+  float cell_size_;
+  glm::ivec3 resolution_;
+  std::vector<int> cell_start_;
+  std::vector<int> cell_triangles_;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef VEC3_ARRAY_H_
+#define VEC3_ARRAY_H_
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "AlignedAllocator.hpp"
+#include "ThreadPool.hpp"
+
+namespace GLOO {
+// Number of floats every component array is padded to. 16 floats are one
+// AVX-512 register, two AVX2 registers and one 64 byte cache line.
+const static size_t kSimdWidth = 16;
+
+typedef std::vector<float, AlignedAllocator<float, 64>> AlignedFloatArray;
+
+// Calls f(begin, end) in parallel on chunks of [0, padded_size). Chunk bounds
+// are multiples of kSimdWidth, so every chunk vectorizes without remainder.
+template <class F>
+void ParallelForPadded(size_t padded_size, const F& f) {
+  const int kMinBlocks = 256;
+  ThreadPool::GetInstance().ParallelFor(
+      0, padded_size / kSimdWidth,
+      [&](int begin, int end) { f(begin * kSimdWidth, end * kSimdWidth); },
+      kMinBlocks);
+}
+
+// Writable reference to element i of a Vec3Array, so that code written
+// against std::vector<glm::vec3> keeps working.
+struct Vec3Ref {
+  float& x;
+  float& y;
+  float& z;
+
+  operator glm::vec3() const {
+    return glm::vec3(x, y, z);
+  }
+  Vec3Ref& operator=(const glm::vec3& v) {
+    x = v.x;
+    y = v.y;
+    z = v.z;
+    return *this;
+  }
+  Vec3Ref& operator=(const Vec3Ref& v) {
+    return *this = glm::vec3(v);
+  }
+  Vec3Ref& operator+=(const glm::vec3& v) {
+    return *this = glm::vec3(*this) + v;
+  }
+  Vec3Ref& operator-=(const glm::vec3& v) {
+    return *this = glm::vec3(*this) - v;
+  }
+  Vec3Ref& operator*=(float k) {
+    return *this = glm::vec3(*this) * k;
+  }
+};
+
+// An array of 3D vectors stored as separate x, y and z float arrays
+// (structure of arrays). Each array is 64 byte aligned and padded with
+// zeros up to a multiple of kSimdWidth, so loops over GetPaddedSize()
+// elements vectorize without a remainder loop.
+class Vec3Array {
+ public:
+  Vec3Array() {
+  }
+  Vec3Array(const std::vector<glm::vec3>& values) {
+    for (const glm::vec3& v : values) {
+      push_back(v);
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  size_t GetPaddedSize() const {
+    return x_.size();
+  }
+
+  glm::vec3 operator[](size_t i) const {
+    return glm::vec3(x_[i], y_[i], z_[i]);
+  }
+  Vec3Ref operator[](size_t i) {
+    return Vec3Ref{x_[i], y_[i], z_[i]};
+  }
+
+  float* x() {
+    return x_.data();
+  }
+  float* y() {
+    return y_.data();
+  }
+  float* z() {
+    return z_.data();
+  }
+  const float* x() const {
+    return x_.data();
+  }
+  const float* y() const {
+    return y_.data();
+  }
+  const float* z() const {
+    return z_.data();
+  }
+  float* component(int axis) {
+    return axis == 0 ? x() : (axis == 1 ? y() : z());
+  }
+  const float* component(int axis) const {
+    return axis == 0 ? x() : (axis == 1 ? y() : z());
+  }
+
+  void resize(size_t n) {
+    size_t padded = (n + kSimdWidth - 1) / kSimdWidth * kSimdWidth;
+    // Clear the elements that become padding, growing fills with zeros.
+    for (size_t i = n; i < std::min(size_, padded); i++) {
+      x_[i] = y_[i] = z_[i] = 0.f;
+    }
+    x_.resize(padded, 0.f);
+    y_.resize(padded, 0.f);
+    z_.resize(padded, 0.f);
+    size_ = n;
+  }
+  void reserve(size_t n) {
+    x_.reserve(n + kSimdWidth);
+    y_.reserve(n + kSimdWidth);
+    z_.reserve(n + kSimdWidth);
+  }
+  void clear() {
+    resize(0);
+  }
+  void push_back(const glm::vec3& v) {
+    resize(size_ + 1);
+    (*this)[size_ - 1] = v;
+  }
+
+  // Moves element order[k] into slot k
+  void Permute(const std::vector<int>& order) {
+    Vec3Array permuted;
+    permuted.resize(order.size());
+    for (size_t k = 0; k < order.size(); k++) {
+      permuted.x_[k] = x_[order[k]];
+      permuted.y_[k] = y_[order[k]];
+      permuted.z_[k] = z_[order[k]];
+    }
+    *this = std::move(permuted);
+  }
+
+  // Copies the values out as an array of structures, for code such as the
+  // renderer that needs contiguous glm::vec3s.
+  std::vector<glm::vec3> ToVector() const {
+    std::vector<glm::vec3> values(size_);
+    for (size_t i = 0; i < size_; i++) {
+      values[i] = (*this)[i];
+    }
+    return values;
+  }
+
+ private:
+  AlignedFloatArray x_;
+  AlignedFloatArray y_;
+  AlignedFloatArray z_;
+  size_t size_ = 0;
+};
+}  // namespace GLOO
+
+#endif
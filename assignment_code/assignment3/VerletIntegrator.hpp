@@ -0,0 +1,76 @@
+#ifndef VERLET_INTEGRATOR_H_
+#define VERLET_INTEGRATOR_H_
+
+#include "IntegratorBase.hpp"
+
+namespace GLOO {
+// Velocity Verlet in kick-drift-kick (leapfrog) form. The accelerations at
+// the end of a step are kept for the first kick of the next one, so each
+// step costs a single ComputeTimeDerivative.
+template <class TSystem, class TState>
+class VerletIntegrator : public IntegratorBase<TSystem, TState> {
+ public:
+  void OnParticlesPermuted(const std::vector<int>& order) override {
+    if (derivative_.velocities.size() == order.size()) {
+      derivative_.Permute(order);
+    }
+  }
+
+  void OnParticlesMigrated() override {
+    // Recomputed by the next step
+    derivative_valid_ = false;
+  }
+
+ private:
+  void Step(TSystem& system,
+            TState& state,
+            float start_time,
+            float dt) override {
+    // Particles were added or migrated (or this is the first step), start
+    // over. A process left without particles still has to evaluate, the
+    // others wait for its ghosts.
+    if (!derivative_valid_ ||
+        derivative_.velocities.size() != state.positions.size()) {
+      system.ComputeTimeDerivative(state, start_time, derivative_);
+      derivative_valid_ = true;
+    }
+
+    // Half kick and drift. The velocity at the half step also feeds the
+    // viscosity term of the force evaluation.
+    Kick(state, dt / 2.f);
+    ParallelForPadded(state.positions.GetPaddedSize(), [&](size_t begin, size_t end) {
+      for (int axis = 0; axis < 3; axis++) {
+        float* __restrict p = state.positions.component(axis);
+        const float* __restrict v = state.velocities.component(axis);
+        for (size_t i = begin; i < end; i++) {
+          p[i] += dt * v[i];
+        }
+      }
+    });
+    this->ApplyBoundary(state);
+
+    system.ComputeTimeDerivative(state, start_time + dt, derivative_);
+    Kick(state, dt / 2.f);
+  }
+
+  // Adds h times the accelerations in derivative_ to the velocities
+  void Kick(TState& state, float h) const {
+    ParallelForPadded(state.velocities.GetPaddedSize(), [&](size_t begin, size_t end) {
+      for (int axis = 0; axis < 3; axis++) {
+        float* __restrict v = state.velocities.component(axis);
+        const float* __restrict a = derivative_.velocities.component(axis);
+        for (size_t i = begin; i < end; i++) {
+          v[i] += h * a[i];
+        }
+      }
+    });
+  }
+
+  // The derivative at the end of the last step. Only its accelerations
+  // (the velocities part) are used.
+  TState derivative_;
+  bool derivative_valid_ = false;
+};
+}  // namespace GLOO
+
+#endif
@@ -1,124 +1,575 @@
 #include "WaterSystem.hpp"
+#include "ThreadPool.hpp"
+#include "MortonOrder.hpp"
 #include <iostream>
 #include <math.h>
 #include <algorithm>
 #include <chrono>
+#include <mutex>
 
 namespace GLOO {
 
-WaterSystem::WaterSystem() {
+namespace {
+// Constants of the vectorized kernels, which only implement the Müller
+// kernels. Returns false for the other policies.
+template <class TKernels>
+bool GetSimdKernelParams(SphKernelParams& params) {
+	return false;
+}
+
+template <>
+bool GetSimdKernelParams<MullerKernels>(SphKernelParams& params) {
+	params = {H, HSQ, MASS, MullerKernels::kPoly6, MullerKernels::kSpikyGrad,
+						MullerKernels::kViscLap, VISC};
+	return true;
+}
+}
+
+template <class TKernels>
+BasicWaterSystem<TKernels>::BasicWaterSystem() {
 	// Initialize the grid data structure
-	int grid_width = (int) (box_width_/grid_cell_width_);
-	int grid_height = (int) (box_height_/grid_cell_height_);
-	for (int x = 0; x < grid_width; x++) {
-		grid_.push_back(std::vector<std::vector<std::set<int>>>());
-		for (int y = 0; y < grid_height; y++) {
-			grid_[x].push_back(std::vector<std::set<int>>());
-			for (int z = 0; z < grid_width; z++) {
-				grid_[x][y].push_back(std::set<int>());
-			}
+	grid_ = NeighborGrid(BOX_MIN, BOX_SIZE, grid_cell_size_);
+	hash_ = SpatialHash(grid_cell_size_);
+}
+
+template <class TKernels>
+ParticleState BasicWaterSystem<TKernels>::ComputeTimeDerivative(const ParticleState& state,
+                                                    float time) {
+	ParticleState gradient;
+	ComputeTimeDerivative(state, time, gradient);
+	return gradient;
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::ComputeTimeDerivative(const ParticleState& owned,
+																				float time,
+																				ParticleState& gradient) {
+	// With a domain the owned particles come first, followed by the ghosts.
+	// The ghosts change every step, so neighbor lists can't be kept.
+	if (domain_) {
+		domain_->ExchangeGhosts(owned, halo_state_);
+		neighbors_.Invalidate();
+	}
+	const ParticleState& state = domain_ ? halo_state_ : owned;
+	int n = owned.positions.size();
+
+	// Scratch buffers that keep their capacity between calls
+	std::vector<float>& pressures = pressures_;
+	std::vector<float>& rhos = rhos_;
+	std::vector<glm::vec3>& forces = forces_;
+	if (simd_level_ != SimdLevel::Scalar) {
+		BinParticles(state);
+	} else {
+		UpdateNeighbors(state);
+	}
+	// The pair passes run on one thread, there is nothing to split
+	bool partitioned = use_sfc_partitioning_ && !UsePairwisePasses();
+	if (partitioned) {
+		UpdatePartitions();
+	}
+	if (simd_level_ != SimdLevel::Scalar) {
+		CalculateVectorized(state, pressures, rhos, forces);
+	} else if (UsePairwisePasses()) {
+		CalculatePressurePairwise(state, pressures, rhos);
+		CalculateForcesPairwise(state, pressures, rhos, forces);
+	} else {
+		CalculatePressure(state, pressures, rhos);
+		CalculateForces(state, pressures, rhos, forces);
+	}
+	if (partitioned && ++evaluations_since_rebalance_ >= rebalance_interval_) {
+		RebalancePartitions();
+		evaluations_since_rebalance_ = 0;
+	}
+
+	gradient.positions = owned.velocities;
+	gradient.velocities.resize(n);
+	float max_acceleration_sq = 0.f;
+	std::mutex max_mutex;
+	ThreadPool::GetInstance().ParallelFor(0, n, [&](int begin, int end) {
+		float chunk_max = 0.f;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 a = forces[i]/rhos[i];
+			gradient.velocities[i] = a;
+			chunk_max = std::max(chunk_max, glm::dot(a, a));
 		}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		max_acceleration_sq = std::max(max_acceleration_sq, chunk_max);
+	}, kParticleGrain);
+	max_acceleration_ = sqrt(max_acceleration_sq);
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::SetDomain(std::shared_ptr<SlabDecomposition> domain) {
+	domain_ = domain;
+	neighbors_.Invalidate();
+	grid_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::OnParticlesPermuted(const std::vector<int>& order) {
+	neighbors_.Invalidate();
+	grid_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UseNeighborLists(bool enabled, float skin) {
+	use_neighbor_lists_ = enabled;
+	skin_ = std::max(0.f, std::min(skin, grid_cell_size_ - H));
+	if (enabled) {
+		simd_level_ = SimdLevel::Scalar;
 	}
-	
-	grid_width_ = grid_width;
-	grid_height_ = grid_height;
+	neighbors_.Invalidate();
 }
 
-ParticleState WaterSystem::ComputeTimeDerivative(const ParticleState& state,
-                                                    float time) {
-	// Reset the grid
-	for (int x = 0; x < grid_.size(); x++) {
-		for (int y = 0; y < grid_[0].size(); y++) {
-			for (int z = 0; z < grid_[0][0].size(); z++) {
-				grid_[x][y][z].clear();
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UseSymmetricPairs(bool enabled) {
+	use_symmetric_pairs_ = enabled;
+	if (enabled) {
+		simd_level_ = SimdLevel::Scalar;
+	}
+	neighbors_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UseSpatialHash(bool enabled) {
+	use_spatial_hash_ = enabled;
+	neighbors_.Invalidate();
+	grid_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UseIncrementalRebinning(bool enabled, float rebuild_fraction) {
+	use_incremental_rebinning_ = enabled;
+	grid_.SetRebuildFraction(rebuild_fraction);
+	grid_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UseSfcPartitioning(bool enabled, int rebalance_interval) {
+	use_sfc_partitioning_ = enabled;
+	rebalance_interval_ = std::max(1, rebalance_interval);
+	evaluations_since_rebalance_ = 0;
+	partition_cuts_.clear();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::SetSimdLevel(SimdLevel level) {
+	SphKernelParams params;
+	SimdLevel supported = GetSimdKernelParams<TKernels>(params) ? DetectSimdLevel() : SimdLevel::Scalar;
+	simd_level_ = (int)level > (int)supported ? supported : level;
+	if (simd_level_ != SimdLevel::Scalar) {
+		use_neighbor_lists_ = false;
+		use_symmetric_pairs_ = false;
+	}
+	neighbors_.Invalidate();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UpdateNeighbors(const ParticleState& state) {
+	if (!use_neighbor_lists_) {
+		// Assign each particle to it's respective grid cell
+		BinParticles(state);
+		return;
+	}
+	// Pairs need half lists, the per-particle passes full ones
+	bool half = UsePairwisePasses();
+	if (neighbors_.IsHalf() != half || neighbors_.NeedsRebuild(state.positions)) {
+		BinParticles(state);
+		if (use_spatial_hash_) {
+			neighbors_.Build(hash_, state.positions, H, skin_, half);
+		} else {
+			neighbors_.Build(grid_, state.positions, H, skin_, half);
+		}
+	}
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::BinParticles(const ParticleState& state) {
+	if (use_spatial_hash_) {
+		hash_.Build(state.positions);
+	} else if (use_incremental_rebinning_) {
+		grid_.Update(state.positions);
+	} else {
+		grid_.Build(state.positions);
+	}
+	UpdateCellBlocks();
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UpdateCellBlocks() {
+	const std::vector<int>& starts = use_spatial_hash_ ? hash_.GetCellStarts() : grid_.GetCellStarts();
+	const std::vector<int>& counts = use_spatial_hash_ ? hash_.GetCellCounts() : grid_.GetCellCounts();
+	int num_cells = starts.size();
+	int n = num_cells > 0 ? starts[num_cells-1] + counts[num_cells-1] : 0;
+	int num_blocks = ThreadPool::GetInstance().GetNumThreads() * kBlocksPerThread;
+	int target = std::max(kParticleGrain, n / num_blocks);
+	cell_blocks_.assign(1, 0);
+	particle_blocks_.assign(1, 0);
+	// Cells are never split, so a single crowded cell is a block of its own
+	int block_count = 0;
+	for (int c = 0; c < num_cells; c++) {
+		block_count += counts[c];
+		if (block_count >= target || c == num_cells - 1) {
+			cell_blocks_.push_back(c + 1);
+			particle_blocks_.push_back(starts[c] + counts[c]);
+			block_count = 0;
+		}
+	}
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::UpdatePartitions() {
+	const std::vector<int>& counts = use_spatial_hash_ ? hash_.GetCellCounts() : grid_.GetCellCounts();
+	// Biased like the keys of the spatial hash, so both structures put their
+	// cells on the same curve. z goes into the lowest bits, which keeps the
+	// pairs of cells adjacent in memory together.
+	const int bias = 1 << 20;
+	sfc_cells_.clear();
+	for (int c = 0; c < (int)counts.size(); c++) {
+		if (counts[c] == 0) {
+			continue;
+		}
+		glm::ivec3 cell = use_spatial_hash_ ? hash_.GetCellCoordinates(c) : grid_.GetCellCoordinates(c);
+		sfc_cells_.push_back(std::make_pair(MortonEncode64(cell.z + bias, cell.y + bias, cell.x + bias), c));
+	}
+	std::sort(sfc_cells_.begin(), sfc_cells_.end());
+
+	// One piece per thread, starting out with the same particle counts
+	int num_partitions = ThreadPool::GetInstance().GetNumThreads();
+	if ((int)partition_cuts_.size() != num_partitions + 1) {
+		partition_cuts_.assign(num_partitions + 1, 0);
+		partition_cuts_.back() = ~0ull;
+		CutPartitions(std::vector<double>(num_partitions, 1.0));
+		partition_times_.assign(num_partitions, 0.0);
+		partition_particles_.assign(num_partitions, 0.0);
+		evaluations_since_rebalance_ = 0;
+	}
+
+	partition_runs_.assign(1, 0);
+	partition_sizes_.assign(num_partitions, 0);
+	sfc_runs_.clear();
+	int k = 0;
+	for (int p = 0; p < num_partitions; p++) {
+		for (; k < (int)sfc_cells_.size() && sfc_cells_[k].first < partition_cuts_[p+1]; k++) {
+			int c = sfc_cells_[k].second;
+			if ((int)sfc_runs_.size() > partition_runs_.back() && sfc_runs_.back().y == c) {
+				sfc_runs_.back().y++;
+			} else {
+				sfc_runs_.push_back(glm::ivec2(c, c + 1));
 			}
+			partition_sizes_[p] += counts[c];
 		}
+		partition_runs_.push_back(sfc_runs_.size());
 	}
+}
 
-	// Assign each particle to it's respective grid cell
-	for (int i = 0; i < state.positions.size(); i++) {
-		glm::vec3 cell = GetGridCell(state.positions[i]);
-		grid_[(int)cell.x][(int)cell.y][(int)cell.z].insert(i);
+template <class TKernels>
+void BasicWaterSystem<TKernels>::RebalancePartitions() {
+	int num_partitions = partition_sizes_.size();
+	double total_time = 0.0;
+	double total_particles = 0.0;
+	for (int p = 0; p < num_partitions; p++) {
+		total_time += partition_times_[p];
+		total_particles += partition_particles_[p];
 	}
-	std::vector<float> pressures;
-	std::vector<float> rhos;
-	std::vector<glm::vec3> forces;
-	CalculatePressure(state, pressures, rhos);
-	CalculateForces(state, pressures, rhos, forces);
+	// Pieces that had no particles get the mean rate
+	double mean_rate = total_particles > 0.0 && total_time > 0.0 ? total_time / total_particles : 1.0;
+	std::vector<double> rates(num_partitions, mean_rate);
+	for (int p = 0; p < num_partitions; p++) {
+		if (partition_particles_[p] > 0.0 && partition_times_[p] > 0.0) {
+			rates[p] = partition_times_[p] / partition_particles_[p];
+		}
+	}
+	CutPartitions(rates);
+	partition_times_.assign(num_partitions, 0.0);
+	partition_particles_.assign(num_partitions, 0.0);
+}
 
-	ParticleState gradient;
-	for (int i = 0; i < state.positions.size(); i++) {
-		gradient.positions.push_back(state.velocities[i]);
-		gradient.velocities.push_back(forces[i]/rhos[i]);
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CutPartitions(const std::vector<double>& rates) {
+	const std::vector<int>& counts = use_spatial_hash_ ? hash_.GetCellCounts() : grid_.GetCellCounts();
+	int num_partitions = rates.size();
+	double total = 0.0;
+	int p = 0;
+	for (const auto& cell : sfc_cells_) {
+		while (p + 1 < num_partitions && cell.first >= partition_cuts_[p+1]) {
+			p++;
+		}
+		total += counts[cell.second] * rates[p];
 	}
-	return gradient;
+
+	// Piece j starts at the first cell with at least j/num_partitions of the
+	// total cost before it
+	std::vector<uint64_t> cuts(num_partitions + 1, ~0ull);
+	cuts[0] = 0;
+	int j = 1;
+	double before = 0.0;
+	p = 0;
+	for (const auto& cell : sfc_cells_) {
+		while (p + 1 < num_partitions && cell.first >= partition_cuts_[p+1]) {
+			p++;
+		}
+		while (j < num_partitions && before >= total * j / num_partitions) {
+			cuts[j++] = cell.first;
+		}
+		before += counts[cell.second] * rates[p];
+	}
+	partition_cuts_.swap(cuts);
+}
+
+template <class TKernels>
+bool BasicWaterSystem<TKernels>::UsePairwisePasses() const {
+	// Pairs scatter into both particles, so the pairwise passes run on the
+	// calling thread whatever the size of the pool
+	return use_symmetric_pairs_;
+}
+
+template <class TKernels>
+template <class F>
+void BasicWaterSystem<TKernels>::ForEachNeighbor(const ParticleState& state, int i, F f) const {
+	if (use_neighbor_lists_) {
+		neighbors_.ForEachNeighbor(i, f);
+	} else if (use_spatial_hash_) {
+		hash_.ForEachCandidate(state.positions[i], f);
+	} else {
+		grid_.ForEachCandidate(state.positions[i], f);
+	}
+}
+
+template <class TKernels>
+template <class F>
+void BasicWaterSystem<TKernels>::ForEachPair(F f) const {
+	if (use_neighbor_lists_) {
+		neighbors_.ForEachPair(f);
+	} else if (use_spatial_hash_) {
+		hash_.ForEachPair(f);
+	} else {
+		grid_.ForEachPair(f);
+	}
+}
+
+template <class TKernels>
+template <class F>
+void BasicWaterSystem<TKernels>::ForEachPartitionRun(F f) {
+	ThreadPool::GetInstance().ParallelForBlocks(partition_runs_, [&](int p, int begin, int end) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = begin; r < end; r++) {
+			f(sfc_runs_[r].x, sfc_runs_[r].y);
+		}
+		partition_times_[p] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		partition_particles_[p] += partition_sizes_[p];
+	});
+}
+
+template <class TKernels>
+template <class F>
+void BasicWaterSystem<TKernels>::ForEachParticleBlock(F f) {
+	if (!use_sfc_partitioning_) {
+		ThreadPool::GetInstance().ParallelForBlocks(particle_blocks_, [&](int block, int begin, int end) {
+			f(begin, end);
+		});
+		return;
+	}
+	const std::vector<int>& starts = use_spatial_hash_ ? hash_.GetCellStarts() : grid_.GetCellStarts();
+	const std::vector<int>& counts = use_spatial_hash_ ? hash_.GetCellCounts() : grid_.GetCellCounts();
+	ForEachPartitionRun([&](int begin, int end) {
+		f(starts[begin], starts[end-1] + counts[end-1]);
+	});
 }
 
-void WaterSystem::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
+template <class TKernels>
+void BasicWaterSystem<TKernels>::AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity) {
   state.positions.push_back(position);
   state.velocities.push_back(velocity);
 }
 
-void WaterSystem::CalculatePressure(const ParticleState& state, std::vector<float>& pressures, std::vector<float>& rhos) const {
-	for (int i = 0; i < state.positions.size(); i++) {
-		// Get the nearby particles from the grid
-		float rho = 0.f;
-		glm::vec3 cell = GetGridCell(state.positions[i]);
-		for (int x = std::max(0,(int)cell.x-1); x < std::min(grid_width_,(int)cell.x+2); x++) {
-			for (int y = std::max(0,(int)cell.y-1); y < std::min(grid_height_,(int)cell.y+2); y++) {
-				for (int z = std::max(0,(int)cell.z-1); z < std::min(grid_width_,(int)cell.z+2); z++) {
-					for (int j : grid_[x][y][z]) {
-						glm::vec3 d = state.positions[j] - state.positions[i];
-						float d2 = pow(glm::length(d), 2.f);
-						if (d2 < HSQ) {
-							rho += MASS*POLY6*pow(HSQ-d2, 3.f);
-						}
-					}
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CalculatePressure(const ParticleState& state, std::vector<float>& pressures, std::vector<float>& rhos) {
+	pressures.resize(state.positions.size());
+	rhos.resize(state.positions.size());
+	// Visits the particles cell by cell, so neighboring particles are
+	// handled by the same thread
+	const std::vector<int>& sorted = use_spatial_hash_ ? hash_.GetSortedIndices() : grid_.GetSortedIndices();
+	ForEachParticleBlock([&](int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int i = sorted[s];
+			// Get the nearby particles from the grid
+			float rho = 0.f;
+			ForEachNeighbor(state, i, [&](int j) {
+				glm::vec3 d = state.positions[j] - state.positions[i];
+				float d2 = glm::dot(d, d);
+				if (d2 < HSQ) {
+					rho += MASS*TKernels::Density(d2);
 				}
-			}
+			});
+			pressures[i] = GAS_CONST*(rho - REST_DENS);
+			rhos[i] = rho;
 		}
-		pressures.push_back(GAS_CONST*(rho - REST_DENS));
-		rhos.push_back(rho);
-	}
-}
-
-void WaterSystem::CalculateForces(const ParticleState& state,
-																	std::vector<float> pressures, 
-																	std::vector<float> rhos, 
-																	std::vector<glm::vec3>& forces) const {
-	for (int i = 0; i < state.positions.size(); i++) {
-		
-		glm::vec3 pressure(0.f);
-		glm::vec3 visc(0.f);
-		glm::vec3 cell = GetGridCell(state.positions[i]);
-		for (int x = std::max(0,(int)cell.x-1); x < std::min(grid_width_,(int)cell.x+2); x++) {
-			for (int y = std::max(0,(int)cell.y-1); y < std::min(grid_height_,(int)cell.y+2); y++) {
-				for (int z = std::max(0,(int)cell.z-1); z < std::min(grid_width_,(int)cell.z+2); z++) {
-					for (int j : grid_[x][y][z]) {
-						if (i == j) {
-							continue;
-						}
-						glm::vec3 d_vec = state.positions[i] - state.positions[j];
-						float d = pow(glm::length(d_vec), 1.f);
-						
-						if (d < H) {
-							pressure += glm::normalize(-d_vec)*MASS*(pressures[i] + pressures[j])/(2.f * rhos[j]) * SPIKY_GRAD*pow(H-d,2.f);
-							visc += VISC*MASS*(state.velocities[j] - state.velocities[i])/rhos[j] * VISC_LAP*(H-d);
-						}
-					}
+	});
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CalculateForces(const ParticleState& state,
+																	const std::vector<float>& pressures,
+																	const std::vector<float>& rhos,
+																	std::vector<glm::vec3>& forces) {
+	forces.resize(state.positions.size());
+	const std::vector<int>& sorted = use_spatial_hash_ ? hash_.GetSortedIndices() : grid_.GetSortedIndices();
+	ForEachParticleBlock([&](int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int i = sorted[s];
+			glm::vec3 pressure(0.f);
+			glm::vec3 visc(0.f);
+			ForEachNeighbor(state, i, [&](int j) {
+				if (i == j) {
+					return;
 				}
-			}
+				glm::vec3 d_vec = state.positions[i] - state.positions[j];
+				float d = glm::length(d_vec);
+
+				// Coincident particles have no direction to push each other in,
+				// the vectorized kernels skip them as well
+				if (d < H && d > 0.f) {
+					pressure += glm::normalize(-d_vec)*MASS*(pressures[i] + pressures[j])/(2.f * rhos[j]) * TKernels::PressureGradient(d);
+					visc += VISC*MASS*(state.velocities[j] - state.velocities[i])/rhos[j] * TKernels::ViscosityLaplacian(d);
+				}
+			});
+			forces[i] = pressure + visc + GRAVITY * rhos[i];
+		}
+	});
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CalculatePressurePairwise(const ParticleState& state,
+																						std::vector<float>& pressures,
+																						std::vector<float>& rhos) {
+	// Every particle is its own neighbor at distance 0
+	rhos.assign(state.positions.size(), MASS*TKernels::Density(0.f));
+	pairs_.clear();
+	ForEachPair([&](int i, int j) {
+		glm::vec3 d = state.positions[j] - state.positions[i];
+		float d2 = glm::dot(d, d);
+		if (d2 < HSQ) {
+			float w = MASS*TKernels::Density(d2);
+			rhos[i] += w;
+			rhos[j] += w;
+			pairs_.push_back({i, j, sqrt(d2)});
 		}
-		forces.push_back(pressure + visc + GRAVITY * rhos[i]);
+	});
+
+	pressures.resize(rhos.size());
+	for (size_t i = 0; i < rhos.size(); i++) {
+		pressures[i] = GAS_CONST*(rhos[i] - REST_DENS);
+	}
+}
+
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CalculateForcesPairwise(const ParticleState& state,
+																					const std::vector<float>& pressures,
+																					const std::vector<float>& rhos,
+																					std::vector<glm::vec3>& forces) const {
+	forces.resize(rhos.size());
+	for (size_t i = 0; i < rhos.size(); i++) {
+		forces[i] = GRAVITY * rhos[i];
 	}
 
+	for (const NeighborPair& pair : pairs_) {
+		int i = pair.i;
+		int j = pair.j;
+		if (pair.d == 0.f) {
+			continue;
+		}
+		// The kernel terms are shared by both particles. Each side still divides
+		// by the density of the other one, as in CalculateForces.
+		glm::vec3 dir = (state.positions[j] - state.positions[i])/pair.d;
+		glm::vec3 pressure = dir*MASS*(pressures[i] + pressures[j])/2.f * TKernels::PressureGradient(pair.d);
+		glm::vec3 visc = VISC*MASS*(state.velocities[j] - state.velocities[i]) * TKernels::ViscosityLaplacian(pair.d);
+		forces[i] += (pressure + visc)/rhos[j];
+		forces[j] -= (pressure + visc)/rhos[i];
+	}
 }
 
-glm::vec3 WaterSystem::GetGridCell(glm::vec3 p) const {
-	int x_cell = std::min(grid_width_-1, std::max(0, (int)floor((p.x + box_width_/2.f)/grid_cell_width_)));
-	int y_cell = std::min(grid_height_-1, std::max(0, (int)floor((p.y + box_height_/2.f)/grid_cell_height_)));
-	int z_cell = std::min(grid_width_-1, std::max(0, (int)floor((p.z + box_width_/2.f)/grid_cell_width_)));
-	return glm::vec3(x_cell, y_cell, z_cell);
+template <class TKernels>
+void BasicWaterSystem<TKernels>::CalculateVectorized(const ParticleState& state,
+																			std::vector<float>& pressures,
+																			std::vector<float>& rhos,
+																			std::vector<glm::vec3>& forces) {
+	int n = state.positions.size();
+	// Both structures lay their cells out the same way, the hash only
+	// leaves out the empty ones
+	const std::vector<int>& sorted = use_spatial_hash_ ? hash_.GetSortedIndices() : grid_.GetSortedIndices();
+	ThreadPool& pool = ThreadPool::GetInstance();
+	sorted_state_.positions.resize(n);
+	sorted_state_.velocities.resize(n);
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			sorted_state_.positions[s] = state.positions[sorted[s]];
+			sorted_state_.velocities[s] = state.velocities[sorted[s]];
+		}
+	}, kParticleGrain);
+	if (use_spatial_hash_) {
+		hash_.GetCandidateRuns(candidate_runs_);
+	} else {
+		grid_.GetCandidateRuns(candidate_runs_);
+	}
+	sorted_rhos_.resize(n);
+	sorted_pressures_.resize(n);
+	sorted_forces_.resize(n);
+
+	SphKernelInput in;
+	in.cell_start = use_spatial_hash_ ? hash_.GetCellStarts().data() : grid_.GetCellStarts().data();
+	in.cell_count = use_spatial_hash_ ? hash_.GetCellCounts().data() : grid_.GetCellCounts().data();
+	in.runs = candidate_runs_.data();
+	in.px = sorted_state_.positions.x();
+	in.py = sorted_state_.positions.y();
+	in.pz = sorted_state_.positions.z();
+	in.vx = sorted_state_.velocities.x();
+	in.vy = sorted_state_.velocities.y();
+	in.vz = sorted_state_.velocities.z();
+	in.rho = sorted_rhos_.data();
+	in.pressure = sorted_pressures_.data();
+	SphKernelParams params;
+	GetSimdKernelParams<TKernels>(params);
+
+	// Each range of cells writes only the sorted particles inside of it
+	auto densities = [&](int begin, int end) {
+		ComputeDensities(simd_level_, in, params, begin, end, sorted_rhos_.data());
+		for (int s = in.cell_start[begin]; s < in.cell_start[end-1] + in.cell_count[end-1]; s++) {
+			sorted_pressures_[s] = GAS_CONST*(sorted_rhos_[s] - REST_DENS);
+		}
+	};
+	auto accelerations = [&](int begin, int end) {
+		ComputeForces(simd_level_, in, params, begin, end,
+									sorted_forces_.x(), sorted_forces_.y(), sorted_forces_.z());
+	};
+	if (use_sfc_partitioning_) {
+		ForEachPartitionRun(densities);
+		ForEachPartitionRun(accelerations);
+	} else {
+		pool.ParallelForBlocks(cell_blocks_, [&](int block, int begin, int end) {
+			densities(begin, end);
+		});
+		pool.ParallelForBlocks(cell_blocks_, [&](int block, int begin, int end) {
+			accelerations(begin, end);
+		});
+	}
+
+	pressures.resize(n);
+	rhos.resize(n);
+	forces.resize(n);
+	pool.ParallelFor(0, n, [&](int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int i = sorted[s];
+			rhos[i] = sorted_rhos_[s];
+			pressures[i] = sorted_pressures_[s];
+			forces[i] = glm::vec3(sorted_forces_[s]) + GRAVITY * sorted_rhos_[s];
+		}
+	}, kParticleGrain);
 }
 
+// Each policy gets its own copy of the passes, with the kernels inlined
+template class BasicWaterSystem<MullerKernels>;
+template class BasicWaterSystem<CubicSplineKernels>;
+template class BasicWaterSystem<WendlandKernels>;
+
 }
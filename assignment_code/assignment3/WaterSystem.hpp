@@ -3,62 +3,244 @@
 
 #include "ParticleState.hpp"
 #include "ParticleSystemBase.hpp"
-#include <set>
+#include "NeighborGrid.hpp"
+#include "SpatialHash.hpp"
+#include "NeighborList.hpp"
+#include "SphKernels.hpp"
+#include "SmoothingKernels.hpp"
+#include "SimulationBox.hpp"
+#include "SlabDecomposition.hpp"
+
+#include <memory>
 
 namespace GLOO {
 
  // solver parameters
 const static float REST_DENS = 12.2f;//10.f; // rest density
 const static float GAS_CONST = 20.f; // const for equation of state
-const static float H = .16f; // kernel radius
-const static float HSQ = H*H; // radius^2 for optimization
 const static float MASS = 1.9f; // assume all particles have the same mass
 const static float VISC = .5f;//2.50f; // viscosity constant
 
-// smoothing kernels defined in Müller and their gradients
-const static float POLY6 = 3.15f/(65.f*3.1415*pow(H, 9.f));
-const static float SPIKY_GRAD = -.45f/(3.1415*pow(H, 6.f));
-const static float VISC_LAP = .45f/(3.1415*pow(H, 6.f));
 const static glm::vec3 GRAVITY = glm::vec3(0.f, -20.f, 0.f);
 
-// const static float POLY6 = 315.f/(65.f*3.1415*pow(H, 9.f));
-// const static float SPIKY_GRAD = -45.f/(3.1415*pow(H, 6.f));
-// const static float VISC_LAP = 45.f/(3.1415*pow(H, 6.f));
-class WaterSystem : public ParticleSystemBase {
+// Smallest number of particles handed to a thread at once
+const static int kParticleGrain = 64;
+// Cell blocks per thread, enough for stealing to even out dense regions
+const static int kBlocksPerThread = 8;
+
+// Weakly compressible SPH with the smoothing kernels of TKernels, one of
+// the policies in SmoothingKernels.hpp. Instantiated in WaterSystem.cpp for
+// each of them.
+template <class TKernels>
+class BasicWaterSystem : public ParticleSystemBase {
  public:
 
-	WaterSystem();
-	virtual ~WaterSystem() {
+	BasicWaterSystem();
+	virtual ~BasicWaterSystem() {
   }
 
   ParticleState ComputeTimeDerivative(const ParticleState& state,
                                       float time) override;
+	void ComputeTimeDerivative(const ParticleState& state,
+														 float time,
+														 ParticleState& gradient) override;
+
+  void OnParticlesPermuted(const std::vector<int>& order) override;
+
+	float GetSmoothingLength() const override { return H; }
+	// The viscosity force is divided by the density once more
+	float GetKinematicViscosity() const override { return VISC/REST_DENS; }
+	float GetMaxAcceleration() const override { return max_acceleration_; }
+	// Density of every particle at the last ComputeTimeDerivative
+	const std::vector<float>& GetDensities() const { return rhos_; }
 
   void AddParticle(ParticleState& state, glm::vec3 position, glm::vec3 velocity);
+
+	// Switches to Verlet neighbor lists of radius H + skin, which are only
+	// rebuilt once some particle moved more than skin/2. H + skin may not
+	// exceed the grid cell size. Enabling them selects the scalar kernels.
+	void UseNeighborLists(bool enabled, float skin = 0.04f);
+	bool UsesNeighborLists() const { return use_neighbor_lists_; }
+	int GetNeighborListBuilds() const { return neighbors_.GetNumBuilds(); }
+
+	// Evaluates every interacting pair once and adds its contribution to both
+	// particles, instead of visiting each pair from both sides. Off by
+	// default. The pairs scatter into both particles, so these passes are
+	// single threaded: they run on the calling thread whatever the size of
+	// the thread pool, and only pay off when the simulation has one thread.
+	// Their sums don't depend on the thread count either, but add up in
+	// another order than the per-particle passes. Enabling them selects the
+	// scalar kernels.
+	void UseSymmetricPairs(bool enabled);
+	bool UsesSymmetricPairs() const { return use_symmetric_pairs_; }
+
+	// Bins the particles with a spatial hash of the occupied cells instead
+	// of the grid over the simulation box, for open domains. The grid clamps
+	// particles outside of the box into its border cells.
+	void UseSpatialHash(bool enabled);
+
+	// Rebins only the particles that changed grid cell since the last
+	// evaluation, unless more than rebuild_fraction of them did. Same
+	// results as rebinning all of them. Not used with the spatial hash.
+	void UseIncrementalRebinning(bool enabled, float rebuild_fraction = 0.01f);
+	const NeighborGrid::RebinStats& GetRebinStats() const { return grid_.GetRebinStats(); }
+	void ResetRebinStats() { grid_.ResetRebinStats(); }
+
+	// Gives every thread one contiguous piece of the cells along a Morton
+	// curve, so its particles stay close together in space, instead of the
+	// blocks in grid order. The pieces start out with the same particle
+	// count. Every rebalance_interval evaluations their cut points move so
+	// they take the same measured time. The per-particle passes, scalar or
+	// vectorized, use it; the pair passes run on one thread and ignore it.
+	void UseSfcPartitioning(bool enabled, int rebalance_interval = 20);
+	// Particles in each piece after the last binning
+	const std::vector<int>& GetPartitionSizes() const { return partition_sizes_; }
+
+	// Simulates only the particles of this process's slab, exchanging the
+	// ghosts within H of its faces on every evaluation. The derivative
+	// covers the owned particles. Migrating particles between slabs is up to
+	// the caller, as is keeping the processes on the same time step.
+	void SetDomain(std::shared_ptr<SlabDecomposition> domain);
+
+	// Selects the vectorized density and force kernels. Defaults to Scalar,
+	// the reference implementation. Levels the CPU lacks fall back to the
+	// best supported one. The vectorized kernels bin every evaluation and
+	// have no neighbor list or pair version, so any other level turns both
+	// off, and turning either back on returns to Scalar. Kernels other than
+	// MullerKernels have no vectorized version and always run the scalar
+	// passes.
+	void SetSimdLevel(SimdLevel level);
+	SimdLevel GetSimdLevel() const { return simd_level_; }
  private:
-	void CalculatePressure(const ParticleState& state, std::vector<float>& pressures, std::vector<float>& rhos) const;
+	// A pair of particles closer than H, found by the density pass
+	struct NeighborPair {
+		int i;
+		int j;
+		float d;
+	};
+
+	void CalculatePressure(const ParticleState& state, std::vector<float>& pressures, std::vector<float>& rhos);
 	void CalculateForces(const ParticleState& state,
-											 std::vector<float> pressures,
-											 std::vector<float> rhos,
-											 std::vector<glm::vec3>& forces) const;
+											 const std::vector<float>& pressures,
+											 const std::vector<float>& rhos,
+											 std::vector<glm::vec3>& forces);
+
+	// Same as above, but visiting each pair only once. The density pass
+	// records the interacting pairs and their distances in pairs_, which the
+	// force pass then reuses.
+	void CalculatePressurePairwise(const ParticleState& state, std::vector<float>& pressures, std::vector<float>& rhos);
+	void CalculateForcesPairwise(const ParticleState& state,
+															 const std::vector<float>& pressures,
+															 const std::vector<float>& rhos,
+															 std::vector<glm::vec3>& forces) const;
 
-	// Gets the grid cell a point is in
-	glm::vec3 GetGridCell(glm::vec3 p) const;
+	// Density, pressure and force of every particle with the vectorized
+	// kernels. These work on a copy of the state sorted by grid cell, so they
+	// always rebin and ignore neighbor lists and pair traversal.
+	void CalculateVectorized(const ParticleState& state,
+													 std::vector<float>& pressures,
+													 std::vector<float>& rhos,
+													 std::vector<glm::vec3>& forces);
 
-	// The width and height of the box
-	float box_width_ = 2.f; //TODO: Hardcoded in RK4Integrator and ParticleSystemNode
-	float box_height_ = 2.f;
+	// Rebuilds whichever neighbor structure is in use if it is out of date
+	void UpdateNeighbors(const ParticleState& state);
+	// Bins the particles into the grid or the spatial hash
+	void BinParticles(const ParticleState& state);
+	// Splits the cells into consecutive blocks of about the same particle
+	// count, the units the density and force passes are scheduled in
+	void UpdateCellBlocks();
+	// Sorts the occupied cells along the Morton curve and splits them at the
+	// current cut points
+	void UpdatePartitions();
+	// Moves the cut points so each piece gets the same share of the time
+	// measured since the last rebalance, assuming every particle of a piece
+	// costs the same
+	void RebalancePartitions();
+	// Cuts the curve into pieces of the same cost, where a particle costs
+	// rates[p] in the current piece p
+	void CutPartitions(const std::vector<double>& rates);
+	// Calls f(cell_begin, cell_end) for runs of cells adjacent in memory,
+	// one piece per block of the thread pool, and times every piece
+	template <class F>
+	void ForEachPartitionRun(F f);
+	// Calls f(begin, end) for ranges of the sorted particles on the thread
+	// pool, one per run of a piece with SFC partitioning, otherwise one per
+	// particle block
+	template <class F>
+	void ForEachParticleBlock(F f);
+	// Whether to use the pairwise passes instead of the per-particle ones
+	bool UsePairwisePasses() const;
+
+	// Calls f(j) for every particle j that may be within H of particle i
+	template <class F>
+	void ForEachNeighbor(const ParticleState& state, int i, F f) const;
+	// Calls f(i, j) once for every unordered pair that may be within H
+	template <class F>
+	void ForEachPair(F f) const;
 
 	// A grid based data structure to improve the speed of pressure/density calculations
-	std::vector<std::vector<std::vector<std::set<int>>>> grid_;
+	NeighborGrid grid_;
+
+  // Must divide evenly into BOX_WIDTH and BOX_HEIGHT, and be at least H
+	float grid_cell_size_ = 0.2f;
+	// Same cells as grid_, but only the occupied ones and without bounds
+	SpatialHash hash_;
+	bool use_spatial_hash_ = false;
+	bool use_incremental_rebinning_ = false;
 
-  // Must divide evenly into box_width_ and box_height_
-	float grid_cell_width_ = 0.2f;
-	float grid_cell_height_ = 0.2f;
+	NeighborList neighbors_;
+	bool use_neighbor_lists_ = false;
+	float skin_ = 0.f;
+	// Largest acceleration of the last ComputeTimeDerivative
+	float max_acceleration_ = 0.f;
 
-	int grid_width_;
-	int grid_height_;
+	bool use_symmetric_pairs_ = false;
+	std::vector<NeighborPair> pairs_;
+
+	// Per-particle results of the last ComputeTimeDerivative
+	std::vector<float> pressures_;
+	std::vector<float> rhos_;
+	std::vector<glm::vec3> forces_;
+
+	SimdLevel simd_level_ = SimdLevel::Scalar;
+	// The state sorted by grid cell and the kernel outputs in that order
+	ParticleState sorted_state_;
+	AlignedFloatArray sorted_rhos_;
+	AlignedFloatArray sorted_pressures_;
+	Vec3Array sorted_forces_;
+	std::vector<int> candidate_runs_;
+	// Block k is cells cell_blocks_[k] ... cell_blocks_[k+1]-1, which hold the
+	// sorted particles particle_blocks_[k] ... particle_blocks_[k+1]-1
+	std::vector<int> cell_blocks_;
+	std::vector<int> particle_blocks_;
+
+	bool use_sfc_partitioning_ = false;
+	int rebalance_interval_ = 20;
+	int evaluations_since_rebalance_ = 0;
+	// The occupied cells in Morton order, as (key, cell)
+	std::vector<std::pair<uint64_t, int>> sfc_cells_;
+	// Piece p holds the cells with keys in [partition_cuts_[p],
+	// partition_cuts_[p+1]). Keys instead of positions in sfc_cells_, so the
+	// cuts stay put while cells fill up and empty.
+	std::vector<uint64_t> partition_cuts_;
+	// Piece p is the runs partition_runs_[p] ... partition_runs_[p+1]-1,
+	// each the cells sfc_runs_[r].x ... sfc_runs_[r].y-1
+	std::vector<int> partition_runs_;
+	std::vector<glm::ivec2> sfc_runs_;
+	std::vector<int> partition_sizes_;
+	// Seconds spent in and particles handled by each piece since the last
+	// rebalance
+	std::vector<double> partition_times_;
+	std::vector<double> partition_particles_;
+
+	std::shared_ptr<SlabDecomposition> domain_;
+	// The owned particles followed by the ghosts
+	ParticleState halo_state_;
 };
+
+typedef BasicWaterSystem<MullerKernels> WaterSystem;
+typedef BasicWaterSystem<CubicSplineKernels> CubicSplineWaterSystem;
+typedef BasicWaterSystem<WendlandKernels> WendlandWaterSystem;
 }  // namespace GLOO
 
 #endif
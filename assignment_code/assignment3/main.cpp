@@ -1,25 +1,89 @@
 #include <iostream>
 #include <chrono>
 #include <string>
+#include <vector>
 #include <cstdio>
 #include <stdexcept>
 
 #include "SimulationApp.hpp"
 #include "IntegratorType.hpp"
+#include "SolverType.hpp"
+#include "KernelType.hpp"
+#include "ThreadPool.hpp"
+#include "DistributedSimulation.hpp"
 
 using namespace GLOO;
 
 int main(int argc, char** argv) {
-  if (argc != 3) {
-    printf("Usage: %s <e|t|r> <timestep>\n", argv[0]);
+  if (argc < 3) {
+    printf("Usage: %s <e|t|r|v> <timestep> [options]\n", argv[0]);
     printf("       e: Integrator: Forward Euler\n");
     printf("       t: Integrator: Trapezoid\n");
     printf("       r: Integrator: RK 4\n");
+    printf("       v: Integrator: Velocity Verlet (leapfrog)\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("       --threads=N: Simulate with N threads (default: all cores)\n");
+    printf("       --deterministic: Sum in a fixed order, so that runs give the\n");
+    printf("                      same bits for any --threads\n");
+    printf("       --adaptive-dt: Choose every step from the CFL, force and\n");
+    printf("                      viscosity conditions instead of <timestep>\n");
+    printf("       --min-dt=X, --max-dt=X: Bounds of the adaptive step\n");
+    printf("                      (default: 0.0001 and 0.01, imply --adaptive-dt)\n");
+    printf("       --solver=wcsph|pcisph|dfsph|pbf|flip: Pressure solver\n");
+    printf("                      (default: wcsph). PCISPH iterates the pressures\n");
+    printf("                      until the density error is under 1%%, DFSPH\n");
+    printf("                      corrects the velocities to 0.1%% and zero\n");
+    printf("                      divergence, PBF projects the positions a fixed\n");
+    printf("                      number of times, FLIP projects the velocities on\n");
+    printf("                      a grid. All four ignore <e|t|r|v>\n");
+    printf("       --pbf-iterations=N: PBF iterations per step (default: 4)\n");
+    printf("       --log-iterations: Print the iterations of PCISPH, DFSPH and\n");
+    printf("                      PBF after every step\n");
+    printf("       --flip-ratio=X: FLIP share of the FLIP/PIC blend, 1 is\n");
+    printf("                      pure FLIP, 0 pure PIC (default: 0.95)\n");
+    printf("       --kernel=muller|cubic|wendland: Smoothing kernels (default:\n");
+    printf("                      muller). Cubic spline and Wendland C2 have no\n");
+    printf("                      vectorized version (WCSPH only)\n");
+    printf("       --open-domain: Only keep the floor of the box, binning the\n");
+    printf("                      particles with a spatial hash (WCSPH only)\n");
+    printf("       --incremental-rebin=X: Only rebin the particles that changed\n");
+    printf("                      cell, unless more than the fraction X did\n");
+    printf("                      (WCSPH only, e.g. 0.01)\n");
+    printf("       --simd: Use the AVX2 or AVX-512 density and force kernels,\n");
+    printf("                      if the CPU has them, instead of the scalar\n");
+    printf("                      passes over neighbor lists (WCSPH with the\n");
+    printf("                      muller kernels only)\n");
+    printf("       --symmetric-pairs: Visit every interacting pair once, on a\n");
+    printf("                      single thread, instead of from both sides\n");
+    printf("                      (WCSPH only, pays off with --threads=1)\n");
+    printf("       --sfc-rebalance=N: Split the cells between the threads along\n");
+    printf("                      a Morton curve, moving the cuts every N\n");
+    printf("                      evaluations to even out their times (WCSPH only)\n");
+    printf("       --reorder-interval=N: Sort the particles along a Z-order\n");
+    printf("                      curve every N steps, 0 never (default: 100)\n");
+    printf("       --obstacle=FILE: Collide with the OBJ mesh assets/FILE, in\n");
+    printf("                      simulation coordinates (may be repeated)\n");
+    printf("       --ranks=N: Run a dam break without a window on N processes,\n");
+    printf("                      one slab of the box each (WCSPH only)\n");
+    printf("       --steps=N: Steps of the --ranks run (default: 1000)\n");
     printf("\n");
     printf("Try  : %s t 0.001\n", argv[0]);
     printf("       for trapezoid (1ms steps)\n");
     printf("Or   : %s r 0.005\n", argv[0]);
     printf("       for RK4 (5ms steps)\n");
+    printf("Or   : %s v 0.005\n", argv[0]);
+    printf("       for Velocity Verlet (5ms steps, one force evaluation each)\n");
+    printf("Or   : %s v 0.005 --solver=pcisph\n", argv[0]);
+    printf("       for PCISPH (5ms steps, about 1%% density error)\n");
+    printf("Or   : %s v 0.02 --solver=dfsph\n", argv[0]);
+    printf("       for DFSPH (20ms steps, about 0.1%% density error)\n");
+    printf("Or   : %s v 0.0166 --solver=pbf\n", argv[0]);
+    printf("       for PBF (one step per frame, about 0.5%% density error)\n");
+    printf("Or   : %s v 0.0166 --solver=flip\n", argv[0]);
+    printf("       for FLIP (one step per frame)\n");
+    printf("Or   : %s v 0.002 --ranks=4\n", argv[0]);
+    printf("       for a dam break on 4 processes (2ms steps)\n");
     return -1;
   }
 
@@ -34,14 +98,135 @@ int main(int argc, char** argv) {
     case 'r':
       integrator_type = IntegratorType::RK4;
       break;
+    case 'v':
+      integrator_type = IntegratorType::Verlet;
+      break;
     default:
       throw std::runtime_error(
           "Unrecognized integrator type: " + std::string(1, argv[1][0]) + ".");
   }
   float integration_step = std::stof(argv[2]);
 
+  bool adaptive_dt = false;
+  float min_dt = 1e-4f;
+  float max_dt = 1e-2f;
+  SolverType solver_type = SolverType::WCSPH;
+  KernelType kernel_type = KernelType::Muller;
+  int pbf_iterations = 4;
+  float flip_ratio = 0.95f;
+  bool log_iterations = false;
+  bool open_domain = false;
+  float rebuild_fraction = -1.f;
+  int sfc_interval = 0;
+  int reorder_interval = 100;
+  bool simd_kernels = false;
+  bool symmetric_pairs = false;
+  std::vector<std::string> obstacles;
+  int num_threads = 0;
+  bool deterministic = false;
+  int num_ranks = 0;
+  int steps = 1000;
+  for (int i = 3; i < argc; i++) {
+    std::string option(argv[i]);
+    if (option.compare(0, 10, "--threads=") == 0) {
+      num_threads = std::stoi(option.substr(10));
+    } else if (option == "--deterministic") {
+      deterministic = true;
+    } else if (option == "--adaptive-dt") {
+      adaptive_dt = true;
+    } else if (option.compare(0, 9, "--min-dt=") == 0) {
+      adaptive_dt = true;
+      min_dt = std::stof(option.substr(9));
+    } else if (option.compare(0, 9, "--max-dt=") == 0) {
+      adaptive_dt = true;
+      max_dt = std::stof(option.substr(9));
+    } else if (option == "--solver=wcsph") {
+      solver_type = SolverType::WCSPH;
+    } else if (option == "--solver=pcisph") {
+      solver_type = SolverType::PCISPH;
+    } else if (option == "--solver=dfsph") {
+      solver_type = SolverType::DFSPH;
+    } else if (option == "--solver=pbf") {
+      solver_type = SolverType::PBF;
+    } else if (option.compare(0, 17, "--pbf-iterations=") == 0) {
+      pbf_iterations = std::stoi(option.substr(17));
+    } else if (option == "--log-iterations") {
+      log_iterations = true;
+    } else if (option == "--solver=flip") {
+      solver_type = SolverType::FLIP;
+    } else if (option.compare(0, 13, "--flip-ratio=") == 0) {
+      flip_ratio = std::stof(option.substr(13));
+    } else if (option.compare(0, 20, "--incremental-rebin=") == 0) {
+      rebuild_fraction = std::stof(option.substr(20));
+    } else if (option.compare(0, 16, "--sfc-rebalance=") == 0) {
+      sfc_interval = std::stoi(option.substr(16));
+    } else if (option.compare(0, 19, "--reorder-interval=") == 0) {
+      reorder_interval = std::stoi(option.substr(19));
+    } else if (option == "--simd") {
+      simd_kernels = true;
+    } else if (option == "--symmetric-pairs") {
+      symmetric_pairs = true;
+    } else if (option == "--kernel=muller") {
+      kernel_type = KernelType::Muller;
+    } else if (option == "--kernel=cubic") {
+      kernel_type = KernelType::CubicSpline;
+    } else if (option == "--kernel=wendland") {
+      kernel_type = KernelType::Wendland;
+    } else if (option == "--open-domain") {
+      open_domain = true;
+    } else if (option.compare(0, 11, "--obstacle=") == 0) {
+      obstacles.push_back(option.substr(11));
+    } else if (option.compare(0, 8, "--ranks=") == 0) {
+      num_ranks = std::stoi(option.substr(8));
+    } else if (option.compare(0, 8, "--steps=") == 0) {
+      steps = std::stoi(option.substr(8));
+    } else {
+      throw std::runtime_error("Unrecognized option: " + option + ".");
+    }
+  }
+
+  // The processes are forked before the thread pool starts its workers
+  if (num_ranks > 0) {
+    RunDistributed(num_ranks, integrator_type, integration_step, steps,
+                   num_threads, deterministic);
+    return 0;
+  }
+  if (num_threads > 0) {
+    ThreadPool::GetInstance().SetNumThreads(num_threads);
+  }
+  ThreadPool::GetInstance().SetDeterministic(deterministic);
+
   std::unique_ptr<SimulationApp> app = make_unique<SimulationApp>(
       "Assignment3", glm::ivec2(1440, 900), integrator_type, integration_step);
+  if (adaptive_dt) {
+    app->UseAdaptiveTimeStep(min_dt, max_dt);
+  }
+  app->SetSolverType(solver_type);
+  app->SetKernelType(kernel_type);
+  app->SetPbfIterations(pbf_iterations);
+  app->SetFlipRatio(flip_ratio);
+  if (log_iterations) {
+    app->LogSolverIterations();
+  }
+  if (open_domain) {
+    app->UseOpenDomain();
+  }
+  if (rebuild_fraction >= 0.f) {
+    app->UseIncrementalRebinning(rebuild_fraction);
+  }
+  if (sfc_interval > 0) {
+    app->UseSfcPartitioning(sfc_interval);
+  }
+  app->SetReorderInterval(reorder_interval);
+  if (simd_kernels) {
+    app->UseSimdKernels();
+  }
+  if (symmetric_pairs) {
+    app->UseSymmetricPairs();
+  }
+  for (const std::string& obstacle : obstacles) {
+    app->AddObstacle(obstacle);
+  }
 
   app->SetupScene();
 
@@ -0,0 +1,140 @@
+// The boundaries must push a particle that crossed them back out and
+// reflect its velocity only while it still moves into the wall.
+
+#include <cstdio>
+#include <string>
+
+#include "BoxBoundary.hpp"
+#include "TestScene.hpp"
+#include "TriangleMeshBoundary.hpp"
+
+using namespace GLOO;
+
+namespace {
+const float kThickness = 0.02f;
+const float kRestitution = 0.3f;
+// The contact normal comes from the offset to the closest point, which
+// is only a few thousandths long
+const float kTolerance = 1e-4f;
+
+// Where a particle starts and where the boundary has to leave it
+struct Contact {
+	std::string name;
+	glm::vec3 position;
+	glm::vec3 velocity;
+	glm::vec3 expected_position;
+	glm::vec3 expected_velocity;
+};
+
+// Applies the boundary to every contact at once and checks each of them
+int CheckContacts(const std::string& name, const BoundaryBase& boundary,
+									const std::vector<Contact>& contacts) {
+	ParticleState state;
+	for (const Contact& contact : contacts) {
+		state.positions.push_back(contact.position);
+		state.velocities.push_back(contact.velocity);
+	}
+	boundary.Apply(state, 0, contacts.size());
+
+	int failures = 0;
+	for (size_t i = 0; i < contacts.size(); i++) {
+		const Contact& contact = contacts[i];
+		glm::vec3 p = state.positions[i];
+		glm::vec3 v = state.velocities[i];
+		TEST_CHECK(failures, glm::length(p - contact.expected_position) < kTolerance,
+							 "%s, %s: position (%g, %g, %g)", name.c_str(), contact.name.c_str(),
+							 p.x, p.y, p.z);
+		TEST_CHECK(failures, glm::length(v - contact.expected_velocity) < kTolerance,
+							 "%s, %s: velocity (%g, %g, %g)", name.c_str(), contact.name.c_str(),
+							 v.x, v.y, v.z);
+	}
+	std::printf("%s: %zu contacts checked\n", name.c_str(), contacts.size());
+	return failures;
+}
+
+// One triangle in the plane y = 0, the half of [-1, 1]^2 in x and z with
+// x + z <= 0
+int CheckSingleTriangle() {
+	PositionArray positions = {glm::vec3(-1.f, 0.f, -1.f), glm::vec3(1.f, 0.f, -1.f),
+														 glm::vec3(-1.f, 0.f, 1.f)};
+	IndexArray indices = {0, 2, 1};
+	TriangleMeshBoundary boundary(positions, indices, kThickness, kRestitution);
+	float r = kRestitution;
+	std::vector<Contact> contacts = {
+			{"from above", glm::vec3(-.5f, .01f, -.5f), glm::vec3(.3f, -1.f, 0.f),
+			 glm::vec3(-.5f, kThickness, -.5f), glm::vec3(.3f, r, 0.f)},
+			{"from below", glm::vec3(-.2f, -.005f, -.3f), glm::vec3(0.f, 2.f, .1f),
+			 glm::vec3(-.2f, -kThickness, -.3f), glm::vec3(0.f, -2.f * r, .1f)},
+			{"leaving", glm::vec3(-.5f, .01f, -.2f), glm::vec3(0.f, .5f, 0.f),
+			 glm::vec3(-.5f, kThickness, -.2f), glm::vec3(0.f, .5f, 0.f)},
+			{"far", glm::vec3(-.5f, .3f, -.5f), glm::vec3(0.f, -1.f, 0.f),
+			 glm::vec3(-.5f, .3f, -.5f), glm::vec3(0.f, -1.f, 0.f)},
+			// Past the hypotenuse the closest point is on the edge x + z = 0
+			{"beside", glm::vec3(.5f, .01f, .5f), glm::vec3(0.f, -1.f, 0.f),
+			 glm::vec3(.5f, .01f, .5f), glm::vec3(0.f, -1.f, 0.f)},
+	};
+	return CheckContacts("single triangle", boundary, contacts);
+}
+
+// The closed cube [-0.5, 0.5]^3, two triangles per face
+int CheckClosedMesh() {
+	PositionArray positions;
+	for (int i = 0; i < 8; i++) {
+		positions.push_back(glm::vec3((i & 1) ? .5f : -.5f, (i & 2) ? .5f : -.5f,
+																	(i & 4) ? .5f : -.5f));
+	}
+	IndexArray indices = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+												0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+												0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+	TriangleMeshBoundary boundary(positions, indices, kThickness, kRestitution);
+	float r = kRestitution;
+	float outside = .5f + kThickness;
+	float inside = .5f - kThickness;
+	// Away from the cube's edge along the diagonal of x and y
+	glm::vec3 diagonal = glm::normalize(glm::vec3(1.f, 1.f, 0.f));
+	glm::vec3 edge_contact = glm::vec3(.5f, .5f, .1f) + kThickness * diagonal;
+	std::vector<Contact> contacts = {
+			{"onto +x", glm::vec3(.51f, .1f, -.2f), glm::vec3(-1.f, .2f, 0.f),
+			 glm::vec3(outside, .1f, -.2f), glm::vec3(r, .2f, 0.f)},
+			{"onto -y", glm::vec3(.2f, -.505f, .3f), glm::vec3(.1f, 1.f, 0.f),
+			 glm::vec3(.2f, -outside, .3f), glm::vec3(.1f, -r, 0.f)},
+			{"onto the edge", glm::vec3(.505f, .505f, .1f), glm::vec3(-1.f, -1.f, 0.f),
+			 edge_contact, glm::vec3(r, r, 0.f)},
+			// Inside the cube is a container
+			{"inside +z", glm::vec3(.1f, .2f, .49f), glm::vec3(0.f, 0.f, 1.f),
+			 glm::vec3(.1f, .2f, inside), glm::vec3(0.f, 0.f, -r)},
+			{"center", glm::vec3(0.f), glm::vec3(1.f, 0.f, 0.f),
+			 glm::vec3(0.f), glm::vec3(1.f, 0.f, 0.f)},
+	};
+	return CheckContacts("closed mesh", boundary, contacts);
+}
+
+int CheckBox() {
+	BoxBoundary boundary(glm::vec3(-1.f), glm::vec3(1.f), kRestitution);
+	float r = kRestitution;
+	// Particles that crossed a wall end up eps inside of it
+	float eps = 0.001f;
+	std::vector<Contact> contacts = {
+			{"into -x", glm::vec3(-1.1f, 0.f, 0.f), glm::vec3(-2.f, .5f, 0.f),
+			 glm::vec3(-1.f + eps, 0.f, 0.f), glm::vec3(2.f * r, .5f, 0.f)},
+			{"into +y", glm::vec3(0.f, 1.05f, .5f), glm::vec3(0.f, 1.f, 0.f),
+			 glm::vec3(0.f, 1.f - eps, .5f), glm::vec3(0.f, -r, 0.f)},
+			// Already reflected by an earlier step, so it must not turn around
+			{"back from -z", glm::vec3(.3f, .2f, -1.02f), glm::vec3(0.f, 0.f, 1.f),
+			 glm::vec3(.3f, .2f, -1.f + eps), glm::vec3(0.f, 0.f, 1.f)},
+			{"back from +x", glm::vec3(1.01f, 0.f, 0.f), glm::vec3(-.4f, 0.f, 0.f),
+			 glm::vec3(1.f - eps, 0.f, 0.f), glm::vec3(-.4f, 0.f, 0.f)},
+			{"inside", glm::vec3(.9f, -.9f, 0.f), glm::vec3(1.f, -1.f, 1.f),
+			 glm::vec3(.9f, -.9f, 0.f), glm::vec3(1.f, -1.f, 1.f)},
+	};
+	return CheckContacts("box", boundary, contacts);
+}
+}  // namespace
+
+int main() {
+	int failures = 0;
+	failures += CheckSingleTriangle();
+	failures += CheckClosedMesh();
+	failures += CheckBox();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+// In deterministic mode every solver must produce the same bits on 1, 2
+// and 4 threads.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "DfSphSystem.hpp"
+#include "FlipSystem.hpp"
+#include "IntegratorFactory.hpp"
+#include "PbfSystem.hpp"
+#include "PciSphSystem.hpp"
+#include "TestScene.hpp"
+#include "ThreadPool.hpp"
+#include "WaterSystem.hpp"
+
+using namespace GLOO;
+
+namespace {
+const int kParticles = 2000;
+const int kThreadCounts[] = {1, 2, 4};
+
+// Steps a fresh system from the test scene, like the app does
+template <class TSystem, class FConfigure>
+ParticleState Simulate(FConfigure configure, IntegratorType integrator_type,
+											 float dt, int steps) {
+	TSystem system;
+	configure(system);
+	auto integrator = IntegratorFactory::CreateIntegrator<TSystem, ParticleState>(integrator_type);
+	ParticleState state = MakeTestScene(kParticles, 3);
+	for (int k = 0; k < steps; k++) {
+		integrator->Step(system, state, k * dt, dt);
+	}
+	return state;
+}
+
+bool SameBits(const Vec3Array& a, const Vec3Array& b) {
+	size_t bytes = a.size() * sizeof(float);
+	return a.size() == b.size() &&
+				 std::memcmp(a.x(), b.x(), bytes) == 0 &&
+				 std::memcmp(a.y(), b.y(), bytes) == 0 &&
+				 std::memcmp(a.z(), b.z(), bytes) == 0;
+}
+
+template <class TSystem, class FConfigure>
+int CheckSolver(const std::string& name, FConfigure configure,
+								IntegratorType integrator_type, float dt, int steps) {
+	int failures = 0;
+	ParticleState reference;
+	for (int num_threads : kThreadCounts) {
+		ThreadPool::GetInstance().SetNumThreads(num_threads);
+		ParticleState state = Simulate<TSystem>(configure, integrator_type, dt, steps);
+		if (num_threads == kThreadCounts[0]) {
+			reference = state;
+			continue;
+		}
+		TEST_CHECK(failures, SameBits(state.positions, reference.positions),
+							 "%s: positions on %d threads differ from %d thread", name.c_str(),
+							 num_threads, kThreadCounts[0]);
+		TEST_CHECK(failures, SameBits(state.velocities, reference.velocities),
+							 "%s: velocities on %d threads differ from %d thread", name.c_str(),
+							 num_threads, kThreadCounts[0]);
+	}
+	std::printf("%s: %d steps checked\n", name.c_str(), steps);
+	return failures;
+}
+
+template <class TSystem>
+void KeepDefaults(TSystem& system) {
+}
+}  // namespace
+
+int main() {
+	ThreadPool::GetInstance().SetDeterministic(true);
+	int failures = 0;
+	failures += CheckSolver<WaterSystem>("WCSPH, neighbor lists", [](WaterSystem& system) {
+		system.UseNeighborLists(true);
+	}, IntegratorType::Verlet, 0.005f, 40);
+	failures += CheckSolver<WaterSystem>("WCSPH, neighbor lists, SFC pieces", [](WaterSystem& system) {
+		system.UseNeighborLists(true);
+		system.UseSfcPartitioning(true, 5);
+	}, IntegratorType::Verlet, 0.005f, 40);
+	failures += CheckSolver<WaterSystem>("WCSPH, symmetric pairs",[](WaterSystem& system) {
+		system.UseSymmetricPairs(true);
+	}, IntegratorType::Verlet, 0.005f, 20);
+	failures += CheckSolver<WaterSystem>("WCSPH, vectorized", [](WaterSystem& system) {
+		system.SetSimdLevel(DetectSimdLevel());
+		system.UseSfcPartitioning(true, 5);
+	}, IntegratorType::Verlet, 0.005f, 40);
+	failures += CheckSolver<PciSphSystem>("PCISPH", KeepDefaults<PciSphSystem>,
+																				IntegratorType::SolverStep, 0.005f, 20);
+	failures += CheckSolver<DfSphSystem>("DFSPH", KeepDefaults<DfSphSystem>,
+																			 IntegratorType::SolverStep, 0.01f, 10);
+	failures += CheckSolver<PbfSystem>("PBF", KeepDefaults<PbfSystem>,
+																		 IntegratorType::SolverStep, 0.0166f, 10);
+	failures += CheckSolver<FlipSystem>("FLIP", KeepDefaults<FlipSystem>,
+																			IntegratorType::SolverStep, 0.01f, 20);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// Running the dam break on several processes must conserve the particles
+// across migrations and end up where the single process run does. The
+// slabs must also reject rank counts that make them too narrow.
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "DistributedSimulation.hpp"
+#include "SlabDecomposition.hpp"
+#include "TestScene.hpp"
+#include "Transport.hpp"
+
+using namespace GLOO;
+
+namespace {
+const int kRanks = 5;
+const int kSteps = 60;
+const float kDt = 0.002f;
+// Ghosts arrive in another order than the particles of a single process,
+// so the sums round differently. The dam break amplifies that: after about
+// 70 steps even the scalar and vectorized kernels disagree by more than
+// this on a single process, so the run stops before. The velocities take
+// the differences of the accelerations straight away and drift further.
+const float kPositionTolerance = 1e-4f;
+const float kVelocityTolerance = 5e-3f;
+// Whether a particle bounces off a wall is decided by a threshold, which
+// rounding can tip either way, so the particles touching a wall only have
+// to be matched
+const float kWallContact = 1e-3f;
+
+// Reports the rank count without connecting any processes, enough for the
+// constructor of SlabDecomposition
+class IdleTransport : public Transport {
+ public:
+	explicit IdleTransport(int num_ranks) : num_ranks_(num_ranks) {
+	}
+	int GetRank() const override { return 0; }
+	int GetNumRanks() const override { return num_ranks_; }
+	void Exchange(int peer, const std::vector<char>& send,
+								std::vector<char>& receive) override {
+		throw std::runtime_error("IdleTransport can't exchange.");
+	}
+
+ private:
+	int num_ranks_;
+};
+
+bool Accepts(int num_ranks, float radius, float skin) {
+	try {
+		SlabDecomposition(std::make_shared<IdleTransport>(num_ranks), BOX_MIN, BOX_SIZE,
+											radius, skin);
+		return true;
+	} catch (const std::runtime_error& error) {
+		std::printf("%d ranks: %s\n", num_ranks, error.what());
+		return false;
+	}
+}
+
+int CheckSlabWidth() {
+	int failures = 0;
+	// The halo is 2 * 0.16 + 0.04, the slabs have to fit it plus the skin
+	TEST_CHECK(failures, Accepts(1, .16f, .04f), "one rank rejected");
+	TEST_CHECK(failures, Accepts(4, .16f, .04f), "4 slabs of 0.5 rejected");
+	TEST_CHECK(failures, !Accepts(6, .16f, .04f), "6 slabs of 0.33 accepted");
+	// Wider than the halo 0.6, but not than the halo plus the skin 0.7
+	TEST_CHECK(failures, !Accepts(3, .2f, .2f), "3 slabs of 0.67 accepted");
+	return failures;
+}
+
+bool TouchesWall(glm::vec3 p) {
+	glm::vec3 inside = glm::min(p - BOX_MIN, BOX_MAX - p);
+	return std::min(inside.x, std::min(inside.y, inside.z)) < kWallContact;
+}
+
+// Index of the particle of state closest to p
+int FindClosest(const ParticleState& state, glm::vec3 p) {
+	int closest = -1;
+	float closest_d2 = 0.f;
+	for (int i = 0; i < (int)state.positions.size(); i++) {
+		glm::vec3 d = glm::vec3(state.positions[i]) - p;
+		float d2 = glm::dot(d, d);
+		if (closest < 0 || d2 < closest_d2) {
+			closest = i;
+			closest_d2 = d2;
+		}
+	}
+	return closest;
+}
+
+int CompareRuns(const DistributedRun& split, const DistributedRun& single) {
+	int failures = 0;
+	int n = single.particles.positions.size();
+	TEST_CHECK(failures, split.migrated > 0, "no particle migrated");
+	TEST_CHECK(failures, (int)split.particles.positions.size() == n,
+						 "%d particles on %d ranks, %d on one", (int)split.particles.positions.size(),
+						 kRanks, n);
+	// The particles of the two runs are in different orders, but closer to
+	// their counterparts than to any other particle
+	std::vector<int> matches(split.particles.positions.size(), 0);
+	float max_position_error = 0.f;
+	float max_velocity_error = 0.f;
+	for (int i = 0; i < n; i++) {
+		glm::vec3 p = single.particles.positions[i];
+		glm::vec3 v = single.particles.velocities[i];
+		int j = FindClosest(split.particles, p);
+		if (j < 0) {
+			break;
+		}
+		matches[j]++;
+		glm::vec3 split_p = split.particles.positions[j];
+		glm::vec3 split_v = split.particles.velocities[j];
+		if (!TouchesWall(p)) {
+			max_position_error = std::max(max_position_error, glm::length(split_p - p));
+			max_velocity_error = std::max(max_velocity_error, RelativeError(split_v, v, 1.f));
+		}
+	}
+	int unmatched = 0;
+	for (int count : matches) {
+		unmatched += count != 1;
+	}
+	TEST_CHECK(failures, unmatched == 0, "%d particles not matched one to one", unmatched);
+	TEST_CHECK(failures, max_position_error < kPositionTolerance, "position error %g", max_position_error);
+	TEST_CHECK(failures, max_velocity_error < kVelocityTolerance, "velocity error %g", max_velocity_error);
+	std::printf("%d particles, %d migrated in %d migrations, position error %g, velocity error %g\n",
+							n, split.migrated, split.migrations, max_position_error, max_velocity_error);
+	return failures;
+}
+}  // namespace
+
+int main() {
+	// The processes are forked before the thread pool starts its workers.
+	// Only rank 0 goes on to check the results.
+	DistributedRun split = RunDistributed(kRanks, IntegratorType::Verlet, kDt, kSteps, 1, true);
+	if (split.rank != 0) {
+		return 0;
+	}
+	DistributedRun single = RunDistributed(1, IntegratorType::Verlet, kDt, kSteps, 1, true);
+
+	int failures = 0;
+	failures += CheckSlabWidth();
+	failures += CompareRuns(split, single);
+	return failures == 0 ? 0 : 1;
+}
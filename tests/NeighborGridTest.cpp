@@ -0,0 +1,171 @@
+// NeighborGrid::Update must leave the grid exactly as a full Build would,
+// whether it relocates the movers or falls back to rebinning everything,
+// and the parallel counting sort must give the same grid as the serial one.
+// The neighbor lists built from it on several threads must hold exactly
+// the pairs a brute force search finds.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "NeighborGrid.hpp"
+#include "NeighborList.hpp"
+#include "TestScene.hpp"
+#include "ThreadPool.hpp"
+
+using namespace GLOO;
+
+namespace {
+const float kCellSize = 0.2f;
+
+// Compares everything Build leaves behind: the cell of every particle, the
+// range of every cell and the particle order within the ranges
+int CompareGrids(const std::string& name, const NeighborGrid& actual,
+								 const NeighborGrid& expected, int n) {
+	int failures = 0;
+	TEST_CHECK(failures, actual.GetCellStarts() == expected.GetCellStarts(),
+						 "%s: cell starts differ", name.c_str());
+	TEST_CHECK(failures, actual.GetCellCounts() == expected.GetCellCounts(),
+						 "%s: cell counts differ", name.c_str());
+	TEST_CHECK(failures, actual.GetSortedIndices() == expected.GetSortedIndices(),
+						 "%s: sorted indices differ", name.c_str());
+	int cell_mismatches = 0;
+	for (int i = 0; i < n; i++) {
+		cell_mismatches += actual.GetParticleCell(i) != expected.GetParticleCell(i);
+	}
+	TEST_CHECK(failures, cell_mismatches == 0, "%s: %d particle cells differ",
+						 name.c_str(), cell_mismatches);
+	return failures;
+}
+
+// Moves a random share of the particles by up to a cell and a half each,
+// some of them out of the box, which clamps them into the border cells
+void MoveParticles(ParticleState& state, float share, TestRandom& random) {
+	int n = state.positions.size();
+	for (int i = 0; i < n; i++) {
+		if (random.Next() >= share) {
+			continue;
+		}
+		glm::vec3 p = state.positions[i];
+		float step = 1.5f * kCellSize;
+		p += glm::vec3(random.Next(-step, step), random.Next(-step, step), random.Next(-step, step));
+		state.positions[i] = p;
+	}
+}
+
+// Updates one grid and rebuilds another after every round of moves. Every
+// share in shares is used for one round, in order.
+int CheckUpdate(const std::string& name, const std::vector<float>& shares,
+								int expected_incremental, int expected_fallbacks) {
+	const int n = 5000;
+	ParticleState state = MakeTestScene(n, 7);
+	TestRandom random(11);
+	NeighborGrid updated(BOX_MIN, BOX_SIZE, kCellSize);
+	NeighborGrid rebuilt(BOX_MIN, BOX_SIZE, kCellSize);
+	updated.SetRebuildFraction(0.01f);
+	updated.Update(state.positions);
+	updated.ResetRebinStats();
+
+	int failures = 0;
+	for (size_t round = 0; round < shares.size(); round++) {
+		MoveParticles(state, shares[round], random);
+		updated.Update(state.positions);
+		rebuilt.Build(state.positions);
+		failures += CompareGrids(name + ", round " + std::to_string(round), updated, rebuilt, n);
+	}
+	const NeighborGrid::RebinStats& stats = updated.GetRebinStats();
+	TEST_CHECK(failures, stats.incremental_updates == expected_incremental,
+						 "%s: %d incremental updates, expected %d", name.c_str(),
+						 stats.incremental_updates, expected_incremental);
+	TEST_CHECK(failures, stats.full_rebuilds == expected_fallbacks,
+						 "%s: %d fallbacks, expected %d", name.c_str(),
+						 stats.full_rebuilds, expected_fallbacks);
+	std::printf("%s: %d incremental updates moving %lld particles, %d fallbacks\n",
+							name.c_str(), stats.incremental_updates, stats.moved_particles,
+							stats.full_rebuilds);
+	return failures;
+}
+
+// Builds the same particles on one thread and on num_threads. Build sorts
+// in parallel from two chunks of kBinGrain (16384) particles on, with the
+// last chunk shorter whenever n is not a multiple of the chunk size.
+int CheckParallelSort(int n, int num_threads, float cell_size) {
+	ParticleState state = MakeTestScene(n, n);
+	NeighborGrid serial(BOX_MIN, BOX_SIZE, cell_size);
+	NeighborGrid parallel(BOX_MIN, BOX_SIZE, cell_size);
+	ThreadPool::GetInstance().SetNumThreads(1);
+	serial.Build(state.positions);
+	ThreadPool::GetInstance().SetNumThreads(num_threads);
+	parallel.Build(state.positions);
+	std::string name = std::to_string(n) + " particles, " + std::to_string(num_threads) +
+										 " threads, " + std::to_string(parallel.GetNumCells()) + " cells";
+	return CompareGrids(name, parallel, serial, n);
+}
+// Builds full and half lists on num_threads and checks every list against
+// all particles within the cutoff, in index order
+int CheckNeighborLists(int n, int num_threads) {
+	const float radius = 0.15f;
+	const float skin = 0.03f;
+	float cutoff2 = (radius + skin) * (radius + skin);
+	ParticleState state = MakeTestScene(n, 13);
+	ThreadPool::GetInstance().SetNumThreads(num_threads);
+	NeighborGrid grid(BOX_MIN, BOX_SIZE, kCellSize);
+	grid.Build(state.positions);
+
+	int failures = 0;
+	for (bool half : {false, true}) {
+		NeighborList lists;
+		lists.Build(grid, state.positions, radius, skin, half);
+		int wrong_lists = 0;
+		for (int i = 0; i < n; i++) {
+			std::vector<int> expected;
+			glm::vec3 p = state.positions[i];
+			for (int j = half ? i + 1 : 0; j < n; j++) {
+				glm::vec3 d = glm::vec3(state.positions[j]) - p;
+				if (glm::dot(d, d) < cutoff2) {
+					expected.push_back(j);
+				}
+			}
+			std::vector<int> actual;
+			lists.ForEachNeighbor(i, [&](int j) {
+				actual.push_back(j);
+			});
+			std::sort(actual.begin(), actual.end());
+			wrong_lists += actual != expected;
+		}
+		TEST_CHECK(failures, wrong_lists == 0, "%d %s lists on %d threads differ from brute force",
+							 wrong_lists, half ? "half" : "full", num_threads);
+		// Nothing moved, so the lists are still good
+		TEST_CHECK(failures, !lists.NeedsRebuild(state.positions), "unmoved lists need a rebuild");
+		ParticleState moved = state;
+		moved.positions[n - 1] = glm::vec3(moved.positions[n - 1]) + glm::vec3(0.f, .6f * skin, 0.f);
+		TEST_CHECK(failures, lists.NeedsRebuild(moved.positions),
+							 "a move of over half the skin on %d threads kept the lists", num_threads);
+	}
+	return failures;
+}
+}  // namespace
+
+int main() {
+	int failures = 0;
+	for (int n : {2 * 16384 + 1, 3 * 16384 - 1, 100003}) {
+		for (int num_threads : {2, 3, 4, 7}) {
+			failures += CheckParallelSort(n, num_threads, kCellSize);
+			failures += CheckParallelSort(n, num_threads, 0.05f);
+		}
+	}
+
+	for (int num_threads : {1, 3, 4}) {
+		failures += CheckNeighborLists(3001, num_threads);
+	}
+
+	ThreadPool::GetInstance().SetNumThreads(2);
+	// Well under the 1% rebuild fraction, and no moves at all
+	failures += CheckUpdate("incremental", {0.002f, 0.f, 0.004f, 0.001f, 0.003f}, 5, 0);
+	// Far over it
+	failures += CheckUpdate("fallback", {0.2f, 0.5f}, 0, 2);
+	// Switching between the two, so an update follows a fallback
+	failures += CheckUpdate("mixed", {0.002f, 0.1f, 0.003f, 0.3f, 0.001f}, 3, 2);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// The symmetric pair passes of the WCSPH solver must give the densities
+// and forces of the per-particle passes, up to the order of the sums.
+
+#include <cstdio>
+#include <string>
+
+#include "TestScene.hpp"
+#include "ThreadPool.hpp"
+#include "WaterSystem.hpp"
+
+using namespace GLOO;
+
+namespace {
+const int kParticles = 3000;
+const float kTolerance = 1e-4f;
+
+// Evaluates the scene with and without pairs under the same neighbor
+// search and compares the results
+template <class TSystem>
+int CompareSearch(const std::string& name, const ParticleState& state,
+									bool neighbor_lists, bool spatial_hash) {
+	TSystem reference;
+	TSystem pairwise;
+	for (TSystem* system : {&reference, &pairwise}) {
+		system->UseNeighborLists(neighbor_lists);
+		system->UseSpatialHash(spatial_hash);
+	}
+	pairwise.UseSymmetricPairs(true);
+
+	ParticleState expected;
+	ParticleState actual;
+	reference.ComputeTimeDerivative(state, 0.f, expected);
+	pairwise.ComputeTimeDerivative(state, 0.f, actual);
+
+	int failures = 0;
+	const std::vector<float>& rho = reference.GetDensities();
+	const std::vector<float>& pair_rho = pairwise.GetDensities();
+	TEST_CHECK(failures, rho.size() == pair_rho.size(), "%s: %zu densities, expected %zu",
+						 name.c_str(), pair_rho.size(), rho.size());
+	float rho_error = 0.f;
+	float accel_error = 0.f;
+	for (size_t i = 0; i < rho.size() && i < pair_rho.size(); i++) {
+		rho_error = std::max(rho_error, RelativeError(pair_rho[i], rho[i], 1e-3f));
+		glm::vec3 a = actual.velocities[i];
+		glm::vec3 b = expected.velocities[i];
+		accel_error = std::max(accel_error, RelativeError(a, b, 1e-3f));
+	}
+	TEST_CHECK(failures, rho_error < kTolerance, "%s: density error %g", name.c_str(), rho_error);
+	TEST_CHECK(failures, accel_error < kTolerance, "%s: acceleration error %g", name.c_str(), accel_error);
+	std::printf("%s: density error %g, acceleration error %g\n", name.c_str(), rho_error, accel_error);
+	return failures;
+}
+
+template <class TSystem>
+int CompareKernels(const std::string& name, const ParticleState& state) {
+	int failures = 0;
+	failures += CompareSearch<TSystem>(name + ", grid", state, false, false);
+	failures += CompareSearch<TSystem>(name + ", neighbor lists", state, true, false);
+	failures += CompareSearch<TSystem>(name + ", spatial hash", state, false, true);
+	return failures;
+}
+}  // namespace
+
+int main() {
+	// The per-particle passes run on every thread, the pairs on one
+	ThreadPool::GetInstance().SetNumThreads(2);
+	ParticleState state = MakeTestScene(kParticles, 1);
+
+	int failures = 0;
+	failures += CompareKernels<WaterSystem>("Muller", state);
+	failures += CompareKernels<CubicSplineWaterSystem>("cubic spline", state);
+	failures += CompareKernels<WendlandWaterSystem>("Wendland", state);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+// A field baked from a cube must hold the analytic signed distances, deep
+// inside as well as near the surface, survive a round trip through its
+// cache file and interpolate its nodes trilinearly.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "SignedDistanceField.hpp"
+#include "TestScene.hpp"
+#include "ThreadPool.hpp"
+
+using namespace GLOO;
+
+namespace {
+const float kCellSize = 0.05f;
+// Exact distances only differ by rounding, the lookups by the rounding of
+// the interpolation weights
+const float kTolerance = 1e-4f;
+const char kCachePath[] = "SignedDistanceFieldTest.sdf";
+
+// A cube of half extent half centered at center and rotated by transform
+struct Cube {
+	glm::mat4 transform;
+	glm::vec3 half;
+
+	// Signed distance from the analytic formula, in the frame of the cube
+	float Distance(glm::vec3 p) const {
+		glm::vec3 local = glm::vec3(glm::inverse(transform) * glm::vec4(p, 1.f));
+		glm::vec3 q = glm::abs(local) - half;
+		float outside = glm::length(glm::max(q, glm::vec3(0.f)));
+		return outside + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+	}
+
+	void MakeMesh(PositionArray& positions, IndexArray& indices) const {
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 corner((i & 1) ? half.x : -half.x, (i & 2) ? half.y : -half.y,
+											 (i & 4) ? half.z : -half.z);
+			positions.push_back(glm::vec3(transform * glm::vec4(corner, 1.f)));
+		}
+		// Two triangles per face, wound outwards
+		const unsigned int faces[12][3] = {
+				{0, 2, 1}, {1, 2, 3}, {4, 5, 6}, {5, 7, 6},  // z
+				{0, 1, 4}, {1, 5, 4}, {2, 6, 3}, {3, 6, 7},  // y
+				{0, 4, 2}, {2, 4, 6}, {1, 3, 5}, {3, 7, 5}};  // x
+		for (const auto& face : faces) {
+			indices.insert(indices.end(), face, face + 3);
+		}
+	}
+};
+
+float NodeValue(const SignedDistanceField& sdf, glm::ivec3 node) {
+	return sdf.Sample(sdf.GetMin() + glm::vec3(node) * kCellSize);
+}
+
+// Every node against the analytic distance, which also has to hold where
+// the parity rays run along the faces and edges of the cube
+int CheckNodes(const std::string& name, const SignedDistanceField& sdf, const Cube& cube) {
+	int failures = 0;
+	glm::ivec3 res = glm::ivec3(glm::round((sdf.GetMax() - sdf.GetMin()) / kCellSize)) + 1;
+	float max_error = 0.f;
+	int wrong_signs = 0;
+	for (int x = 0; x < res.x; x++) {
+		for (int y = 0; y < res.y; y++) {
+			for (int z = 0; z < res.z; z++) {
+				glm::vec3 p = sdf.GetMin() + glm::vec3(x, y, z) * kCellSize;
+				float expected = cube.Distance(p);
+				float actual = NodeValue(sdf, glm::ivec3(x, y, z));
+				max_error = std::max(max_error, std::fabs(actual - expected));
+				// Nodes on the surface may take either sign
+				wrong_signs += std::fabs(expected) > kTolerance && (actual < 0.f) != (expected < 0.f);
+			}
+		}
+	}
+	TEST_CHECK(failures, max_error < kTolerance, "%s: distance error %g", name.c_str(), max_error);
+	TEST_CHECK(failures, wrong_signs == 0, "%s: %d nodes with the wrong sign", name.c_str(), wrong_signs);
+	std::printf("%s: %d nodes, distance error %g\n", name.c_str(), res.x * res.y * res.z, max_error);
+	return failures;
+}
+
+// The center is twice the band away from the surface and must still get
+// its distance and a gradient out of the cube
+int CheckCenter(const std::string& name, const SignedDistanceField& sdf, const Cube& cube) {
+	int failures = 0;
+	glm::vec3 center = glm::vec3(cube.transform[3]);
+	glm::vec3 p = center + glm::vec3(.7f, .2f, .1f) * cube.half;
+	float d = sdf.Sample(p);
+	TEST_CHECK(failures, std::fabs(d - cube.Distance(p)) < kTolerance,
+						 "%s: deep distance %g, expected %g", name.c_str(), d, cube.Distance(p));
+	glm::vec3 g = sdf.SampleGradient(p);
+	glm::vec3 x_axis = glm::vec3(cube.transform[0]);
+	// The closest face is the +x one, but the trilinear gradient is only
+	// exact where the field is linear on the cell
+	TEST_CHECK(failures, glm::dot(g, x_axis) > .9f, "%s: deep gradient (%g, %g, %g)",
+						 name.c_str(), g.x, g.y, g.z);
+	return failures;
+}
+
+// Sample has to be the trilinear interpolation of the nodes around p
+int CheckLookup(const std::string& name, const SignedDistanceField& sdf, const Cube& cube) {
+	int failures = 0;
+	TestRandom random(5);
+	float max_error = 0.f;
+	for (int i = 0; i < 1000; i++) {
+		glm::vec3 p(random.Next(sdf.GetMin().x, sdf.GetMax().x),
+								random.Next(sdf.GetMin().y, sdf.GetMax().y),
+								random.Next(sdf.GetMin().z, sdf.GetMax().z));
+		glm::vec3 g = (p - sdf.GetMin()) / kCellSize;
+		glm::ivec3 c = glm::ivec3(glm::floor(g));
+		glm::vec3 t = g - glm::vec3(c);
+		float expected = 0.f;
+		for (int corner = 0; corner < 8; corner++) {
+			glm::ivec3 o(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+			glm::vec3 w = glm::mix(glm::vec3(1.f) - t, t, glm::vec3(o));
+			expected += w.x * w.y * w.z * cube.Distance(sdf.GetMin() + glm::vec3(c + o) * kCellSize);
+		}
+		max_error = std::max(max_error, std::fabs(sdf.Sample(p) - expected));
+	}
+	TEST_CHECK(failures, max_error < kTolerance, "%s: lookup error %g", name.c_str(), max_error);
+	return failures;
+}
+
+int CheckCube(const std::string& name, const Cube& cube) {
+	PositionArray positions;
+	IndexArray indices;
+	cube.MakeMesh(positions, indices);
+	SignedDistanceField sdf = SignedDistanceField::Bake(positions, indices, kCellSize);
+	int failures = 0;
+	TEST_CHECK(failures, !sdf.IsEmpty(), "%s: empty field", name.c_str());
+	if (sdf.IsEmpty()) {
+		return failures;
+	}
+	failures += CheckNodes(name, sdf, cube);
+	failures += CheckCenter(name, sdf, cube);
+	failures += CheckLookup(name, sdf, cube);
+	return failures;
+}
+
+bool SameField(const SignedDistanceField& a, const SignedDistanceField& b) {
+	if (a.GetMin() != b.GetMin() || a.GetMax() != b.GetMax()) {
+		return false;
+	}
+	TestRandom random(9);
+	for (int i = 0; i < 100; i++) {
+		glm::vec3 p = glm::mix(a.GetMin(), a.GetMax(),
+													 glm::vec3(random.Next(), random.Next(), random.Next()));
+		if (a.Sample(p) != b.Sample(p)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int CheckCache(const Cube& cube) {
+	int failures = 0;
+	PositionArray positions;
+	IndexArray indices;
+	cube.MakeMesh(positions, indices);
+	std::remove(kCachePath);
+	SignedDistanceField baked = SignedDistanceField::LoadOrBake(positions, indices, kCellSize,
+																															kCachePath);
+	TEST_CHECK(failures, std::ifstream(kCachePath).good(), "no cache written");
+
+	SignedDistanceField loaded;
+	TEST_CHECK(failures, loaded.Load(kCachePath, baked.GetKey()), "cache not loaded");
+	TEST_CHECK(failures, SameField(loaded, baked), "cache differs from the bake");
+	SignedDistanceField cached = SignedDistanceField::LoadOrBake(positions, indices, kCellSize,
+																															 kCachePath);
+	TEST_CHECK(failures, SameField(cached, baked), "LoadOrBake differs from the bake");
+
+	// Other settings must not pick up the cache
+	SignedDistanceField other;
+	TEST_CHECK(failures, !other.Load(kCachePath, baked.GetKey() + 1), "cache of other input loaded");
+	SignedDistanceField coarse = SignedDistanceField::Bake(positions, indices, 2.f * kCellSize);
+	TEST_CHECK(failures, coarse.GetKey() != baked.GetKey(), "cell size not part of the key");
+
+	// Nor a truncated file
+	{
+		std::ifstream in(kCachePath, std::ios::binary);
+		std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		std::ofstream out(kCachePath, std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), bytes.size() / 2);
+	}
+	TEST_CHECK(failures, !other.Load(kCachePath, baked.GetKey()), "truncated cache loaded");
+	TEST_CHECK(failures, other.IsEmpty(), "truncated cache left data behind");
+	std::remove(kCachePath);
+	return failures;
+}
+}  // namespace
+
+int main() {
+	ThreadPool::GetInstance().SetNumThreads(3);
+	Cube aligned;
+	aligned.transform = glm::translate(glm::mat4(1.f), glm::vec3(.1f, -.2f, .05f));
+	aligned.half = glm::vec3(.4f, .45f, .5f);
+	Cube rotated = aligned;
+	rotated.transform = glm::rotate(aligned.transform, .5f, glm::normalize(glm::vec3(1.f, 2.f, 0.f)));
+
+	int failures = 0;
+	failures += CheckCube("aligned cube", aligned);
+	failures += CheckCube("rotated cube", rotated);
+	failures += CheckCache(aligned);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#ifndef TEST_SCENE_H_
+#define TEST_SCENE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ParticleState.hpp"
+#include "SimulationBox.hpp"
+
+// Helpers shared by the simulation tests. A test is an executable that
+// returns nonzero when one of its checks failed.
+namespace GLOO {
+
+// Reports a failed check and counts it
+#define TEST_CHECK(failures, condition, ...) \
+	do { \
+		if (!(condition)) { \
+			std::printf("%s:%d: ", __FILE__, __LINE__); \
+			std::printf(__VA_ARGS__); \
+			std::printf("\n"); \
+			(failures)++; \
+		} \
+	} while (0)
+
+// Same sequence on every platform, unlike rand()
+class TestRandom {
+ public:
+	explicit TestRandom(unsigned int seed) : state_(seed) {
+	}
+	// Uniform in [0, 1)
+	float Next() {
+		state_ = state_ * 1664525u + 1013904223u;
+		return (state_ >> 8) * (1.f / 16777216.f);
+	}
+	float Next(float lo, float hi) {
+		return lo + (hi - lo) * Next();
+	}
+
+ private:
+	unsigned int state_;
+};
+
+// count particles scattered over the lower half of the box, with small
+// random velocities
+inline ParticleState MakeTestScene(int count, unsigned int seed) {
+	TestRandom random(seed);
+	ParticleState state;
+	for (int i = 0; i < count; i++) {
+		glm::vec3 p(random.Next(BOX_MIN.x, BOX_MAX.x),
+								random.Next(BOX_MIN.y, 0.f),
+								random.Next(BOX_MIN.z, BOX_MAX.z));
+		glm::vec3 v(random.Next(-.1f, .1f), random.Next(-.1f, .1f), random.Next(-.1f, .1f));
+		state.positions.push_back(p);
+		state.velocities.push_back(v);
+	}
+	return state;
+}
+
+// |a - b| relative to the larger of |b| and floor
+inline float RelativeError(float a, float b, float floor) {
+	return std::fabs(a - b) / std::max(std::fabs(b), floor);
+}
+
+inline float RelativeError(glm::vec3 a, glm::vec3 b, float floor) {
+	return glm::length(a - b) / std::max(glm::length(b), floor);
+}
+
+}  // namespace GLOO
+
+#endif